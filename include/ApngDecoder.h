@@ -0,0 +1,152 @@
+/**
+ * Animated png (acTL, fcTL and fdAT chunks) playback. Each frame is
+ * decoded through the same inflate and unfilter pipeline as a still image
+ * and composited row by row into one canvas that is reused for every
+ * frame, so the work per frame follows the size of the frame rectangle
+ * rather than the size of the canvas.
+*/
+
+#ifndef APNG_DECODER_HEADER
+#define APNG_DECODER_HEADER
+
+#include <cstdint>
+#include <vector>
+#include <optional>
+
+#include "Png.h"
+#include "Color.h"
+#include "pixel_conversion.h"
+#include "row_pipeline.h"
+#include "DecoderContext.h"
+
+enum class DisposeOp : unsigned char {
+    None,
+    Background,
+    Previous,
+};
+
+enum class BlendOp : unsigned char {
+    Source,
+    Over,
+};
+
+struct FrameRect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct FrameControl {
+    uint32_t sequence_number;
+    FrameRect rect;
+    uint16_t delay_numerator;
+    uint16_t delay_denominator;
+    DisposeOp dispose_op;
+    BlendOp blend_op;
+};
+
+struct AnimationFrame {
+    FrameControl control;
+    /**
+     * Indexes into the chunks of the png. Either the IDAT chunks, when the
+     * default image is the first frame, or the fdAT chunks of the frame.
+    */
+    std::vector<int> data_chunk_indexes;
+    bool uses_IDAT;
+};
+
+struct Animation {
+    uint32_t number_of_plays;
+    std::vector<AnimationFrame> frames;
+};
+
+/**
+ * @return nullopt if png has no acTL chunk or the frame chunks are not
+ * consistent with it and the canvas, including fcTL and fdAT sequence
+ * numbers that do not count up from 0 in chunk order.
+*/
+std::optional<Animation> read_animation(const Png& png);
+
+class ApngDecoder {
+    struct Keyframe {
+        uint32_t frame;
+        std::vector<Color> canvas;
+        // Pixels under the frame rectangle, needed when it disposes to previous
+        std::vector<Color> saved_region;
+    };
+
+    const Png& png_;
+    Animation animation_;
+    ColorTables tables_;
+    std::vector<Color> canvas_;
+    std::vector<Color> saved_region_;
+    std::vector<Color> row_pixels_;
+    // Inflate and unfilter buffers, reset before every frame
+    DecoderContext scratch_;
+    // -1 while nothing has been drawn
+    int64_t current_frame_;
+    FrameRect dirty_rect_;
+
+    uint32_t keyframe_interval_;
+    std::size_t keyframe_budget_;
+    // Oldest first
+    std::vector<Keyframe> keyframes_;
+    std::size_t keyframe_bytes_;
+
+    void clear_canvas();
+    void dispose_current_frame();
+    PipelineStatus draw_frame(const AnimationFrame& frame);
+    void cache_keyframe(const AnimationFrame& frame);
+    void save_region(const FrameRect& rect);
+    void restore_region(const FrameRect& rect);
+
+public:
+    /**
+     * @param keyframe_interval the canvas is cached after every
+     * keyframe_interval-th frame so that seek() can start from the closest
+     * cached frame instead of frame 0. 0 turns caching off.
+     * @param keyframe_budget bytes the cached canvases may take up, the
+     * oldest are dropped to make room for new ones.
+    */
+    ApngDecoder(const Png& png, uint32_t keyframe_interval = 0, std::size_t keyframe_budget = std::size_t{64} << 20);
+
+    bool is_animated() const;
+    uint32_t frame_count() const;
+    const Animation& get_animation() const;
+    /**
+     * @brief disposes the current frame and draws the next one.
+     * @return false after the last frame, the canvas is left untouched.
+     * Also false if the image data of the next frame is damaged, it is
+     * then the current frame with the rows before the damage drawn.
+    */
+    bool next_frame();
+    /**
+     * @brief makes frame the current one, replaying from the closest cached
+     * keyframe or from the current frame if that is closer.
+     * @return false if frame does not exist or a frame on the way to it is
+     * damaged, the current frame is then the damaged one.
+    */
+    bool seek(uint32_t frame);
+    /**
+     * @brief -1 before the first call to next_frame() or seek().
+    */
+    int64_t current_frame() const;
+    /**
+     * @brief canvas width * canvas height pixels in RGBA, not premultiplied.
+    */
+    const std::vector<Color>& canvas() const;
+    /**
+     * @brief the part of the canvas that changed with the last next_frame(),
+     * the whole canvas after a seek().
+    */
+    const FrameRect& dirty_rect() const;
+
+    ApngDecoder() = delete;
+    ApngDecoder(const ApngDecoder& other) = delete;
+    ApngDecoder(ApngDecoder&& other) = delete;
+    ApngDecoder& operator=(const ApngDecoder& other) = delete;
+    ApngDecoder& operator=(ApngDecoder&& other) = delete;
+};
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * Reads a list of files ahead of the consumer so that decoding one file
+ * overlaps with the reads of the next ones. At most queue_depth files are
+ * in flight at any time. Files are opened, stat'ed and read through
+ * io_uring when the kernel allows it and supports IORING_OP_OPENAT,
+ * IORING_OP_STATX and IORING_OP_READ (5.6 on), so on slow storage the whole
+ * fetch overlaps with decoding. Otherwise a small pool of threads does the
+ * same with open, fstat and pread.
+*/
+
+#ifndef BATCH_LOADER_HEADER
+#define BATCH_LOADER_HEADER
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+#include "PngByte.h"
+
+struct LoadedFile {
+    std::string path;
+    std::vector<PngByte> data;
+    bool success;
+};
+
+class BatchLoader {
+    struct Slot {
+        std::vector<PngByte> data;
+        std::size_t bytes_read;
+        int fd;
+        bool done;
+        bool success;
+        // io_uring only: the open and stat that have not completed yet, and
+        // whether one of them failed
+        int pending;
+        bool failed;
+    };
+    struct IoUring;
+
+    std::vector<std::string> file_paths_;
+    std::size_t queue_depth_;
+    /**
+     * File i lives in slots_[i % queue_depth_] from the moment its read is
+     * submitted until next() hands it out.
+    */
+    std::vector<Slot> slots_;
+    std::size_t next_to_submit_;
+    std::size_t next_to_return_;
+
+    std::unique_ptr<IoUring> ring_;
+
+    std::mutex mutex_;
+    std::condition_variable slot_done_;
+    std::condition_variable slot_free_;
+    std::vector<std::thread> workers_;
+    bool stopping_;
+
+    /**
+     * @brief opens file index and sizes its slot. Returns false and marks
+     * the slot done if the file can not be opened.
+    */
+    bool open_slot(std::size_t index);
+    void submit_uring_reads();
+    /**
+     * @brief queues the read of file index once its open and stat have
+     * completed, or finishes its slot if either failed or it is empty.
+    */
+    void start_uring_read(std::size_t index);
+    void wait_uring_completion();
+    void worker_loop();
+
+public:
+    /**
+     * @param queue_depth maximum number of files read ahead of the consumer.
+     * @param number_of_threads size of the pread pool, only used when
+     * io_uring is unavailable.
+     * @param allow_io_uring false always reads with the pread pool.
+    */
+    BatchLoader(
+        const std::vector<std::string>& file_paths,
+        std::size_t queue_depth = 8,
+        std::size_t number_of_threads = 4,
+        bool allow_io_uring = true
+    );
+    ~BatchLoader();
+
+    /**
+     * @brief blocks until the next file in list order has been read.
+     * @return false once every file has been handed out.
+    */
+    bool next(LoadedFile& file);
+    bool using_io_uring() const;
+
+    BatchLoader() = delete;
+    BatchLoader(const BatchLoader& other) = delete;
+    BatchLoader(BatchLoader&& other) = delete;
+    BatchLoader& operator=(const BatchLoader& other) = delete;
+    BatchLoader& operator=(BatchLoader&& other) = delete;
+};
+
+#endif
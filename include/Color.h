@@ -0,0 +1,11 @@
+#ifndef COLOR_HEADER
+#define COLOR_HEADER
+
+struct Color {
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+    unsigned char a;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * Keeps decoded images around for pngs that are decoded again and again.
+ * Entries are keyed by a hash of everything in the png that decoding reads
+ * (IHDR, palette, transparency, colour chunks and the IDAT bytes) together
+ * with the output format and scale, so the same asset under a different
+ * path still hits. Images are handed out as shared pointers to const, a hit
+ * costs a hash of the file and a lookup instead of a decode.
+ *
+ * Keys are compared by hash, dimensions and total IDAT length, not by the
+ * bytes themselves: two different pngs that agree on all of these would
+ * share an entry. With a 64 bit hash that takes about 2^32 distinct images
+ * of the same size before it becomes likely, and that risk is accepted in
+ * return for not keeping a copy of every file around.
+*/
+
+#ifndef DECODE_CACHE_HEADER
+#define DECODE_CACHE_HEADER
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <future>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+#include "Png.h"
+#include "decode.h"
+#include "pixel_format.h"
+
+/**
+ * @brief 64 bit hash of the chunks of png that decoding depends on.
+*/
+uint64_t content_hash(const Png& png);
+
+struct DecodeCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    // Lookups that waited for another thread decoding the same key
+    // instead of decoding themselves, counted in neither of the above
+    uint64_t coalesced;
+    uint64_t evictions;
+    std::size_t bytes;
+    std::size_t entries;
+};
+
+class DecodeCache {
+public:
+    using ImagePtr = std::shared_ptr<const DecodedImage>;
+    /**
+     * Decodes png into format on a miss, in place of decode().
+    */
+    using Decoder = std::function<std::optional<DecodedImage>(const Png& png, const PixelFormat& format)>;
+
+private:
+    struct Key {
+        uint64_t hash;
+        // Sum of the IDAT chunk lengths, a cheap second check on the hash
+        uint64_t idat_length;
+        uint32_t width;
+        uint32_t height;
+        PixelFormat format;
+        // 0 for a full decode, a ThumbnailScale otherwise
+        unsigned char scale;
+        bool adam7_coarse_passes;
+
+        friend bool operator==(const Key& a, const Key& b) = default;
+    };
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const;
+    };
+    struct Entry {
+        Key key;
+        ImagePtr image;
+        std::size_t bytes;
+    };
+    /**
+     * Each shard is an LRU list under its own mutex, most recently used at
+     * the front. in_flight holds the decodes that have been started but not
+     * finished so that concurrent misses on one key decode once. If that
+     * decode throws, its waiters get the exception and the key is free
+     * to be decoded again.
+    */
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+        std::unordered_map<Key, std::shared_future<ImagePtr>, KeyHash> in_flight;
+        std::size_t bytes;
+    };
+
+    std::vector<Shard> shards_;
+    std::size_t shard_budget_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> coalesced_;
+    std::atomic<uint64_t> evictions_;
+
+    ImagePtr get_or_decode(const Key& key, const std::function<std::optional<DecodedImage>()>& decode_image);
+    void evict(Shard& shard, std::size_t incoming_bytes);
+
+public:
+    /**
+     * @param byte_budget upper bound on the pixel bytes held, split evenly
+     * between the shards. Images bigger than one shard's part are decoded
+     * but not kept, with the default that is anything over 1/16 of the
+     * budget. A cache of few, large images wants fewer shards, with one
+     * shard a single image may take up the whole budget.
+    */
+    DecodeCache(std::size_t byte_budget, std::size_t number_of_shards = 16);
+
+    /**
+     * @return the cached image or the result of decode(png, format), nullptr
+     * if png can not be decoded.
+    */
+    ImagePtr get(const Png& png, const PixelFormat& format = rgba8);
+    /**
+     * @brief like get(), decoding with decoder on a miss, e.g. to pass a
+     * DecoderContext. The entry is shared with get(), so decoder has to
+     * give what decode(png, format) would. Whatever decoder throws is
+     * rethrown to this caller and to those waiting on the same key.
+    */
+    ImagePtr get(const Png& png, const PixelFormat& format, const Decoder& decoder);
+    /**
+     * @brief like get(), for decode_thumbnail().
+    */
+    ImagePtr get_thumbnail(const Png& png, ThumbnailScale scale, bool adam7_coarse_passes = true, const PixelFormat& format = rgba8);
+
+    DecodeCacheStats stats() const;
+    /**
+     * @brief drops every entry, images already handed out stay valid.
+    */
+    void clear();
+
+    DecodeCache() = delete;
+    DecodeCache(const DecodeCache& other) = delete;
+    DecodeCache(DecodeCache&& other) = delete;
+    DecodeCache& operator=(const DecodeCache& other) = delete;
+    DecodeCache& operator=(DecodeCache&& other) = delete;
+};
+
+#endif
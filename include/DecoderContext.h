@@ -0,0 +1,76 @@
+/**
+ * Scratch memory for decoding. All transient buffers of a decode (huffman
+ * tables, code lengths, the inflate window, scanline buffers, the chunk
+ * index of a Png) can be served from one DecoderContext. Resetting it
+ * between images is O(1) and keeps every block it has grown, so decoding
+ * a stream of images settles into making no calls to malloc at all.
+*/
+
+#ifndef DECODER_CONTEXT_HEADER
+#define DECODER_CONTEXT_HEADER
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+/**
+ * Bump allocator. deallocate() does nothing, memory only comes back with
+ * reset().
+*/
+class Arena : public std::pmr::memory_resource {
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+    std::vector<Block> blocks_;
+    std::size_t current_block_;
+    std::size_t offset_;
+    std::size_t next_block_size_;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+public:
+    explicit Arena(std::size_t initial_size);
+    /**
+     * @brief starts handing out memory from the first block again.
+    */
+    void reset();
+    std::size_t bytes_reserved() const;
+
+    Arena(const Arena& other) = delete;
+    Arena(Arena&& other) = delete;
+    Arena& operator=(const Arena& other) = delete;
+    Arena& operator=(Arena&& other) = delete;
+};
+
+class DecoderContext {
+    Arena arena_;
+
+public:
+    explicit DecoderContext(std::size_t initial_size = 1 << 20);
+
+    std::pmr::memory_resource* resource();
+    /**
+     * @brief frees everything allocated from this context at once. Nothing
+     * that was allocated from it, including a Png built on it, may be used
+     * afterwards.
+    */
+    void reset();
+    std::size_t bytes_reserved() const;
+
+    DecoderContext(const DecoderContext& other) = delete;
+    DecoderContext(DecoderContext&& other) = delete;
+    DecoderContext& operator=(const DecoderContext& other) = delete;
+    DecoderContext& operator=(DecoderContext&& other) = delete;
+};
+
+/**
+ * @brief the memory resource of context, or the default resource when
+ * there is no context.
+*/
+std::pmr::memory_resource* scratch_resource(DecoderContext* context);
+
+#endif
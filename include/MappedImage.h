@@ -0,0 +1,108 @@
+/**
+ * Decoded pixels that live in a file instead of on the heap, for images too
+ * large to hold in memory. The file is mapped shared and written through
+ * the mapping in the layout of DecodedImage::data. As the decode moves
+ * down the image, every tile of finished rows is handed back to the page
+ * cache with madvise, and the file is msynced every so many bytes. So the
+ * pages of the output that are resident stay around one tile, however
+ * large the image.
+*/
+
+#ifndef MAPPED_IMAGE_HEADER
+#define MAPPED_IMAGE_HEADER
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "Png.h"
+#include "pixel_format.h"
+#include "DecoderContext.h"
+
+class MappedImage {
+    int fd_;
+    unsigned char* data_;
+    uint64_t size_;
+    uint32_t width_;
+    uint32_t height_;
+    PixelFormat format_;
+    // Rows handed back to the page cache at once
+    uint32_t tile_rows_;
+    // Bytes released between two msyncs
+    uint64_t sync_interval_;
+    // Rows above this one were released during the current pass
+    uint32_t released_rows_;
+    uint32_t stored_rows_;
+    uint64_t unsynced_bytes_;
+    bool write_failed_;
+
+    /**
+     * @brief hands the whole pages inside rows first .. end - 1 of every
+     * plane back to the page cache, msyncing first when sync_interval_ bytes
+     * have piled up.
+    */
+    void release_rows(uint32_t first, uint32_t end);
+
+public:
+    /**
+     * @brief creates or truncates the file at path and reserves
+     * bytes_per_image(format, width, height) bytes for it.
+     * @param tile_rows rows released at a time, bigger tiles mean fewer
+     * system calls and more resident memory.
+     * @param sync_interval bytes written between two msyncs, which keeps
+     * the dirty pages of the file bounded as well.
+    */
+    MappedImage(
+        const std::string& path,
+        uint32_t width,
+        uint32_t height,
+        const PixelFormat& format = rgba8,
+        uint32_t tile_rows = 64,
+        uint64_t sync_interval = uint64_t{256} << 20
+    );
+    /**
+     * @brief finish()es if that was not done yet.
+    */
+    ~MappedImage();
+
+    /**
+     * @brief false if the file could not be created, sized or mapped.
+    */
+    bool is_open() const;
+    unsigned char* data();
+    uint64_t size() const;
+    uint32_t width() const;
+    uint32_t height() const;
+    const PixelFormat& format() const;
+
+    /**
+     * @brief a StoreProgress for decode_into(), releases each tile as soon
+     * as the pass leaves it.
+    */
+    void rows_stored(uint32_t rows);
+    /**
+     * @brief msyncs all of the file, unmaps and closes it.
+     * @return false if any write back failed.
+    */
+    bool finish();
+
+    MappedImage() = delete;
+    MappedImage(const MappedImage& other) = delete;
+    MappedImage(MappedImage&& other) = delete;
+    MappedImage& operator=(const MappedImage& other) = delete;
+    MappedImage& operator=(MappedImage&& other) = delete;
+};
+
+/**
+ * @brief decodes png into a new file at path, see MappedImage. Apart from
+ * the png itself, memory use is the row pipeline and one tile.
+ * @return false if png cannot be decoded or the file could not be written.
+*/
+bool decode_to_file(
+    const Png& png,
+    const std::string& path,
+    const PixelFormat& format = rgba8,
+    DecoderContext* context = nullptr
+);
+
+#endif
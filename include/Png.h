@@ -6,6 +6,7 @@
 #include <iostream>
 #include <fstream>
 #include <cstdint>
+#include <memory_resource>
 
 #include "PngByte.h"
 
@@ -33,13 +34,17 @@ class Png {
      * but try no to copy bytes to other structures.
     */
     std::vector<PngByte> data_;
-    std::vector<Chunk> chunks_;
+    /**
+     * Grows one chunk at a time, allocated from the resource given to the
+     * constructor so that a DecoderContext can serve it.
+    */
+    std::pmr::vector<Chunk> chunks_;
     IHDR header_;
     /**
      * Indexes into the chunks_ vector. The size of this vector indicates how many
      * IDAT chunks there are.
     */
-    std::vector<int> IDAT_chunk_indexes;
+    std::pmr::vector<int> IDAT_chunk_indexes;
 
     std::string file_path;
 
@@ -49,6 +54,15 @@ class Png {
      * @brief copies file to data_
     */
     void load_data_from_file_path();
+    /**
+     * @brief validates data_ and fills chunks_ and header_. Shared by both
+     * constructors once data_ holds the file.
+    */
+    void parse();
+    /**
+     * @return true if every check passed. parse() wraps it to time it.
+    */
+    bool parse_steps();
     bool validate_png_signature();
     /**
      * @brief IHDR chunk has to be present and first! Assumes that 
@@ -56,6 +70,10 @@ class Png {
      * called.
     */
     bool validate_IHDR();
+    /**
+     * @brief fills IDAT_chunk_indexes. There has to be at least one IDAT
+     * chunk and all of them have to be consecutive.
+    */
     bool validate_IDAT();
 
     /** 
@@ -68,11 +86,46 @@ class Png {
     void populate_header();
 
 public:
-    Png(const std::string& path_to_image);
-    ~Png();
-    void print_data_hex(int width = 16) const;
+    /**
+     * @param resource serves the chunk index, it has to outlive the Png.
+    */
+    Png(
+        const std::string& path_to_image,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    );
+    /**
+     * @brief takes bytes that were already read, e.g. by BatchLoader.
+     * path_to_image is only used for diagnostics.
+    */
+    Png(
+        const std::string& path_to_image,
+        std::vector<PngByte>&& file_data,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    );
+    /**
+     * @brief writes the file size and then every byte of the file to out,
+     * width bytes per line.
+    */
+    void print_data_hex(std::ostream& out, int width = 16) const;
     uint32_t get_uint32_t_h(std::size_t index_into_data) const;
 
+    /**
+     * @brief true when the signature, IHDR and IDAT chunks were all valid.
+     * Nothing below is meaningful otherwise.
+    */
+    bool is_parsed() const;
+    const IHDR& get_header() const;
+    const std::pmr::vector<Chunk>& get_chunks() const;
+    const std::pmr::vector<int>& get_IDAT_chunk_indexes() const;
+    /**
+     * @return first chunk with the four character name or nullptr.
+    */
+    const Chunk* find_chunk(const char* name) const;
+    /**
+     * @brief points into data_, valid for chunk.length bytes.
+    */
+    const unsigned char* get_chunk_data(const Chunk& chunk) const;
+
 
     Png() = delete;
     Png(const Png& other) = delete;
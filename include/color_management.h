@@ -0,0 +1,86 @@
+/**
+ * Opt-in conversion of decoded colour samples from the transfer curve a png
+ * declares through its gAMA, sRGB and iCCP chunks to linear light or sRGB.
+ * Alpha is never touched.
+*/
+
+#ifndef COLOR_MANAGEMENT_HEADER
+#define COLOR_MANAGEMENT_HEADER
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Png.h"
+#include "pixel_format.h"
+
+struct Chromaticities {
+    double white_x;
+    double white_y;
+    double red_x;
+    double red_y;
+    double green_x;
+    double green_y;
+    double blue_x;
+    double blue_y;
+};
+
+/**
+ * What the ancillary colour chunks of a png say.
+*/
+struct ColorInfo {
+    bool has_gamma;
+    // gAMA value, 100000 times the encoding exponent
+    uint32_t gamma;
+    bool is_srgb;
+    unsigned char srgb_rendering_intent;
+    bool has_chromaticities;
+    Chromaticities chromaticities;
+    bool has_icc_profile;
+    std::string icc_profile_name;
+};
+
+ColorInfo read_color_info(const Png& png);
+
+using TransferTable = std::array<unsigned char, 256>;
+
+/**
+ * Maps samples from the curve of one png to an output curve.
+*/
+struct TransferCurve {
+    // Samples pass through untouched when false
+    bool active;
+    bool source_is_srgb;
+    // 1 / encoding exponent, only used when !source_is_srgb
+    float source_exponent;
+    TransferFunction output;
+    // For 8 bit (and smaller, after scaling) samples
+    const TransferTable* table;
+};
+
+/**
+ * @details An iCCP profile overrides gAMA and cHRM but is not interpreted,
+ * so with one the samples pass through as encoded (the curve is not
+ * active) rather than taken through a gamma the file does not mean. The
+ * sRGB chunk wins over gAMA, and without any of them sRGB is assumed, as
+ * the spec suggests. cHRM is reported by read_color_info() but primaries
+ * are not converted, only the transfer curve is.
+ * Tables are built once per distinct source curve and output and cached
+ * for the life of the process.
+*/
+TransferCurve make_transfer_curve(const ColorInfo& info, TransferFunction output);
+
+inline unsigned char transfer_8(const TransferCurve& curve, unsigned char sample) {
+    return (*curve.table)[sample];
+}
+
+/**
+ * @brief takes count contiguous 16 bit samples through an active curve
+ * to 8 bits, with kernels().transfer_16: log2 and exp2 by polynomial,
+ * within one step of the 8 bit output pow would give and on the same one
+ * for all but about 0.1% of samples, four or eight samples at a time.
+*/
+void transfer_16(const TransferCurve& curve, const uint16_t* samples, std::size_t count, unsigned char* out);
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * Runtime selection of the hot kernels. Each kernel is built once per
+ * instruction set target in its own translation unit, and the first call
+ * to kernels() binds the fastest build the CPU supports. One binary then
+ * runs on anything from a plain x86-64 host to AVX-512, and the scalar
+ * builds are used everywhere else.
+ *
+ * The environment variable BITMAP_KERNELS overrides the choice per kernel
+ * for benchmarking, e.g. BITMAP_KERNELS="crc32=scalar,unfilter=sse4" or
+ * BITMAP_KERNELS="all=avx2". Kernels are crc32, adler32, unfilter,
+ * palette, swizzle, copy_match, reduce, premultiply, float and transfer16;
+ * targets are scalar, sse4, avx2 and avx512. A target the CPU can not run,
+ * or that a kernel has no build for, falls back to the best one below it.
+*/
+
+#ifndef CPU_DISPATCH_HEADER
+#define CPU_DISPATCH_HEADER
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Color.h"
+
+struct CpuFeatures {
+    bool ssse3;
+    bool sse41;
+    bool pclmul;
+    bool avx2;
+    bool avx512f;
+    bool avx512bw;
+};
+
+/**
+ * @brief detected once, all false on CPUs other than x86.
+*/
+const CpuFeatures& cpu_features();
+
+enum class KernelTarget {
+    Scalar,
+    // SSSE3, SSE4.1 and PCLMULQDQ
+    SSE4,
+    AVX2,
+    // AVX-512 F and BW
+    AVX512,
+    Count,
+};
+
+bool target_supported(KernelTarget target);
+const char* target_name(KernelTarget target);
+
+enum class Kernel {
+    Crc32,
+    Adler32,
+    Unfilter,
+    ExpandPalette,
+    Swizzle,
+    CopyMatch,
+    ReduceRow,
+    Premultiply,
+    WidenToFloat,
+    Transfer16,
+    Count,
+};
+
+/**
+ * @brief the CRC-32 of png chunks and gzip, continuing from crc. 0 starts
+ * a new checksum.
+*/
+using Crc32Kernel = uint32_t (*)(uint32_t crc, const unsigned char* bytes, std::size_t size);
+/**
+ * @brief the Adler-32 of zlib streams, continuing from adler. 1 starts a
+ * new checksum.
+*/
+using Adler32Kernel = uint32_t (*)(uint32_t adler, const unsigned char* bytes, std::size_t size);
+/**
+ * @brief reverses one png filter in place, see unfilter_row().
+*/
+using UnfilterKernel = void (*)(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+/**
+ * @brief out[i] = palette[indexes[i]] for 8 bit indexes.
+*/
+using ExpandPaletteKernel = void (*)(const unsigned char* indexes, std::size_t count, const Color* palette, Color* out);
+/**
+ * @brief writes count pixels to out in BGRA order.
+*/
+using SwizzleKernel = void (*)(const Color* pixels, std::size_t count, unsigned char* out);
+/**
+ * @brief the deflate match copy, out[i] = out[i - distance] for i in
+ * 0 .. length - 1, front to back so that short distances repeat.
+*/
+using CopyMatchKernel = void (*)(unsigned char* out, std::size_t distance, std::size_t length);
+
+/**
+ * @brief adds each run of 1 << shift pixels (the last one may be shorter)
+ * to one group of four sums in sums: red, green and blue each weighted by
+ * alpha, and alpha. shift is 1 to 3.
+*/
+using ReduceRowKernel = void (*)(const Color* pixels, std::size_t count, int shift, uint32_t* sums);
+/**
+ * @brief multiplies red, green and blue by alpha in place, rounded as
+ * multiply_alpha().
+*/
+using PremultiplyKernel = void (*)(Color* pixels, std::size_t count);
+/**
+ * @brief writes each pixel to out as four floats R, G, B, A in 0 .. 1,
+ * 16 bytes per pixel in native byte order. With premultiply red, green
+ * and blue are then multiplied by alpha.
+*/
+using WidenToFloatKernel = void (*)(const Color* pixels, std::size_t count, bool premultiply, unsigned char* out);
+
+/**
+ * @brief takes count 16 bit samples through a transfer curve to 8 bits,
+ * see transfer_16() in color_management.h. The source is the sRGB curve
+ * or, if !source_is_srgb, x^source_exponent; the output linear light or
+ * sRGB.
+*/
+using Transfer16Kernel = void (*)(
+    const uint16_t* samples,
+    std::size_t count,
+    bool source_is_srgb,
+    float source_exponent,
+    bool linear_output,
+    unsigned char* out
+);
+
+/**
+ * copy_match may write up to this many bytes past out + length.
+*/
+constexpr std::size_t CopyMatchSlack = 64;
+
+struct Kernels {
+    Crc32Kernel crc32;
+    Adler32Kernel adler32;
+    UnfilterKernel unfilter_sub;
+    UnfilterKernel unfilter_up;
+    UnfilterKernel unfilter_average;
+    UnfilterKernel unfilter_paeth;
+    ExpandPaletteKernel expand_palette;
+    SwizzleKernel swizzle_rgba_to_bgra;
+    CopyMatchKernel copy_match;
+    ReduceRowKernel reduce_row;
+    PremultiplyKernel premultiply_alpha;
+    WidenToFloatKernel widen_to_float;
+    Transfer16Kernel transfer_16;
+    // The target each kernel was requested as, after the override
+    KernelTarget targets[static_cast<std::size_t>(Kernel::Count)];
+};
+
+/**
+ * @brief the bound kernels, chosen on the first call.
+*/
+const Kernels& kernels();
+
+#endif
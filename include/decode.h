@@ -0,0 +1,119 @@
+/**
+ * Turns a parsed Png into pixels. Every colour type, bit depth and Adam7
+ * interlacing are converted to RGBA and then stored in the requested
+ * PixelFormat.
+*/
+
+#ifndef DECODE_HEADER
+#define DECODE_HEADER
+
+#include <cstdint>
+#include <vector>
+#include <optional>
+#include <functional>
+
+#include "Png.h"
+#include "Color.h"
+#include "pixel_format.h"
+#include "DecoderContext.h"
+
+struct DecodedImage {
+    uint32_t width;
+    uint32_t height;
+    PixelFormat format;
+    // bytes_per_image(format, width, height) bytes laid out as format says
+    std::vector<unsigned char> data;
+};
+
+/**
+ * @brief the checks every decode starts with: png parsed, has a header the
+ * decoder supports and, for colour type 3, a palette.
+*/
+bool is_decodable(const Png& png);
+
+/**
+ * @param context when given, serves every transient buffer of the decode.
+ * The returned image is never allocated from it.
+ * @return nullopt if png failed to parse, uses a format the spec does not
+ * allow or its image data is damaged.
+*/
+std::optional<DecodedImage> decode(const Png& png, const PixelFormat& format = rgba8, DecoderContext* context = nullptr);
+
+/**
+ * @brief decodes only the w by h window whose top left pixel is (x, y). The
+ * window is clipped to the image.
+ * @details Rows above the window are inflated and unfiltered because the
+ * rows below depend on them, but they are never converted to pixels.
+ * Inflating stops right after the last row of the window, and columns
+ * outside of it are skipped during conversion. A window that reaches the
+ * bottom of the image inflates to the end of the stream, so its Adler-32
+ * is checked as it is by decode(). Interlaced images still
+ * need every pass, so only the conversion work shrinks for them.
+*/
+std::optional<DecodedImage> decode_region(
+    const Png& png,
+    uint32_t x,
+    uint32_t y,
+    uint32_t w,
+    uint32_t h,
+    const PixelFormat& format = rgba8,
+    DecoderContext* context = nullptr
+);
+
+/**
+ * Told after each row stored by decode_into() how many rows from the top
+ * the current pass has finished, nothing above that row is stored again
+ * until the next Adam7 pass starts over from the top.
+*/
+using StoreProgress = std::function<void(uint32_t rows_stored)>;
+
+/**
+ * @brief decodes the whole image into data, which has to hold
+ * bytes_per_image(format, width, height) bytes, laid out as
+ * DecodedImage::data. Lets the caller own the output, e.g. as a mapping of
+ * a file, see MappedImage.
+ * @return false in the cases decode() returns nullopt in. Rows stored before
+ * damaged image data was found are left in data.
+*/
+bool decode_into(
+    const Png& png,
+    unsigned char* data,
+    const PixelFormat& format = rgba8,
+    const StoreProgress& progress = {},
+    DecoderContext* context = nullptr
+);
+
+enum class ThumbnailScale {
+    Half = 1,
+    Quarter = 2,
+    Eighth = 3,
+};
+
+/**
+ * @brief decodes straight to a box filtered thumbnail, each output pixel is
+ * the average of the (up to) 2x2, 4x4 or 8x8 block it covers. Colour is
+ * weighted by alpha, transparent pixels add none of theirs.
+ * @details Scanlines are converted one at a time and summed into one row
+ * of sums as they leave the unfilter stage, full resolution pixels are
+ * never stored.
+ *
+ * Adam7 passes come back to every row, so an interlaced image can not be
+ * summed a row at a time. By default (adam7_coarse_passes) it stops after
+ * the first pass that holds the top left pixel of every block (pass 1 for
+ * an eighth, 3 for a quarter, 5 for a half) and uses those pixels as is,
+ * which needs no sums at all and shrinks inflate work along with the
+ * conversion work. Without it all seven passes are box filtered into sums
+ * kept for the whole thumbnail, 16 bytes per thumbnail pixel: 4 bytes per
+ * image pixel at a half, as much as the full image in rgba8, 1 at a quarter
+ * and 1/4 at an eighth. Alpha weighted sums of a 2x2 block already overflow
+ * 16 bits, so they can not be narrowed without rounding the result.
+*/
+std::optional<DecodedImage> decode_thumbnail(
+    const Png& png,
+    ThumbnailScale scale,
+    bool adam7_coarse_passes = true,
+    const PixelFormat& format = rgba8,
+    DecoderContext* context = nullptr
+);
+
+#endif
@@ -7,31 +7,156 @@
 #include <algorithm>
 #include <cassert>
 #include <array>
+#include <cstdint>
+#include <functional>
+#include <memory_resource>
+#include <memory>
 
 namespace deflate
 {
 struct HuffmanTree {
-    std::vector<int> count;
-    std::vector<int> symbol;
-    ~HuffmanTree() {
-        std::cout << "HuffmanTree deconstructor called\n";
-    }
-    friend std::ostream& operator<<(std::ostream& os, const HuffmanTree& ht) {
-        os << "count: ";
-        for (const auto& e : ht.count) {
-            os << e << " ";
-        }
-        os << "\n";
-        os << "symbol: ";
-        for (const auto& e : ht.symbol) {
-            os << e << " ";
-        }
-        return os;
-    }
+    std::pmr::vector<int> count;
+    std::pmr::vector<int> symbol;
 };
 
-HuffmanTree calculate_huffman_tree(const std::vector<int>& bit_lengths);
-void inflate(const std::vector<unsigned char>& encoded_bytes, std::size_t size_of_decoded_bytes);
+/**
+ * Hands compressed input to inflate one span at a time. Called each time the
+ * previous span has been used up, returns false once there is no more input.
+ * This lets a stream that is split across chunks (PNG IDATs) be inflated
+ * without first copying it into one buffer.
+*/
+using ByteSource = std::function<bool(const unsigned char*& bytes, std::size_t& size)>;
+/**
+ * Receives decoded bytes in order. Returning false stops inflate, anything
+ * that was not handed to the sink yet is dropped.
+*/
+using ByteSink = std::function<bool(const unsigned char* bytes, std::size_t size)>;
+
+enum class Status {
+    // The final block was decoded and all output was given to the sink.
+    Done,
+    // The sink returned false.
+    Stopped,
+    // Everything below means the stream is corrupt. The output decoded
+    // before the damage was found has been given to the sink.
+    // The source ran out before the end of the stream.
+    InputEnded,
+    // Block type 3, which RFC 1951 reserves.
+    BadBlockType,
+    // LEN and NLEN of a stored block do not match.
+    BadStoredLength,
+    // The code lengths of a dynamic block do not describe a huffman code.
+    BadCodeLengths,
+    // A code that is not in the tree or a length or distance symbol out of
+    // range.
+    BadSymbol,
+    // A match reaches back before the first byte of output.
+    DistanceTooFar,
+    // The zlib header is malformed or asks for a preset dictionary.
+    BadZlibHeader,
+    // The gzip header is malformed or its header CRC does not match.
+    BadGzipHeader,
+    // The Adler-32 of a zlib stream or the CRC-32 or length of a gzip
+    // member does not match the output.
+    BadChecksum,
+};
+
+/**
+ * @brief true for every status that reports a corrupt stream.
+*/
+bool is_error(Status status);
+const char* status_name(Status status);
+
+/**
+ * @param resource where the tables of the tree are allocated.
+ * @return a tree without any symbols if bit_lengths asks for more codes than
+ * the bit lengths allow.
+*/
+HuffmanTree calculate_huffman_tree(
+    const int* bit_lengths,
+    int n,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+/**
+ * @brief inflates a raw deflate stream (RFC 1951). Only the last 32 KiB of
+ * output is kept, everything older has already been given to the sink.
+ * @param resource serves the window and the huffman tables of every block.
+*/
+Status inflate(
+    const ByteSource& source,
+    const ByteSink& sink,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+/**
+ * @brief checks the two byte zlib header (RFC 1950), inflates the stream
+ * behind it and, if the sink took all of the output, compares the Adler-32
+ * that follows it.
+*/
+Status inflate_zlib(
+    const ByteSource& source,
+    const ByteSink& sink,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+enum class Framing {
+    // RFC 1951 deflate without header or trailer
+    Raw,
+    // RFC 1950, as in png IDAT chunks
+    Zlib,
+    // RFC 1952, one member or several back to back. Bytes after the last
+    // member that do not start another one, zero padding say, are ignored.
+    Gzip,
+    // Gzip or zlib when the first two bytes are a header of either, raw
+    // otherwise
+    Detect,
+};
+
+/**
+ * @brief which framing Framing::Detect picks for a stream starting with the
+ * size (at least 2 to tell anything) bytes at bytes.
+*/
+Framing detect_framing(const unsigned char* bytes, std::size_t size);
+
+/**
+ * @brief inflates the stream from source, unwrapping and checking the
+ * header and trailer framing asks for. Memory use is the window and the
+ * tables of one block whatever the length of the stream, so arbitrarily
+ * large streams can go from source to sink.
+ *
+ * This is the streaming interface. Input is pulled a span at a time, as
+ * it is read from a file, a socket or the chunks of a png, and output is
+ * pushed in spans of about 4 KiB straight out of the inflate window. A
+ * caller that wants to stop early, say once its buffer is full, returns
+ * false from the sink. The engine keeps its position on the stack of this
+ * call, so there is no object to feed input to between calls the way
+ * zlib's inflate() is driven. Code that has to be driven that way reads
+ * its input from inside the source instead.
+*/
+Status decompress(
+    Framing framing,
+    const ByteSource& source,
+    const ByteSink& sink,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+/**
+ * @brief decompresses the size bytes at bytes and appends the output to out.
+*/
+Status decompress(
+    Framing framing,
+    const unsigned char* bytes,
+    std::size_t size,
+    std::vector<unsigned char>& out,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+/**
+ * @brief ByteSource handing out one buffer, which has to outlive it.
+*/
+ByteSource buffer_source(const unsigned char* bytes, std::size_t size);
+
+/**
+ * @brief inflates at most size_of_decoded_bytes bytes of a raw deflate stream
+ * held in one buffer.
+*/
+std::vector<unsigned char> inflate(const std::vector<unsigned char>& encoded_bytes, std::size_t size_of_decoded_bytes);
 } // namespace deflate
 
 #endif
@@ -0,0 +1,120 @@
+/**
+ * Trace points and counters for looking inside a decode.
+ *
+ * BITMAP_TRACE() is printf style and compiles to nothing unless the build
+ * defines BITMAP_ENABLE_TRACE (make TRACE=1). Counters are always built in:
+ * inflate and the row pipeline count into locals and publish them to the
+ * counters of the calling thread once per call, so counting costs next to
+ * nothing. Timing stages needs a clock read per scanline and is therefore
+ * switched on at run time with set_stage_timing().
+*/
+
+#ifndef INSTRUMENTATION_HEADER
+#define INSTRUMENTATION_HEADER
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <string>
+
+#ifdef BITMAP_ENABLE_TRACE
+#define BITMAP_TRACE(...) instrumentation::trace(__VA_ARGS__)
+#else
+#define BITMAP_TRACE(...) ((void)0)
+#endif
+
+namespace instrumentation
+{
+enum class Stage {
+    // Png construction, from the signature to the IDAT checks
+    Parse,
+    // Everything in the row pipeline that is not unfiltering or the row
+    // handler, which is mostly inflate
+    Inflate,
+    Unfilter,
+    // The row handler: pixel conversion, compositing, storing
+    Convert,
+    Count,
+};
+
+enum class BlockType {
+    Stored,
+    Fixed,
+    Dynamic,
+    Count,
+};
+
+constexpr std::size_t NumberOfLengthCodes = 29;
+constexpr std::size_t NumberOfDistanceCodes = 30;
+
+struct Counters {
+    uint64_t bits_consumed;
+    // Literal, length and end of block symbols
+    uint64_t symbols_decoded;
+    uint64_t literals;
+    uint64_t matches;
+    uint64_t stored_bytes;
+    uint64_t bytes_out;
+    uint64_t blocks[static_cast<std::size_t>(BlockType::Count)];
+    // Indexed by length code - 257 and by distance code
+    uint64_t length_histogram[NumberOfLengthCodes];
+    uint64_t distance_histogram[NumberOfDistanceCodes];
+    uint64_t rows;
+    uint64_t stage_nanoseconds[static_cast<std::size_t>(Stage::Count)];
+
+    Counters& operator+=(const Counters& other);
+};
+
+/**
+ * @brief adds delta to the counters of the calling thread.
+*/
+void publish(const Counters& delta);
+/**
+ * @brief everything the calling thread has published since its last
+ * reset_thread_counters().
+*/
+Counters thread_counters();
+void reset_thread_counters();
+/**
+ * @brief the sum over all threads, including ones that have exited.
+*/
+Counters total_counters();
+void reset_total_counters();
+
+void set_stage_timing(bool enabled);
+bool stage_timing_enabled();
+
+/**
+ * @brief adds the time since construction to one stage of counters, only
+ * when stage timing is on.
+*/
+class StageTimer {
+    Counters& counters_;
+    Stage stage_;
+    bool enabled_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    StageTimer(Counters& counters, Stage stage);
+    ~StageTimer();
+
+    StageTimer() = delete;
+    StageTimer(const StageTimer& other) = delete;
+    StageTimer(StageTimer&& other) = delete;
+    StageTimer& operator=(const StageTimer& other) = delete;
+    StageTimer& operator=(StageTimer&& other) = delete;
+};
+
+std::string to_json(const Counters& counters);
+
+/**
+ * @brief writes one line to stderr. Use BITMAP_TRACE() instead so that the
+ * call disappears from builds without tracing.
+*/
+#if defined(__GNUC__)
+__attribute__((format(printf, 1, 2)))
+#endif
+void trace(const char* format, ...);
+} // namespace instrumentation
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Every build of the dispatched kernels, one namespace per target. Only
+ * cpu_dispatch.cc should call these directly, everything else goes
+ * through kernels(). A target leaves out the kernels it has nothing better
+ * for than the target below it.
+ *
+ * The translation units of the SIMD targets are compiled with their
+ * instruction set enabled, so they must not define or instantiate
+ * anything that could be shared with the rest of the program (inline
+ * functions, templates from the standard library).
+*/
+
+#ifndef KERNELS_HEADER
+#define KERNELS_HEADER
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Color.h"
+
+namespace kernel_builds
+{
+namespace scalar
+{
+uint32_t crc32(uint32_t crc, const unsigned char* bytes, std::size_t size);
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size);
+void unfilter_sub(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void unfilter_average(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void unfilter_paeth(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void expand_palette(const unsigned char* indexes, std::size_t count, const Color* palette, Color* out);
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out);
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length);
+void reduce_row(const Color* pixels, std::size_t count, int shift, uint32_t* sums);
+void premultiply_alpha(Color* pixels, std::size_t count);
+void widen_to_float(const Color* pixels, std::size_t count, bool premultiply, unsigned char* out);
+void transfer_16(const uint16_t* samples, std::size_t count, bool source_is_srgb, float source_exponent, bool linear_output, unsigned char* out);
+} // namespace scalar
+
+#if defined(__x86_64__) || defined(__i386__)
+namespace sse4
+{
+uint32_t crc32(uint32_t crc, const unsigned char* bytes, std::size_t size);
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size);
+void unfilter_sub(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void unfilter_average(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void unfilter_paeth(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out);
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length);
+void reduce_row(const Color* pixels, std::size_t count, int shift, uint32_t* sums);
+void premultiply_alpha(Color* pixels, std::size_t count);
+void widen_to_float(const Color* pixels, std::size_t count, bool premultiply, unsigned char* out);
+void transfer_16(const uint16_t* samples, std::size_t count, bool source_is_srgb, float source_exponent, bool linear_output, unsigned char* out);
+} // namespace sse4
+
+namespace avx2
+{
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size);
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void expand_palette(const unsigned char* indexes, std::size_t count, const Color* palette, Color* out);
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out);
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length);
+void premultiply_alpha(Color* pixels, std::size_t count);
+void widen_to_float(const Color* pixels, std::size_t count, bool premultiply, unsigned char* out);
+void transfer_16(const uint16_t* samples, std::size_t count, bool source_is_srgb, float source_exponent, bool linear_output, unsigned char* out);
+} // namespace avx2
+
+namespace avx512
+{
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size);
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bytes_per_pixel);
+void expand_palette(const unsigned char* indexes, std::size_t count, const Color* palette, Color* out);
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out);
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length);
+} // namespace avx512
+#endif
+} // namespace kernel_builds
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ * Turns the samples of an unfiltered scanline into RGBA, for every colour
+ * type and bit depth, including palettes, tRNS and the optional transfer
+ * curve.
+*/
+
+#ifndef PIXEL_CONVERSION_HEADER
+#define PIXEL_CONVERSION_HEADER
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Png.h"
+#include "Color.h"
+#include "color_management.h"
+
+/**
+ * Everything besides the scanline itself that is needed to turn samples
+ * into colours.
+*/
+struct ColorTables {
+    Color palette[256];
+    // tRNS for greyscale and truecolour images names one colour, at full
+    // sample precision, that is fully transparent.
+    bool has_transparent_key;
+    uint16_t transparent_key[3];
+    // Applied to the colour samples, the palette already went through it.
+    TransferCurve curve;
+};
+
+/**
+ * @brief reads PLTE, tRNS and the colour chunks of png.
+*/
+ColorTables color_tables(const Png& png, TransferFunction transfer);
+
+/**
+ * @brief converts count pixels of an unfiltered scanline starting at pixel
+ * first to RGBA.
+*/
+void convert_pixels(
+    const unsigned char* row,
+    const IHDR& header,
+    const ColorTables& tables,
+    std::size_t first,
+    std::size_t count,
+    Color* out
+);
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * Describes the layout decoded pixels are written in and holds the kernels
+ * that store converted RGBA pixels in that layout. The kernels run on one
+ * scanline at a time inside the decode, so callers never need a second
+ * pass over the image just to reorder channels.
+*/
+
+#ifndef PIXEL_FORMAT_HEADER
+#define PIXEL_FORMAT_HEADER
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Color.h"
+
+enum class ChannelOrder {
+    RGBA,
+    BGRA,
+};
+
+enum class SampleType {
+    U8,
+    // Samples normalized to 0.0 .. 1.0
+    F32,
+};
+
+/**
+ * Transfer curve of the output samples. Anything other than AsEncoded
+ * converts from the curve the png declares (gAMA, sRGB) to this one.
+*/
+enum class TransferFunction {
+    AsEncoded,
+    Linear,
+    SRGB,
+};
+
+struct PixelFormat {
+    ChannelOrder order;
+    // Colour samples multiplied by alpha
+    bool premultiplied;
+    SampleType sample_type;
+    /**
+     * Interleaved formats store the channels of a pixel next to each other,
+     * planar formats store one width * height plane per channel in channel
+     * order.
+    */
+    bool planar;
+    TransferFunction transfer = TransferFunction::AsEncoded;
+
+    friend bool operator==(const PixelFormat& a, const PixelFormat& b) = default;
+};
+
+inline constexpr PixelFormat rgba8{ChannelOrder::RGBA, false, SampleType::U8, false};
+inline constexpr PixelFormat bgra8{ChannelOrder::BGRA, false, SampleType::U8, false};
+inline constexpr PixelFormat rgba8_premultiplied{ChannelOrder::RGBA, true, SampleType::U8, false};
+inline constexpr PixelFormat bgra8_premultiplied{ChannelOrder::BGRA, true, SampleType::U8, false};
+inline constexpr PixelFormat planar_float32{ChannelOrder::RGBA, false, SampleType::F32, true};
+
+std::size_t bytes_per_sample(const PixelFormat& format);
+std::size_t bytes_per_image(const PixelFormat& format, uint32_t width, uint32_t height);
+
+/**
+ * @brief c * a / 255 rounded to nearest, exact for every pair of 8 bit
+ * inputs without a division.
+*/
+inline unsigned char multiply_alpha(unsigned c, unsigned a) {
+    const unsigned t = c * a + 128;
+    return static_cast<unsigned char>((t + (t >> 8)) >> 8);
+}
+
+void premultiply_alpha(Color* pixels, std::size_t count);
+/**
+ * @brief writes pixels as B, G, R, A bytes, out_step pixels apart.
+*/
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out, std::size_t out_step);
+
+/**
+ * @brief writes count pixels into an image of the given format so that the
+ * first lands on (x, y) and the rest follow x_step pixels apart.
+ * @details pixels is used as scratch space and is clobbered.
+*/
+void store_pixels(
+    Color* pixels,
+    std::size_t count,
+    const PixelFormat& format,
+    unsigned char* data,
+    uint32_t width,
+    uint32_t height,
+    std::size_t x,
+    std::size_t y,
+    std::size_t x_step
+);
+
+#endif
@@ -9,19 +9,13 @@
 #include <cmath>
 
 #include "deflate.h"
-
-struct Color {
-    unsigned char r;
-    unsigned char g;
-    unsigned char b;
-    unsigned char a;
-};
+#include "Color.h"
 
 class Image {
     std::vector<unsigned char> data_;
     std::vector<Color> pixel_array;
-    int width_;
-    int height_;
+    uint32_t width_;
+    uint32_t height_;
     unsigned char bit_depth_;
     unsigned char color_type_;
     unsigned char compression_method_;
@@ -60,7 +54,7 @@ class Image {
         );
     }
 
-    int32_t get_i32_big_endian(int buffer_offset){
+    int32_t get_i32_big_endian(std::size_t buffer_offset){
         union intc32
         {
             unsigned char c[4];
@@ -88,17 +82,17 @@ class Image {
         constexpr int size_of_ascii_chunk_name = 4;
         constexpr int size_of_check_sum = 4;
         bool found_IHDR_chunk = false;
-        int buffer_offset = size_of_png_header;
+        std::size_t buffer_offset = size_of_png_header;
         while (buffer_offset < data_.size() - size_of_length_field) {
-            int chunk_size = get_i32_big_endian(buffer_offset);
+            const uint32_t chunk_size = static_cast<uint32_t>(get_i32_big_endian(buffer_offset));
             buffer_offset += size_of_length_field;
             if (data_.at(buffer_offset + 0) == 'I' &&
                 data_.at(buffer_offset + 1) == 'H' &&
                 data_.at(buffer_offset + 2) == 'D' &&
                 data_.at(buffer_offset + 3) == 'R') 
             {
-                width_ = get_i32_big_endian(buffer_offset + 4);
-                height_ = get_i32_big_endian(buffer_offset + 8);
+                width_ = static_cast<uint32_t>(get_i32_big_endian(buffer_offset + 4));
+                height_ = static_cast<uint32_t>(get_i32_big_endian(buffer_offset + 8));
                 bit_depth_ = data_.at(buffer_offset + 12);
                 color_type_ = data_.at(buffer_offset + 13);
                 compression_method_ = data_.at(buffer_offset + 14);
@@ -147,6 +141,11 @@ class Image {
                     std::exit(EXIT_FAILURE);
                 }
                 std::cout << "IDAT:\n"; 
+                // The two header bytes and the Adler-32 are subtracted from chunk_size below.
+                if (chunk_size < 6) {
+                    std::cout << "Error. The IDAT chunk is too short to hold a zlib header and checksum.\n";
+                    std::exit(EXIT_FAILURE);
+                }
                 const std::bitset<8> compression_method_and_flag_byte = data_.at(buffer_offset + 4);
                 if (!compression_method_and_flag_byte[3]){
                     std::cout << "Error. bits 3 of 'Compression method' is not set. This bit indicates the 'deflate' compression method.";
@@ -177,15 +176,17 @@ class Image {
                     std::exit(EXIT_FAILURE);
                 }
                 constexpr int size_of_cmf_flg_bytes = 2;
-                const int offset_to_compressed_data = buffer_offset + size_of_ascii_chunk_name + size_of_cmf_flg_bytes;
+                const std::size_t offset_to_compressed_data = buffer_offset + size_of_ascii_chunk_name + size_of_cmf_flg_bytes;
                 constexpr int size_of_ADLER32_check_sum = 4;
-                const int size_of_compressed_data = chunk_size - size_of_ADLER32_check_sum - size_of_cmf_flg_bytes;
+                const std::size_t size_of_compressed_data = chunk_size - size_of_ADLER32_check_sum - size_of_cmf_flg_bytes;
                 std::vector<unsigned char> compressed_data{};
-                for (int i = 0; i < size_of_compressed_data; i++){
+                for (std::size_t i = 0; i < size_of_compressed_data; i++){
                     compressed_data.push_back(data_.at(offset_to_compressed_data + i));
                 }
-                constexpr int number_of_bytes_per_pixel = 4; // assuming argb
-                deflate::inflate(compressed_data, width_ * height_ * number_of_bits_in_compression_method_mask);
+                constexpr uint64_t number_of_bytes_per_pixel = 4; // assuming argb
+                // In 64 bits, a 32 bit product overflows past 2 GiB of pixels.
+                const uint64_t size_of_decoded_bytes = static_cast<uint64_t>(width_) * height_ * number_of_bytes_per_pixel;
+                deflate::inflate(compressed_data, static_cast<std::size_t>(size_of_decoded_bytes));
             }
             else {
                 std::cout << chunk_size << ":" 
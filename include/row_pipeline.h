@@ -0,0 +1,114 @@
+/**
+ * The stage between inflate and pixel conversion. Inflated bytes are cut
+ * into scanlines, each scanline is unfiltered against the previous one of
+ * the same pass and handed to a callback, so the filtered image never has
+ * to be held in memory as a whole.
+*/
+
+#ifndef ROW_PIPELINE_HEADER
+#define ROW_PIPELINE_HEADER
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory_resource>
+
+#include "Png.h"
+#include "deflate.h"
+
+struct Adam7Pass {
+    uint32_t x_start;
+    uint32_t y_start;
+    uint32_t x_step;
+    uint32_t y_step;
+};
+
+/**
+ * Pass 0 stands for the whole image of a non interlaced png, passes 1 to 7
+ * are the Adam7 passes.
+*/
+inline constexpr Adam7Pass adam7_passes[8] = {
+    {0, 0, 1, 1},
+    {0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4},
+    {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2},
+};
+
+int channels_for_color_type(unsigned char color_type);
+/**
+ * @brief false for colour type / bit depth combinations the spec does not
+ * allow and for compression, filter or interlace methods it does not define.
+*/
+bool is_supported_header(const IHDR& header);
+int bits_per_pixel(const IHDR& header);
+std::size_t bytes_per_row(uint32_t width, int bits_per_pixel);
+uint32_t pass_width(const IHDR& header, int pass);
+uint32_t pass_height(const IHDR& header, int pass);
+/**
+ * @return the pass whose rows come out of the pipeline last.
+*/
+int last_pass(const IHDR& header);
+
+/**
+ * @brief reverses the filter named by filter_type in place.
+ * @return false if filter_type is not one of the five png filters, row is
+ * left as it was.
+ * @param previous_row the unfiltered row above, all zeros for the first row
+ * of a pass.
+ * @param bytes_per_pixel distance to the byte that Sub, Average and Paeth
+ * use on the left, at least 1.
+*/
+bool unfilter_row(
+    unsigned char filter_type,
+    unsigned char* row,
+    const unsigned char* previous_row,
+    std::size_t row_bytes,
+    std::size_t bytes_per_pixel
+);
+
+/**
+ * Gets the unfiltered bytes of one scanline, without the filter type byte.
+ * Returning false ends the pipeline, no further data is inflated.
+*/
+using RowHandler = std::function<bool(int pass, uint32_t row_in_pass, const unsigned char* row)>;
+
+enum class PipelineStatus {
+    // Every scanline was handed to on_row.
+    Done,
+    // on_row ended the pipeline early.
+    Stopped,
+    // A scanline starts with a filter type other than the five png has.
+    BadFilterType,
+    // The image data ended before the last scanline.
+    Truncated,
+    // The zlib stream is corrupt, or its Adler-32 does not match or is
+    // missing after the last scanline.
+    BadStream,
+};
+
+/**
+ * @brief true for every status that reports damaged image data.
+*/
+bool is_error(PipelineStatus status);
+
+/**
+ * @brief inflates the zlib stream from compressed and hands each unfiltered
+ * scanline of the image described by header to on_row in stream order.
+ * Unless on_row stops it, the stream is inflated to its end and its
+ * Adler-32 checked after the last scanline.
+ * @param resource serves the scanline buffers and everything inflate needs.
+ * @return Done or Stopped, anything else means the image data is damaged
+ * and only the rows before the damage were handed out.
+*/
+PipelineStatus run_row_pipeline(
+    const IHDR& header,
+    const deflate::ByteSource& compressed,
+    const RowHandler& on_row,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+);
+
+/**
+ * @brief ByteSource over the data of every IDAT chunk of png.
+*/
+deflate::ByteSource IDAT_source(const Png& png);
+
+#endif
@@ -1,7 +1,8 @@
 /**
  * There are several test images in the test_images folder this header 
  * will provide an interface to run though the test images and attempt
- * to decode them
+ * to decode them. It also builds small pngs in memory for the cases
+ * PngSuite does not cover.
 */
 
 #ifndef TEST_IMAGES_HEADER
@@ -11,7 +12,35 @@
 #include <vector>
 #include <filesystem>
 #include <iostream>
+#include <cstdint>
+
+#include "PngByte.h"
 
 std::vector<std::string> get_files_in_directory(const std::string& path);
 
-#endif
\ No newline at end of file
+/**
+ * @brief length, type, data and CRC of one chunk as they appear in a file.
+*/
+std::vector<unsigned char> png_chunk(const char* type, const std::vector<unsigned char>& data);
+/**
+ * @brief the data of an IHDR chunk.
+*/
+std::vector<unsigned char> IHDR_data(
+    uint32_t width,
+    uint32_t height,
+    unsigned char bit_depth,
+    unsigned char color_type,
+    unsigned char interlace_method = 0
+);
+/**
+ * @brief a zlib stream of stored blocks holding bytes, so images can be
+ * built without a compressor.
+*/
+std::vector<unsigned char> zlib_stored(const std::vector<unsigned char>& bytes);
+/**
+ * @brief the png signature followed by chunks.
+*/
+std::vector<unsigned char> png_file(const std::vector<std::vector<unsigned char>>& chunks);
+std::vector<PngByte> as_png_bytes(const std::vector<unsigned char>& bytes);
+
+#endif
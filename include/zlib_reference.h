@@ -0,0 +1,28 @@
+/**
+ * The system zlib behind a plain callback, what inflate_bench measures this
+ * library against. It has a file of its own since zlib.h declares a
+ * deflate() that clashes with namespace deflate, so the two headers cannot
+ * meet in one translation unit.
+*/
+
+#ifndef ZLIB_REFERENCE_HEADER
+#define ZLIB_REFERENCE_HEADER
+
+#include <cstddef>
+#include <functional>
+
+/**
+ * @brief inflates the size bytes at bytes with zlib and hands the output to
+ * sink in blocks of up to 256 KiB.
+ * @param raw raw deflate if true, otherwise a zlib stream or a gzip file of
+ * any number of members, followed by trailing data or not.
+ * @return false if zlib reports the stream corrupt or it ends early.
+*/
+bool zlib_inflate(
+    const unsigned char* bytes,
+    std::size_t size,
+    bool raw,
+    const std::function<void(const unsigned char* bytes, std::size_t size)>& sink
+);
+
+#endif
@@ -0,0 +1,336 @@
+#include "ApngDecoder.h"
+#include "decode.h"
+
+#include <cstring>
+#include <algorithm>
+
+static constexpr uint32_t sizeof_acTL_data = 8;
+static constexpr uint32_t sizeof_fcTL_data = 26;
+static constexpr uint32_t sizeof_sequence_number = 4;
+
+static bool chunk_is(const Chunk& chunk, const char* name) {
+    return std::memcmp(chunk.type, name, 4) == 0;
+}
+
+static FrameRect union_of(const FrameRect& a, const FrameRect& b) {
+    if (a.width == 0 || a.height == 0) {
+        return b;
+    }
+    if (b.width == 0 || b.height == 0) {
+        return a;
+    }
+    const uint32_t x = std::min(a.x, b.x);
+    const uint32_t y = std::min(a.y, b.y);
+    const uint32_t right = std::max(a.x + a.width, b.x + b.width);
+    const uint32_t bottom = std::max(a.y + a.height, b.y + b.height);
+    return FrameRect{x, y, right - x, bottom - y};
+}
+
+std::optional<Animation> read_animation(const Png& png) {
+    if (!png.is_parsed()) {
+        return std::nullopt;
+    }
+    const Chunk* actl = png.find_chunk("acTL");
+    if (!actl || actl->length != sizeof_acTL_data) {
+        return std::nullopt;
+    }
+    const IHDR& header = png.get_header();
+    const uint32_t number_of_frames = png.get_uint32_t_h(actl->chunk_data_start);
+    Animation animation{png.get_uint32_t_h(actl->chunk_data_start + 4), {}};
+
+    const std::pmr::vector<Chunk>& chunks = png.get_chunks();
+    bool seen_IDAT = false;
+    // fcTL and fdAT share one sequence, 0, 1, 2 ... in chunk order
+    uint32_t next_sequence_number = 0;
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+        const Chunk& chunk = chunks[i];
+        if (chunk_is(chunk, "fcTL")) {
+            if (chunk.length != sizeof_fcTL_data || png.get_uint32_t_h(chunk.chunk_data_start) != next_sequence_number++) {
+                return std::nullopt;
+            }
+            const std::size_t start = chunk.chunk_data_start;
+            const unsigned char* data = png.get_chunk_data(chunk);
+            FrameControl control{
+                png.get_uint32_t_h(start),
+                FrameRect{
+                    png.get_uint32_t_h(start + 12),
+                    png.get_uint32_t_h(start + 16),
+                    png.get_uint32_t_h(start + 4),
+                    png.get_uint32_t_h(start + 8)
+                },
+                static_cast<uint16_t>(data[20] << 8 | data[21]),
+                static_cast<uint16_t>(data[22] << 8 | data[23]),
+                static_cast<DisposeOp>(data[24]),
+                static_cast<BlendOp>(data[25])
+            };
+            const FrameRect& r = control.rect;
+            if (r.width == 0 || r.height == 0 ||
+                static_cast<uint64_t>(r.x) + r.width > header.width ||
+                static_cast<uint64_t>(r.y) + r.height > header.height ||
+                data[24] > 2 || data[25] > 1)
+            {
+                return std::nullopt;
+            }
+            // A frame control before the image data makes the default image the first frame.
+            if (!seen_IDAT && (r.x != 0 || r.y != 0 || r.width != header.width || r.height != header.height)) {
+                return std::nullopt;
+            }
+            animation.frames.push_back(AnimationFrame{control, {}, !seen_IDAT});
+        }
+        else if (chunk_is(chunk, "IDAT")) {
+            seen_IDAT = true;
+            if (!animation.frames.empty() && animation.frames.back().uses_IDAT) {
+                animation.frames.back().data_chunk_indexes.push_back(static_cast<int>(i));
+            }
+        }
+        else if (chunk_is(chunk, "fdAT")) {
+            if (animation.frames.empty() || animation.frames.back().uses_IDAT || chunk.length < sizeof_sequence_number ||
+                png.get_uint32_t_h(chunk.chunk_data_start) != next_sequence_number++)
+            {
+                return std::nullopt;
+            }
+            animation.frames.back().data_chunk_indexes.push_back(static_cast<int>(i));
+        }
+    }
+    if (animation.frames.size() != number_of_frames || animation.frames.empty()) {
+        return std::nullopt;
+    }
+    for (const auto& frame : animation.frames) {
+        if (frame.data_chunk_indexes.empty()) {
+            return std::nullopt;
+        }
+    }
+    return animation;
+}
+
+ApngDecoder::ApngDecoder(const Png& png, uint32_t keyframe_interval, std::size_t keyframe_budget) :
+    png_{png},
+    animation_{read_animation(png).value_or(Animation{})},
+    tables_{},
+    canvas_{},
+    saved_region_{},
+    row_pixels_{},
+    scratch_{},
+    current_frame_{-1},
+    dirty_rect_{},
+    keyframe_interval_{keyframe_interval},
+    keyframe_budget_{keyframe_budget},
+    keyframes_{},
+    keyframe_bytes_{0}
+{
+    if (!is_animated()) {
+        return;
+    }
+    const IHDR& header = png_.get_header();
+    tables_ = color_tables(png_, TransferFunction::AsEncoded);
+    canvas_.resize(static_cast<std::size_t>(header.width) * header.height, Color{0, 0, 0, 0});
+    row_pixels_.resize(header.width);
+}
+
+bool ApngDecoder::is_animated() const {
+    return !animation_.frames.empty() && is_decodable(png_);
+}
+
+uint32_t ApngDecoder::frame_count() const {
+    return static_cast<uint32_t>(animation_.frames.size());
+}
+
+const Animation& ApngDecoder::get_animation() const {
+    return animation_;
+}
+
+int64_t ApngDecoder::current_frame() const {
+    return current_frame_;
+}
+
+const std::vector<Color>& ApngDecoder::canvas() const {
+    return canvas_;
+}
+
+const FrameRect& ApngDecoder::dirty_rect() const {
+    return dirty_rect_;
+}
+
+void ApngDecoder::clear_canvas() {
+    std::fill(canvas_.begin(), canvas_.end(), Color{0, 0, 0, 0});
+    current_frame_ = -1;
+}
+
+void ApngDecoder::save_region(const FrameRect& rect) {
+    const uint32_t canvas_width = png_.get_header().width;
+    saved_region_.resize(static_cast<std::size_t>(rect.width) * rect.height);
+    for (uint32_t y = 0; y < rect.height; y++) {
+        const Color* row = &canvas_[static_cast<std::size_t>(rect.y + y) * canvas_width + rect.x];
+        std::copy(row, row + rect.width, &saved_region_[static_cast<std::size_t>(y) * rect.width]);
+    }
+}
+
+void ApngDecoder::restore_region(const FrameRect& rect) {
+    const uint32_t canvas_width = png_.get_header().width;
+    for (uint32_t y = 0; y < rect.height; y++) {
+        const Color* row = &saved_region_[static_cast<std::size_t>(y) * rect.width];
+        std::copy(row, row + rect.width, &canvas_[static_cast<std::size_t>(rect.y + y) * canvas_width + rect.x]);
+    }
+}
+
+void ApngDecoder::dispose_current_frame() {
+    if (current_frame_ < 0) {
+        return;
+    }
+    const FrameControl& control = animation_.frames[current_frame_].control;
+    DisposeOp dispose_op = control.dispose_op;
+    // There is nothing to go back to before the first frame.
+    if (dispose_op == DisposeOp::Previous && current_frame_ == 0) {
+        dispose_op = DisposeOp::Background;
+    }
+    const FrameRect& rect = control.rect;
+    const uint32_t canvas_width = png_.get_header().width;
+    if (dispose_op == DisposeOp::Background) {
+        for (uint32_t y = 0; y < rect.height; y++) {
+            Color* row = &canvas_[static_cast<std::size_t>(rect.y + y) * canvas_width + rect.x];
+            std::fill(row, row + rect.width, Color{0, 0, 0, 0});
+        }
+        dirty_rect_ = rect;
+    }
+    else if (dispose_op == DisposeOp::Previous) {
+        restore_region(rect);
+        dirty_rect_ = rect;
+    }
+}
+
+/**
+ * @brief APNG "over" for straight alpha, src on top of dst.
+*/
+static void blend_over(Color& dst, const Color& src) {
+    if (src.a == 255 || dst.a == 0) {
+        dst = src;
+        return;
+    }
+    if (src.a == 0) {
+        return;
+    }
+    const uint32_t dst_weight = dst.a * (255u - src.a);
+    const uint32_t out_a = src.a * 255u + dst_weight;
+    const auto mix = [&](unsigned char s, unsigned char d) {
+        return static_cast<unsigned char>((s * src.a * 255u + d * dst_weight + out_a / 2) / out_a);
+    };
+    dst = Color{mix(src.r, dst.r), mix(src.g, dst.g), mix(src.b, dst.b), static_cast<unsigned char>((out_a + 127) / 255)};
+}
+
+PipelineStatus ApngDecoder::draw_frame(const AnimationFrame& frame) {
+    const FrameRect& rect = frame.control.rect;
+    const uint32_t canvas_width = png_.get_header().width;
+    IHDR header = png_.get_header();
+    header.width = rect.width;
+    header.height = rect.height;
+
+    scratch_.reset();
+    std::size_t next_chunk = 0;
+    const deflate::ByteSource source = [&](const unsigned char*& bytes, std::size_t& size) {
+        if (next_chunk == frame.data_chunk_indexes.size()) {
+            return false;
+        }
+        const Chunk& chunk = png_.get_chunks()[frame.data_chunk_indexes[next_chunk++]];
+        // fdAT data starts with its sequence number
+        const std::size_t skip = frame.uses_IDAT ? 0 : sizeof_sequence_number;
+        bytes = png_.get_chunk_data(chunk) + skip;
+        size = chunk.length - skip;
+        return true;
+    };
+    const bool over = frame.control.blend_op == BlendOp::Over;
+    // A damaged frame keeps the rows drawn before the damage.
+    return run_row_pipeline(header, source, [&](int pass, uint32_t row_in_pass, const unsigned char* row) {
+        const Adam7Pass& p = adam7_passes[pass];
+        const uint32_t y = rect.y + p.y_start + row_in_pass * p.y_step;
+        const uint32_t count = pass_width(header, pass);
+        convert_pixels(row, header, tables_, 0, count, row_pixels_.data());
+        Color* out = &canvas_[static_cast<std::size_t>(y) * canvas_width + rect.x + p.x_start];
+        for (uint32_t i = 0; i < count; i++, out += p.x_step) {
+            if (over) {
+                blend_over(*out, row_pixels_[i]);
+            }
+            else {
+                *out = row_pixels_[i];
+            }
+        }
+        return true;
+    }, scratch_.resource());
+}
+
+bool ApngDecoder::next_frame() {
+    if (!is_animated() || current_frame_ + 1 >= static_cast<int64_t>(animation_.frames.size())) {
+        return false;
+    }
+    dirty_rect_ = FrameRect{0, 0, 0, 0};
+    dispose_current_frame();
+    current_frame_++;
+    const AnimationFrame& frame = animation_.frames[current_frame_];
+    if (frame.control.dispose_op == DisposeOp::Previous && current_frame_ != 0) {
+        save_region(frame.control.rect);
+    }
+    const PipelineStatus status = draw_frame(frame);
+    dirty_rect_ = union_of(dirty_rect_, frame.control.rect);
+    if (is_error(status)) {
+        return false;
+    }
+    if (keyframe_interval_ && current_frame_ % keyframe_interval_ == 0) {
+        cache_keyframe(frame);
+    }
+    return true;
+}
+
+void ApngDecoder::cache_keyframe(const AnimationFrame& frame) {
+    const bool cached = std::any_of(keyframes_.begin(), keyframes_.end(), [this](const Keyframe& k) {
+        return k.frame == current_frame_;
+    });
+    const bool keep_saved = frame.control.dispose_op == DisposeOp::Previous && current_frame_ != 0;
+    const std::size_t bytes = (canvas_.size() + (keep_saved ? saved_region_.size() : 0)) * sizeof(Color);
+    if (cached || bytes > keyframe_budget_) {
+        return;
+    }
+    while (keyframe_bytes_ + bytes > keyframe_budget_) {
+        const Keyframe& oldest = keyframes_.front();
+        keyframe_bytes_ -= (oldest.canvas.size() + oldest.saved_region.size()) * sizeof(Color);
+        keyframes_.erase(keyframes_.begin());
+    }
+    keyframes_.push_back(Keyframe{
+        static_cast<uint32_t>(current_frame_),
+        canvas_,
+        keep_saved ? saved_region_ : std::vector<Color>{}
+    });
+    keyframe_bytes_ += bytes;
+}
+
+bool ApngDecoder::seek(uint32_t frame) {
+    if (!is_animated() || frame >= animation_.frames.size()) {
+        return false;
+    }
+    if (current_frame_ == frame) {
+        return true;
+    }
+    // Start from whichever is closest below frame: the current frame, a
+    // cached keyframe or an empty canvas.
+    int64_t start = current_frame_ < frame ? current_frame_ : -1;
+    const Keyframe* keyframe = nullptr;
+    for (const auto& k : keyframes_) {
+        if (k.frame <= frame && static_cast<int64_t>(k.frame) > start) {
+            start = k.frame;
+            keyframe = &k;
+        }
+    }
+    if (keyframe) {
+        canvas_ = keyframe->canvas;
+        saved_region_ = keyframe->saved_region;
+        current_frame_ = keyframe->frame;
+    }
+    else if (start == -1) {
+        clear_canvas();
+    }
+    bool drawn = true;
+    while (drawn && current_frame_ < frame) {
+        drawn = next_frame();
+    }
+    const IHDR& header = png_.get_header();
+    dirty_rect_ = FrameRect{0, 0, header.width, header.height};
+    return drawn;
+}
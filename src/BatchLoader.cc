@@ -0,0 +1,455 @@
+#include "BatchLoader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <cerrno>
+#include <algorithm>
+
+static_assert(sizeof(PngByte) == 1, "files are read straight into std::vector<PngByte>");
+
+// A single read submission is limited to what fits in the sqe length field.
+static constexpr std::size_t max_read_size = 1u << 30;
+
+/**
+ * What a completion on the ring belongs to, user_data is the file index
+ * times UringOpCount plus one of these.
+*/
+enum UringOp {
+    UringOpen,
+    UringStat,
+    UringRead,
+    UringOpCount,
+};
+
+/**
+ * Minimal io_uring wrapper talking to the kernel through raw syscalls so
+ * that no liburing dependency is needed. Files are opened, stat'ed and read
+ * with IORING_OP_OPENAT, IORING_OP_STATX and IORING_OP_READ, so none of the
+ * three waits on the thread calling next(). A failed setup() leaves
+ * whatever it got mapped for the destructor.
+*/
+struct BatchLoader::IoUring {
+    int fd;
+    void* sq_ring;
+    void* cq_ring;
+    io_uring_sqe* sqes;
+    std::size_t sq_ring_size;
+    std::size_t cq_ring_size;
+    std::size_t sqes_size;
+
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    unsigned entries;
+    unsigned queued;
+    // One per slot, written by the kernel when a UringStat completes
+    std::vector<struct statx> stats;
+
+    bool setup(unsigned requested_entries) {
+        io_uring_params params{};
+        sq_ring = cq_ring = sqes = nullptr;
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, requested_entries, &params));
+        if (fd < 0) {
+            return false;
+        }
+        entries = params.sq_entries;
+        queued = 0;
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        void* sq_map = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED) {
+            return false;
+        }
+        sq_ring = cq_ring = sq_map;
+        if (!single_mmap) {
+            void* cq_map = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_map == MAP_FAILED) {
+                cq_ring = nullptr;
+                return false;
+            }
+            cq_ring = cq_map;
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes_map == MAP_FAILED) {
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+        char* sq = static_cast<char*>(sq_ring);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ});
+    }
+
+    /**
+     * @brief asks the kernel whether it knows every one of ops. Kernels 5.1
+     * to 5.5 set up a ring but fail all three with -EINVAL, they do not
+     * know IORING_REGISTER_PROBE either.
+    */
+    bool supports(std::initializer_list<int> ops) {
+        std::vector<unsigned char> buffer(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+            return false;
+        }
+        return std::all_of(ops.begin(), ops.end(), [probe](int op) {
+            return probe->last_op >= op && probe->ops[op].flags & IO_URING_OP_SUPPORTED;
+        });
+    }
+
+    void queue(const io_uring_sqe& sqe) {
+        const unsigned tail = *sq_tail;
+        const unsigned index = tail & *sq_mask;
+        sqes[index] = sqe;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+    }
+
+    void queue_open(const char* path, std::size_t file_index) {
+        io_uring_sqe sqe{};
+        sqe.opcode = IORING_OP_OPENAT;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = reinterpret_cast<uint64_t>(path);
+        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+        sqe.user_data = file_index * UringOpCount + UringOpen;
+        queue(sqe);
+    }
+
+    /**
+     * @brief stats path rather than the descriptor, so that it does not have
+     * to wait for the open.
+    */
+    void queue_stat(const char* path, struct statx* status, std::size_t file_index) {
+        io_uring_sqe sqe{};
+        sqe.opcode = IORING_OP_STATX;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = reinterpret_cast<uint64_t>(path);
+        sqe.len = STATX_TYPE | STATX_SIZE;
+        sqe.off = reinterpret_cast<uint64_t>(status);
+        sqe.user_data = file_index * UringOpCount + UringStat;
+        queue(sqe);
+    }
+
+    void queue_read(int file_fd, void* buffer, std::size_t size, std::size_t offset, std::size_t file_index) {
+        io_uring_sqe sqe{};
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = file_fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = static_cast<uint32_t>(std::min(size, max_read_size));
+        sqe.off = offset;
+        sqe.user_data = file_index * UringOpCount + UringRead;
+        queue(sqe);
+    }
+
+    /**
+     * @brief hands every queued sqe to the kernel and optionally blocks
+     * until at least one completion is available.
+    */
+    void enter(bool wait_for_completion) {
+        while (true) {
+            const unsigned flags = wait_for_completion ? IORING_ENTER_GETEVENTS : 0;
+            const long submitted = syscall(__NR_io_uring_enter, fd, queued, wait_for_completion ? 1 : 0, flags, nullptr, 0);
+            if (submitted >= 0) {
+                queued -= static_cast<unsigned>(submitted);
+                return;
+            }
+            if (errno != EINTR) {
+                return;
+            }
+        }
+    }
+
+    ~IoUring() {
+        if (sqes) munmap(sqes, sqes_size);
+        if (cq_ring && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring) munmap(sq_ring, sq_ring_size);
+        if (fd >= 0) close(fd);
+    }
+};
+
+BatchLoader::BatchLoader(
+    const std::vector<std::string>& file_paths,
+    std::size_t queue_depth,
+    std::size_t number_of_threads,
+    bool allow_io_uring
+) :
+    file_paths_{file_paths},
+    queue_depth_{std::max<std::size_t>(queue_depth, 1)},
+    slots_{},
+    next_to_submit_{0},
+    next_to_return_{0},
+    ring_{},
+    mutex_{},
+    slot_done_{},
+    slot_free_{},
+    workers_{},
+    stopping_{false}
+{
+    slots_.resize(queue_depth_);
+    for (auto& slot : slots_) {
+        slot.fd = -1;
+        slot.done = false;
+        slot.success = false;
+        slot.bytes_read = 0;
+        slot.pending = 0;
+        slot.failed = false;
+    }
+    ring_ = std::make_unique<IoUring>();
+    // Every file in flight has at most its open and its stat, or one read,
+    // queued at the same time.
+    if (allow_io_uring && ring_->setup(static_cast<unsigned>(2 * queue_depth_))) {
+        ring_->stats.resize(queue_depth_);
+    }
+    else {
+        ring_.reset();
+        number_of_threads = std::clamp<std::size_t>(number_of_threads, 1, queue_depth_);
+        for (std::size_t i = 0; i < number_of_threads; i++) {
+            workers_.emplace_back(&BatchLoader::worker_loop, this);
+        }
+    }
+}
+
+BatchLoader::~BatchLoader() {
+    if (ring_) {
+        // The kernel may still be writing into slot buffers.
+        for (std::size_t i = next_to_return_; i < next_to_submit_; i++) {
+            while (!slots_[i % queue_depth_].done) {
+                wait_uring_completion();
+            }
+        }
+    }
+    else {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        slot_free_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+}
+
+bool BatchLoader::using_io_uring() const {
+    return static_cast<bool>(ring_);
+}
+
+bool BatchLoader::open_slot(std::size_t index) {
+    Slot& slot = slots_[index % queue_depth_];
+    slot.data.clear();
+    slot.bytes_read = 0;
+    slot.success = false;
+    slot.fd = open(file_paths_[index].c_str(), O_RDONLY | O_CLOEXEC);
+    if (slot.fd < 0) {
+        return false;
+    }
+    struct stat file_status{};
+    if (fstat(slot.fd, &file_status) != 0 || !S_ISREG(file_status.st_mode)) {
+        close(slot.fd);
+        slot.fd = -1;
+        return false;
+    }
+    slot.data.assign(static_cast<std::size_t>(file_status.st_size), PngByte(0));
+    if (slot.data.empty()) {
+        close(slot.fd);
+        slot.fd = -1;
+        slot.success = true;
+        return false;
+    }
+    return true;
+}
+
+void BatchLoader::submit_uring_reads() {
+    while (next_to_submit_ < file_paths_.size() && next_to_submit_ < next_to_return_ + queue_depth_) {
+        const std::size_t index = next_to_submit_++;
+        Slot& slot = slots_[index % queue_depth_];
+        slot.data.clear();
+        slot.bytes_read = 0;
+        slot.success = false;
+        slot.failed = false;
+        slot.done = false;
+        slot.pending = 2;
+        ring_->queue_open(file_paths_[index].c_str(), index);
+        ring_->queue_stat(file_paths_[index].c_str(), &ring_->stats[index % queue_depth_], index);
+    }
+    if (ring_->queued) {
+        ring_->enter(false);
+    }
+}
+
+void BatchLoader::start_uring_read(std::size_t index) {
+    Slot& slot = slots_[index % queue_depth_];
+    if (!slot.failed && !slot.data.empty()) {
+        ring_->queue_read(slot.fd, slot.data.data(), slot.data.size(), 0, index);
+        return;
+    }
+    // An empty regular file has been read in full.
+    slot.success = !slot.failed;
+    slot.done = true;
+    if (slot.fd >= 0) {
+        close(slot.fd);
+        slot.fd = -1;
+    }
+}
+
+void BatchLoader::wait_uring_completion() {
+    ring_->enter(true);
+    unsigned head = *ring_->cq_head;
+    const unsigned tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const io_uring_cqe& cqe = ring_->cqes[head & *ring_->cq_mask];
+        const std::size_t index = static_cast<std::size_t>(cqe.user_data / UringOpCount);
+        const UringOp op = static_cast<UringOp>(cqe.user_data % UringOpCount);
+        const int result = cqe.res;
+        head++;
+        Slot& slot = slots_[index % queue_depth_];
+        if (op == UringOpen || op == UringStat) {
+            if (result == -EINTR || result == -EAGAIN) {
+                if (op == UringOpen) {
+                    ring_->queue_open(file_paths_[index].c_str(), index);
+                }
+                else {
+                    ring_->queue_stat(file_paths_[index].c_str(), &ring_->stats[index % queue_depth_], index);
+                }
+                continue;
+            }
+            if (op == UringOpen) {
+                slot.fd = result;
+                slot.failed = slot.failed || result < 0;
+            }
+            else {
+                const struct statx& status = ring_->stats[index % queue_depth_];
+                if (result < 0 || !S_ISREG(status.stx_mode)) {
+                    slot.failed = true;
+                }
+                else {
+                    slot.data.assign(static_cast<std::size_t>(status.stx_size), PngByte(0));
+                }
+            }
+            if (--slot.pending == 0) {
+                start_uring_read(index);
+            }
+            continue;
+        }
+        if (result == -EINTR || result == -EAGAIN) {
+            ring_->queue_read(slot.fd, slot.data.data() + slot.bytes_read, slot.data.size() - slot.bytes_read, slot.bytes_read, index);
+            continue;
+        }
+        if (result > 0) {
+            slot.bytes_read += static_cast<std::size_t>(result);
+            if (slot.bytes_read < slot.data.size()) {
+                ring_->queue_read(slot.fd, slot.data.data() + slot.bytes_read, slot.data.size() - slot.bytes_read, slot.bytes_read, index);
+                continue;
+            }
+        }
+        // Zero means the file shrank after fstat, keep what was read.
+        slot.data.resize(slot.bytes_read, PngByte(0));
+        slot.success = result >= 0;
+        slot.done = true;
+        close(slot.fd);
+        slot.fd = -1;
+    }
+    __atomic_store_n(ring_->cq_head, head, __ATOMIC_RELEASE);
+    if (ring_->queued) {
+        ring_->enter(false);
+    }
+}
+
+void BatchLoader::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        slot_free_.wait(lock, [this] {
+            return stopping_ ||
+                   next_to_submit_ >= file_paths_.size() ||
+                   next_to_submit_ < next_to_return_ + queue_depth_;
+        });
+        if (stopping_ || next_to_submit_ >= file_paths_.size()) {
+            return;
+        }
+        const std::size_t index = next_to_submit_++;
+        Slot& slot = slots_[index % queue_depth_];
+        lock.unlock();
+
+        if (open_slot(index)) {
+            while (slot.bytes_read < slot.data.size()) {
+                const ssize_t result = pread(
+                    slot.fd,
+                    slot.data.data() + slot.bytes_read,
+                    std::min(slot.data.size() - slot.bytes_read, max_read_size),
+                    static_cast<off_t>(slot.bytes_read)
+                );
+                if (result < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (result <= 0) {
+                    break;
+                }
+                slot.bytes_read += static_cast<std::size_t>(result);
+            }
+            slot.success = slot.bytes_read == slot.data.size();
+            slot.data.resize(slot.bytes_read, PngByte(0));
+            close(slot.fd);
+            slot.fd = -1;
+        }
+
+        lock.lock();
+        slot.done = true;
+        slot_done_.notify_all();
+    }
+}
+
+bool BatchLoader::next(LoadedFile& file) {
+    if (next_to_return_ >= file_paths_.size()) {
+        return false;
+    }
+    const std::size_t index = next_to_return_;
+    Slot& slot = slots_[index % queue_depth_];
+    if (ring_) {
+        submit_uring_reads();
+        while (!slot.done) {
+            wait_uring_completion();
+        }
+        file.path = file_paths_[index];
+        file.data = std::move(slot.data);
+        file.success = slot.success;
+        slot.data = {};
+        slot.done = false;
+        next_to_return_++;
+        // Refill the freed slot so its read overlaps with the caller's decode.
+        submit_uring_reads();
+    }
+    else {
+        std::unique_lock<std::mutex> lock(mutex_);
+        slot_done_.wait(lock, [&slot] { return slot.done; });
+        file.path = file_paths_[index];
+        file.data = std::move(slot.data);
+        file.success = slot.success;
+        slot.data = {};
+        slot.done = false;
+        next_to_return_++;
+        lock.unlock();
+        slot_free_.notify_all();
+    }
+    return true;
+}
@@ -0,0 +1,214 @@
+#include "DecodeCache.h"
+
+#include <cstring>
+#include <bit>
+#include <algorithm>
+
+// Rounds and constants of xxHash64, four independent lanes per 32 bytes.
+static constexpr uint64_t prime_1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t prime_2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t prime_3 = 0x165667b19e3779f9ull;
+
+static uint64_t hash_round(uint64_t lane, uint64_t word) {
+    lane += word * prime_2;
+    lane = std::rotl(lane, 31);
+    return lane * prime_1;
+}
+
+static uint64_t read_word(const unsigned char* bytes) {
+    uint64_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+static uint64_t hash_bytes(const unsigned char* bytes, std::size_t size, uint64_t seed) {
+    uint64_t lanes[4] = {seed + prime_1 + prime_2, seed + prime_2, seed, seed - prime_1};
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int lane = 0; lane < 4; lane++) {
+            lanes[lane] = hash_round(lanes[lane], read_word(bytes + i + 8 * lane));
+        }
+    }
+    uint64_t h = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+    h += size;
+    for (; i + 8 <= size; i += 8) {
+        h = std::rotl(h ^ hash_round(0, read_word(bytes + i)), 27) * prime_1 + prime_3;
+    }
+    for (; i < size; i++) {
+        h = std::rotl(h ^ (bytes[i] * prime_3), 11) * prime_1;
+    }
+    h ^= h >> 33;
+    h *= prime_2;
+    h ^= h >> 29;
+    h *= prime_3;
+    return h ^ (h >> 32);
+}
+
+uint64_t content_hash(const Png& png) {
+    static constexpr const char* hashed_chunk_names[] = {"IHDR", "PLTE", "tRNS", "gAMA", "sRGB", "iCCP", "IDAT"};
+    uint64_t h = 0;
+    for (const auto& chunk : png.get_chunks()) {
+        for (const char* name : hashed_chunk_names) {
+            if (std::memcmp(chunk.type, name, 4) == 0) {
+                h = hash_bytes(chunk.type, 4, h);
+                h = hash_bytes(png.get_chunk_data(chunk), chunk.length, h);
+                break;
+            }
+        }
+    }
+    return h;
+}
+
+static uint64_t idat_length(const Png& png) {
+    uint64_t length = 0;
+    for (const auto& chunk : png.get_chunks()) {
+        if (std::memcmp(chunk.type, "IDAT", 4) == 0) {
+            length += chunk.length;
+        }
+    }
+    return length;
+}
+
+std::size_t DecodeCache::KeyHash::operator()(const Key& key) const {
+    const uint64_t format =
+        static_cast<uint64_t>(key.format.order) |
+        static_cast<uint64_t>(key.format.premultiplied) << 4 |
+        static_cast<uint64_t>(key.format.sample_type) << 8 |
+        static_cast<uint64_t>(key.format.planar) << 12 |
+        static_cast<uint64_t>(key.format.transfer) << 16 |
+        static_cast<uint64_t>(key.scale) << 20 |
+        static_cast<uint64_t>(key.adam7_coarse_passes) << 24;
+    const uint64_t size = static_cast<uint64_t>(key.width) << 32 | key.height;
+    return static_cast<std::size_t>(hash_round(hash_round(hash_round(key.hash, key.idat_length), size), format));
+}
+
+DecodeCache::DecodeCache(std::size_t byte_budget, std::size_t number_of_shards) :
+    shards_(std::max<std::size_t>(number_of_shards, 1)),
+    shard_budget_{byte_budget / std::max<std::size_t>(number_of_shards, 1)},
+    hits_{0},
+    misses_{0},
+    coalesced_{0},
+    evictions_{0}
+{
+    for (auto& shard : shards_) {
+        shard.bytes = 0;
+    }
+}
+
+void DecodeCache::evict(Shard& shard, std::size_t incoming_bytes) {
+    while (!shard.lru.empty() && shard.bytes + incoming_bytes > shard_budget_) {
+        const Entry& oldest = shard.lru.back();
+        shard.bytes -= oldest.bytes;
+        shard.entries.erase(oldest.key);
+        shard.lru.pop_back();
+        evictions_++;
+    }
+}
+
+DecodeCache::ImagePtr DecodeCache::get_or_decode(const Key& key, const std::function<std::optional<DecodedImage>()>& decode_image) {
+    Shard& shard = shards_[KeyHash{}(key) % shards_.size()];
+    std::unique_lock<std::mutex> lock{shard.mutex};
+
+    const auto found = shard.entries.find(key);
+    if (found != shard.entries.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        hits_++;
+        return found->second->image;
+    }
+    const auto flight = shard.in_flight.find(key);
+    if (flight != shard.in_flight.end()) {
+        const std::shared_future<ImagePtr> result = flight->second;
+        lock.unlock();
+        coalesced_++;
+        return result.get();
+    }
+    misses_++;
+    std::promise<ImagePtr> promise;
+    shard.in_flight.emplace(key, promise.get_future().share());
+    lock.unlock();
+
+    // Decoding happens outside the lock, other keys of the shard stay
+    // available meanwhile.
+    ImagePtr image;
+    try {
+        std::optional<DecodedImage> decoded = decode_image();
+        image = decoded ? std::make_shared<const DecodedImage>(std::move(*decoded)) : nullptr;
+    }
+    catch (...) {
+        lock.lock();
+        shard.in_flight.erase(key);
+        lock.unlock();
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    lock.lock();
+    shard.in_flight.erase(key);
+    if (image) {
+        const std::size_t bytes = sizeof(DecodedImage) + image->data.size();
+        if (bytes <= shard_budget_) {
+            evict(shard, bytes);
+            shard.lru.push_front(Entry{key, image, bytes});
+            shard.entries.emplace(key, shard.lru.begin());
+            shard.bytes += bytes;
+        }
+    }
+    lock.unlock();
+    promise.set_value(image);
+    return image;
+}
+
+DecodeCache::ImagePtr DecodeCache::get(const Png& png, const PixelFormat& format) {
+    return get(png, format, [](const Png& png, const PixelFormat& format) {
+        return decode(png, format);
+    });
+}
+
+DecodeCache::ImagePtr DecodeCache::get(const Png& png, const PixelFormat& format, const Decoder& decoder) {
+    if (!png.is_parsed()) {
+        return nullptr;
+    }
+    const IHDR& header = png.get_header();
+    const Key key{content_hash(png), idat_length(png), header.width, header.height, format, 0, false};
+    return get_or_decode(key, [&]() {
+        return decoder(png, format);
+    });
+}
+
+DecodeCache::ImagePtr DecodeCache::get_thumbnail(const Png& png, ThumbnailScale scale, bool adam7_coarse_passes, const PixelFormat& format) {
+    if (!png.is_parsed()) {
+        return nullptr;
+    }
+    const IHDR& header = png.get_header();
+    const Key key{
+        content_hash(png),
+        idat_length(png),
+        header.width,
+        header.height,
+        format,
+        static_cast<unsigned char>(scale),
+        adam7_coarse_passes && header.interlace_method
+    };
+    return get_or_decode(key, [&]() {
+        return decode_thumbnail(png, scale, adam7_coarse_passes, format);
+    });
+}
+
+DecodeCacheStats DecodeCache::stats() const {
+    DecodeCacheStats stats{hits_.load(), misses_.load(), coalesced_.load(), evictions_.load(), 0, 0};
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        stats.bytes += shard.bytes;
+        stats.entries += shard.lru.size();
+    }
+    return stats;
+}
+
+void DecodeCache::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        shard.entries.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
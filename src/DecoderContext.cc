@@ -0,0 +1,85 @@
+#include "DecoderContext.h"
+
+#include <algorithm>
+
+Arena::Arena(std::size_t initial_size) :
+    blocks_{},
+    current_block_{0},
+    offset_{0},
+    next_block_size_{std::max<std::size_t>(initial_size, 4096)}
+{
+}
+
+/**
+ * @brief the first offset at or after offset whose address in data is
+ * aligned to alignment.
+*/
+static std::size_t aligned_offset(const std::byte* data, std::size_t offset, std::size_t alignment) {
+    const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(data) + offset;
+    return offset + ((alignment - (address & (alignment - 1))) & (alignment - 1));
+}
+
+void* Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    while (current_block_ < blocks_.size()) {
+        Block& block = blocks_[current_block_];
+        const std::size_t start = aligned_offset(block.data.get(), offset_, alignment);
+        if (start + bytes <= block.size) {
+            offset_ = start + bytes;
+            return block.data.get() + start;
+        }
+        // Blocks kept from before the last reset are reused in order.
+        current_block_++;
+        offset_ = 0;
+    }
+    // new[] of std::byte is aligned for any fundamental type, larger
+    // alignments are padded inside the block.
+    const std::size_t size = std::max(next_block_size_, bytes + alignment);
+    next_block_size_ = size * 2;
+    blocks_.push_back(Block{std::make_unique<std::byte[]>(size), size});
+    current_block_ = blocks_.size() - 1;
+    std::byte* data = blocks_.back().data.get();
+    const std::size_t start = aligned_offset(data, 0, alignment);
+    offset_ = start + bytes;
+    return data + start;
+}
+
+void Arena::do_deallocate(void*, std::size_t, std::size_t) {
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+void Arena::reset() {
+    current_block_ = 0;
+    offset_ = 0;
+}
+
+std::size_t Arena::bytes_reserved() const {
+    std::size_t total = 0;
+    for (const auto& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+DecoderContext::DecoderContext(std::size_t initial_size) :
+    arena_{initial_size}
+{
+}
+
+std::pmr::memory_resource* DecoderContext::resource() {
+    return &arena_;
+}
+
+void DecoderContext::reset() {
+    arena_.reset();
+}
+
+std::size_t DecoderContext::bytes_reserved() const {
+    return arena_.bytes_reserved();
+}
+
+std::pmr::memory_resource* scratch_resource(DecoderContext* context) {
+    return context ? context->resource() : std::pmr::get_default_resource();
+}
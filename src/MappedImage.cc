@@ -0,0 +1,165 @@
+#include "MappedImage.h"
+#include "decode.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+MappedImage::MappedImage(
+    const std::string& path,
+    uint32_t width,
+    uint32_t height,
+    const PixelFormat& format,
+    uint32_t tile_rows,
+    uint64_t sync_interval
+) :
+    fd_{-1},
+    data_{nullptr},
+    size_{bytes_per_image(format, width, height)},
+    width_{width},
+    height_{height},
+    format_{format},
+    tile_rows_{std::max<uint32_t>(tile_rows, 1)},
+    sync_interval_{sync_interval},
+    released_rows_{0},
+    stored_rows_{0},
+    unsynced_bytes_{0},
+    write_failed_{false}
+{
+    // The whole file is mapped at once, it has to fit the address space.
+    if (size_ == 0 || size_ > std::numeric_limits<std::size_t>::max() ||
+        size_ > static_cast<uint64_t>(std::numeric_limits<off_t>::max())) {
+        return;
+    }
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        return;
+    }
+    // Reserving the blocks up front turns a full disk into an error here
+    // instead of a SIGBUS on some store halfway through the decode.
+    const int reserved = posix_fallocate(fd_, 0, static_cast<off_t>(size_));
+    if (reserved == EINVAL || reserved == EOPNOTSUPP) {
+        if (ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+            return;
+        }
+    }
+    else if (reserved != 0) {
+        return;
+    }
+    void* mapping = mmap(nullptr, static_cast<std::size_t>(size_), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+    data_ = static_cast<unsigned char*>(mapping);
+    madvise(data_, static_cast<std::size_t>(size_), MADV_SEQUENTIAL);
+}
+
+MappedImage::~MappedImage() {
+    finish();
+}
+
+bool MappedImage::is_open() const {
+    return data_ != nullptr;
+}
+
+unsigned char* MappedImage::data() {
+    return data_;
+}
+
+uint64_t MappedImage::size() const {
+    return size_;
+}
+
+uint32_t MappedImage::width() const {
+    return width_;
+}
+
+uint32_t MappedImage::height() const {
+    return height_;
+}
+
+const PixelFormat& MappedImage::format() const {
+    return format_;
+}
+
+void MappedImage::release_rows(uint32_t first, uint32_t end) {
+    static const uint64_t page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    const uint64_t pixel_bytes = bytes_per_sample(format_) * (format_.planar ? 1 : 4);
+    const uint64_t row_bytes = width_ * pixel_bytes;
+    const uint64_t plane_bytes = format_.planar ? row_bytes * height_ : 0;
+    for (int plane = 0; plane < (format_.planar ? 4 : 1); plane++) {
+        // The page holding the start of row end is still being written,
+        // the one holding row first was finished with the tile before.
+        const uint64_t start = (plane * plane_bytes + first * row_bytes) / page_size * page_size;
+        const uint64_t stop = (plane * plane_bytes + end * row_bytes) / page_size * page_size;
+        if (stop <= start) {
+            continue;
+        }
+        // Pages of a shared file mapping keep their data in the page cache.
+        madvise(data_ + start, static_cast<std::size_t>(stop - start), MADV_DONTNEED);
+        unsynced_bytes_ += stop - start;
+    }
+    if (unsynced_bytes_ >= sync_interval_) {
+        if (msync(data_, static_cast<std::size_t>(size_), MS_SYNC) != 0) {
+            write_failed_ = true;
+        }
+        unsynced_bytes_ = 0;
+    }
+}
+
+void MappedImage::rows_stored(uint32_t rows) {
+    if (!data_) {
+        return;
+    }
+    if (rows <= stored_rows_) {
+        // The next Adam7 pass starts over from the top.
+        release_rows(released_rows_, height_);
+        released_rows_ = 0;
+    }
+    stored_rows_ = rows;
+    if (rows - released_rows_ >= tile_rows_) {
+        release_rows(released_rows_, rows);
+        released_rows_ = rows;
+    }
+}
+
+bool MappedImage::finish() {
+    if (data_) {
+        if (msync(data_, static_cast<std::size_t>(size_), MS_SYNC) != 0) {
+            write_failed_ = true;
+        }
+        munmap(data_, static_cast<std::size_t>(size_));
+        data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        if (close(fd_) != 0) {
+            write_failed_ = true;
+        }
+        fd_ = -1;
+    }
+    return !write_failed_;
+}
+
+bool decode_to_file(const Png& png, const std::string& path, const PixelFormat& format, DecoderContext* context) {
+    if (!png.is_parsed()) {
+        return false;
+    }
+    const IHDR& header = png.get_header();
+    MappedImage image{path, header.width, header.height, format};
+    if (!image.is_open()) {
+        return false;
+    }
+    const bool decoded = decode_into(png, image.data(), format, [&](uint32_t rows) {
+        image.rows_stored(rows);
+    }, context);
+    const bool written = image.finish();
+    if (!decoded || !written) {
+        std::remove(path.c_str());
+        return false;
+    }
+    return true;
+}
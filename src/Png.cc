@@ -1,6 +1,5 @@
 #include "Png.h"
-
-static constexpr bool verbose_construction = true;
+#include "instrumentation.h"
 
 static constexpr unsigned char png_signature[] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
 
@@ -8,18 +7,20 @@ static const char* critical_chunk_names[] = {
     "IHDR", "IDAT", "PLTE", "IEND",
 };
 
+static_assert(sizeof(PngByte) == 1, "data_ is filled with a single bulk read");
+
 void Png::load_data_from_file_path() {
     std::ifstream file;
     try {
-        file.open(file_path, std::ios::in | std::ios::binary);
-        while (!file.eof()) {
-            char c{};
-            file.get(c);
-            if (!file.eof()){
-                data_.push_back(PngByte(static_cast<unsigned char>(c)));
-            }
-            
+        file.open(file_path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.good()) {
+            return;
         }
+        const std::streamsize file_size = file.tellg();
+        file.seekg(0);
+        data_.assign(static_cast<std::size_t>(file_size), PngByte(0));
+        file.read(reinterpret_cast<char*>(data_.data()), file_size);
+        data_.resize(static_cast<std::size_t>(file.gcount()), PngByte(0));
         file.close();
     }
     catch (const std::ifstream::failure& e) {
@@ -29,6 +30,9 @@ void Png::load_data_from_file_path() {
 
 bool Png::validate_png_signature()
 {
+    if (data_.size() < sizeof(png_signature)) {
+        return false;
+    }
     for (unsigned long i = 0; i < sizeof(png_signature); i++) {
         if (data_[i].data != png_signature[i]){
             return false;
@@ -37,87 +41,127 @@ bool Png::validate_png_signature()
     return true;
 }
 
-bool Png::validate_IHDR() {
+static bool chunk_has_name(const Chunk& chunk, const char* name) {
     for (int i = 0; i < 4; i++) {
-        if (static_cast<char>(chunks_[0].type[i]) != critical_chunk_names[0][i]) {
+        if (static_cast<char>(chunk.type[i]) != name[i]) {
             return false;
         }
     }
     return true;
 }
 
+bool Png::validate_IHDR() {
+    constexpr uint32_t sizeof_IHDR_data = 13;
+    return !chunks_.empty() &&
+           chunk_has_name(chunks_[0], critical_chunk_names[0]) &&
+           chunks_[0].length == sizeof_IHDR_data;
+}
+
 bool Png::validate_IDAT()
 {
-    int number_of_IDAT_chunks = 0;
     bool previous_chunk_was_IDAT = false;
     for (std::size_t i = 0; i < chunks_.size(); ++i) {
-        bool is_IDAT_chunk = true;
-        for (int i = 0; i < 4; i++) {
-            if (static_cast<char>(chunks_[i].type[i]) != critical_chunk_names[1][i]) {
-                is_IDAT_chunk = false;
-                previous_chunk_was_IDAT = false;
-                break;
-            }
-        }
+        const bool is_IDAT_chunk = chunk_has_name(chunks_[i], critical_chunk_names[1]);
         if (is_IDAT_chunk) {
-            previous_chunk_was_IDAT = true;
-            number_of_IDAT_chunks++;
+            // IDAT chunks have to be consecutive
+            if (!IDAT_chunk_indexes.empty() && !previous_chunk_was_IDAT) {
+                return false;
+            }
+            IDAT_chunk_indexes.push_back(static_cast<int>(i));
         }
+        previous_chunk_was_IDAT = is_IDAT_chunk;
     }
+    return !IDAT_chunk_indexes.empty();
 }
 
 
-Png::Png(const std::string& path_to_image) :
+Png::Png(const std::string& path_to_image, std::pmr::memory_resource* resource) :
     data_{},
-    chunks_{},
+    chunks_{resource},
     header_{},
-    IDAT_chunk_indexes{},
+    IDAT_chunk_indexes{resource},
     file_path{path_to_image},
     parsing_success{false}
 {
     load_data_from_file_path();
-    bool valid_png_signature_found = validate_png_signature();
-    if constexpr (verbose_construction) {
-        if (valid_png_signature_found) {
-            std::cout << file_path << ": valid png signature\n";
-        }
-        else {
-            std::cout << file_path << ": invalid png signature\n";
-        }
+    parse();
+}
+
+Png::Png(const std::string& path_to_image, std::vector<PngByte>&& file_data, std::pmr::memory_resource* resource) :
+    data_{std::move(file_data)},
+    chunks_{resource},
+    header_{},
+    IDAT_chunk_indexes{resource},
+    file_path{path_to_image},
+    parsing_success{false}
+{
+    parse();
+}
+
+void Png::parse() {
+    instrumentation::Counters counters{};
+    {
+        instrumentation::StageTimer timer{counters, instrumentation::Stage::Parse};
+        parsing_success = parse_steps();
     }
-    if (!valid_png_signature_found) return;
+    instrumentation::publish(counters);
+}
+
+bool Png::parse_steps() {
+    bool valid_png_signature_found = validate_png_signature();
+    BITMAP_TRACE("%s: %s png signature", file_path.c_str(), valid_png_signature_found ? "valid" : "invalid");
+    if (!valid_png_signature_found) return false;
     populate_chunks();
     bool valid_IHDR = validate_IHDR();
-    if constexpr (verbose_construction) {
-        if (valid_IHDR) {
-            std::cout << file_path << ": valid IHDR position\n";
-        }
-        else {
-            std::cout << file_path << ": invalid IHDR position\n";
-        }
-    }
-    if (!valid_IHDR) return;
+    BITMAP_TRACE("%s: %s IHDR position", file_path.c_str(), valid_IHDR ? "valid" : "invalid");
+    if (!valid_IHDR) return false;
     populate_header();
+    bool valid_IDAT = validate_IDAT();
+    BITMAP_TRACE("%s: %s IDAT chunks", file_path.c_str(), valid_IDAT ? "valid" : "invalid");
+    return valid_IDAT;
 }
 
-Png::~Png() {
-    if constexpr (verbose_construction) {
-        std::cout << file_path << ": PNG destructor called\n";
-    }
-}
-
-void Png::print_data_hex(int width) const {
+void Png::print_data_hex(std::ostream& out, int width) const {
     int line_width = 0;
-    std::cout << "file size: " << data_.size() << "\n";
+    out << "file size: " << data_.size() << "\n";
     for (auto const& c : data_){
-        std::cout << c << " ";
+        out << c << " ";
         ++line_width;
         if (line_width == width) {
-            std::cout << "\n";
+            out << "\n";
             line_width = 0;
         }
     }
-    std::cout << "\n";
+    out << "\n";
+}
+
+bool Png::is_parsed() const {
+    return parsing_success;
+}
+
+const IHDR& Png::get_header() const {
+    return header_;
+}
+
+const std::pmr::vector<Chunk>& Png::get_chunks() const {
+    return chunks_;
+}
+
+const std::pmr::vector<int>& Png::get_IDAT_chunk_indexes() const {
+    return IDAT_chunk_indexes;
+}
+
+const Chunk* Png::find_chunk(const char* name) const {
+    for (const auto& chunk : chunks_) {
+        if (chunk_has_name(chunk, name)) {
+            return &chunk;
+        }
+    }
+    return nullptr;
+}
+
+const unsigned char* Png::get_chunk_data(const Chunk& chunk) const {
+    return &data_[chunk.chunk_data_start].data;
 }
 
 uint32_t Png::get_uint32_t_h(std::size_t index_into_data) const {
@@ -132,36 +176,39 @@ uint32_t Png::get_uint32_t_h(std::size_t index_into_data) const {
 void Png::populate_chunks() {
     std::size_t current_index = sizeof(png_signature);
     while (current_index < data_.size()) {
+        if (current_index + sizeof(uint32_t) > data_.size()) {
+            BITMAP_TRACE("%s: file ends inside a chunk length", file_path.c_str());
+            break;
+        }
         uint32_t length = get_uint32_t_h(current_index);
         current_index += sizeof(uint32_t);
                         // length + crc int + name chars
         if (current_index + length + 4 + 4 > data_.size()) {
-            if constexpr (verbose_construction) {
-                std::cout << "Error: length found was to big for file size.\n";
-            }
+            BITMAP_TRACE("%s: chunk length %u runs past the end of the file", file_path.c_str(), length);
             break;
         }
 
         unsigned char type[4];
+        bool valid_name = true;
         for (int i = 0; i < 4; i++) {
-            type[i] = data_[current_index].data;
-            if (!((type[i] >= 0x41 && type[i] <= 0x5A) || (type[i] >= 0x61 && type[i] <= 0x7A))) {
-                if constexpr (verbose_construction) {
-                    std::cout << "Error: chunk name parsing found a non ascii character.\n";
-                }
-                break;
-            }
-            current_index++;
+            type[i] = data_[current_index + i].data;
+            valid_name = valid_name && ((type[i] >= 0x41 && type[i] <= 0x5A) || (type[i] >= 0x61 && type[i] <= 0x7A));
+        }
+        if (!valid_name) {
+            // The length before it can not be trusted either, nothing after
+            // this point is read as chunks.
+            BITMAP_TRACE("%s: chunk name has a non ascii character", file_path.c_str());
+            break;
         }
+        current_index += 4;
         std::size_t chunk_data_start = current_index;
         current_index += length;
         uint32_t crc = get_uint32_t_h(current_index);
         current_index += sizeof(uint32_t);
-        if constexpr (verbose_construction) {
-            std::cout << "chunk " << type[0] << type[1] << type[2] << type[3] 
-                      << " length: " << length << " start: " << chunk_data_start 
-                      << " crc: " << crc << "\n";
-        }
+        BITMAP_TRACE(
+            "%s: chunk %c%c%c%c length: %u start: %zu crc: %u", file_path.c_str(),
+            type[0], type[1], type[2], type[3], length, chunk_data_start, crc
+        );
         chunks_.push_back(Chunk {
             .length = length,
             .type = {type[0], type[1], type[2], type[3]},
@@ -177,37 +224,21 @@ void Png::populate_header() {
     std::size_t current_index = sizeof(png_signature) + sizeof_length_field + sizeof_name_field;
     header_.width = get_uint32_t_h(current_index);
     current_index += sizeof(uint32_t);
-    if constexpr (verbose_construction) {
-        std::cout << "IHDR width: " << header_.width << "\n";
-    }
     header_.height = get_uint32_t_h(current_index);
     current_index += sizeof(uint32_t);
-    if constexpr (verbose_construction) {
-        std::cout << "IHDR height: " << header_.width << "\n";
-    }
     header_.bit_depth = data_[current_index].data;
     current_index++;
-    if constexpr (verbose_construction) {
-        std::cout << "IHDR bit depth: " << (int) header_.bit_depth << "\n";
-    }
     header_.color_type = data_[current_index].data;
     current_index++;
-    if constexpr (verbose_construction) {
-        std::cout << "IHDR color type: " << (int) header_.color_type << "\n";
-    }
     header_.compression_method = data_[current_index].data;
     current_index++;
-    if constexpr (verbose_construction) {
-        std::cout << "IHDR compression method: " << (int) header_.compression_method << "\n";
-    }
     header_.filter_method = data_[current_index].data;
     current_index++;
-    if constexpr (verbose_construction) {
-        std::cout << "IHDR filter method: " << (int) header_.filter_method << "\n";
-    }
     header_.interlace_method = data_[current_index].data;
     current_index++;
-    if constexpr (verbose_construction) {
-        std::cout << "IHDR interlace method: " << (int) header_.interlace_method << "\n";
-    }
+    BITMAP_TRACE(
+        "%s: IHDR %ux%u bit depth %d color type %d compression %d filter %d interlace %d", file_path.c_str(),
+        header_.width, header_.height, header_.bit_depth, header_.color_type,
+        header_.compression_method, header_.filter_method, header_.interlace_method
+    );
 }
\ No newline at end of file
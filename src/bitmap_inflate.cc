@@ -0,0 +1,124 @@
+/**
+ * bitmap-inflate: decompresses stdin to stdout with the inflate of this
+ * library, like gzip -dc or zlib-flate -uncompress.
+ *
+ *     bitmap-inflate [-f raw|zlib|gzip|auto] < in > out
+ *
+ * auto, the default, tells gzip and zlib streams apart by their header and
+ * takes anything else for raw deflate. Input is read and output written in
+ * fixed size blocks, so memory use does not depend on the size of either.
+ * Exits 1 with the reason on stderr if the stream is corrupt or truncated.
+*/
+
+#include "deflate.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static constexpr std::size_t ReadSize = std::size_t{1} << 16;
+static constexpr std::size_t WriteSize = std::size_t{1} << 18;
+
+static bool write_all(int fd, const unsigned char* bytes, std::size_t size) {
+    while (size > 0) {
+        const ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        size -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+static bool parse_framing(const std::string& name, deflate::Framing& framing) {
+    if (name == "raw") {
+        framing = deflate::Framing::Raw;
+    }
+    else if (name == "zlib") {
+        framing = deflate::Framing::Zlib;
+    }
+    else if (name == "gzip") {
+        framing = deflate::Framing::Gzip;
+    }
+    else if (name == "auto") {
+        framing = deflate::Framing::Detect;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    deflate::Framing framing = deflate::Framing::Detect;
+    if (argc == 3 && std::strcmp(argv[1], "-f") == 0) {
+        if (!parse_framing(argv[2], framing)) {
+            std::fprintf(stderr, "bitmap-inflate: unknown format \"%s\"\n", argv[2]);
+            return 2;
+        }
+    }
+    else if (argc != 1) {
+        std::fprintf(stderr, "usage: %s [-f raw|zlib|gzip|auto] < in > out\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<unsigned char> input(ReadSize);
+    bool read_failed = false;
+    const deflate::ByteSource source = [&](const unsigned char*& bytes, std::size_t& size) {
+        for (;;) {
+            const ssize_t n = read(STDIN_FILENO, input.data(), input.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                read_failed = n < 0;
+                return false;
+            }
+            bytes = input.data();
+            size = static_cast<std::size_t>(n);
+            return true;
+        }
+    };
+
+    // The sink gets at most a window of output at a time, gather it into
+    // fewer, larger writes.
+    std::vector<unsigned char> output;
+    output.reserve(WriteSize);
+    bool write_failed = false;
+    const deflate::ByteSink sink = [&](const unsigned char* bytes, std::size_t size) {
+        if (output.size() + size > WriteSize) {
+            if (!write_all(STDOUT_FILENO, output.data(), output.size())) {
+                write_failed = true;
+                return false;
+            }
+            output.clear();
+        }
+        output.insert(output.end(), bytes, bytes + size);
+        return true;
+    };
+
+    const deflate::Status status = deflate::decompress(framing, source, sink);
+    if (!write_failed && !write_all(STDOUT_FILENO, output.data(), output.size())) {
+        write_failed = true;
+    }
+    if (read_failed) {
+        std::fprintf(stderr, "bitmap-inflate: reading stdin: %s\n", std::strerror(errno));
+        return 1;
+    }
+    if (write_failed) {
+        std::fprintf(stderr, "bitmap-inflate: writing stdout: %s\n", std::strerror(errno));
+        return 1;
+    }
+    if (deflate::is_error(status)) {
+        std::fprintf(stderr, "bitmap-inflate: %s\n", deflate::status_name(status));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "color_management.h"
+#include "cpu_dispatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+static uint32_t read_uint32(const unsigned char* data) {
+    return static_cast<uint32_t>(data[0]) << 24 |
+           static_cast<uint32_t>(data[1]) << 16 |
+           static_cast<uint32_t>(data[2]) << 8 |
+           static_cast<uint32_t>(data[3]);
+}
+
+ColorInfo read_color_info(const Png& png) {
+    ColorInfo info{};
+    if (const Chunk* gama = png.find_chunk("gAMA")) {
+        if (gama->length == 4) {
+            info.gamma = read_uint32(png.get_chunk_data(*gama));
+            info.has_gamma = info.gamma != 0;
+        }
+    }
+    if (const Chunk* srgb = png.find_chunk("sRGB")) {
+        if (srgb->length == 1) {
+            info.is_srgb = true;
+            info.srgb_rendering_intent = png.get_chunk_data(*srgb)[0];
+        }
+    }
+    if (const Chunk* chrm = png.find_chunk("cHRM")) {
+        if (chrm->length == 32) {
+            const unsigned char* data = png.get_chunk_data(*chrm);
+            double values[8];
+            for (int i = 0; i < 8; i++) {
+                values[i] = read_uint32(data + 4 * i) / 100000.0;
+            }
+            info.has_chromaticities = true;
+            info.chromaticities = Chromaticities{
+                values[0], values[1], values[2], values[3],
+                values[4], values[5], values[6], values[7]
+            };
+        }
+    }
+    if (const Chunk* iccp = png.find_chunk("iCCP")) {
+        const unsigned char* data = png.get_chunk_data(*iccp);
+        // The profile name is a null terminated keyword of 1 to 79 bytes.
+        std::size_t length = 0;
+        while (length < iccp->length && length < 80 && data[length] != 0) {
+            length++;
+        }
+        info.has_icc_profile = true;
+        info.icc_profile_name.assign(reinterpret_cast<const char*>(data), length);
+    }
+    return info;
+}
+
+static double srgb_to_linear(double x) {
+    return x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4);
+}
+
+static double linear_to_srgb(double x) {
+    return x <= 0.0031308 ? x * 12.92 : 1.055 * std::pow(x, 1.0 / 2.4) - 0.055;
+}
+
+/**
+ * @param gamma gAMA value of the source, 0 for the sRGB curve.
+*/
+static const TransferTable& cached_table(uint32_t gamma, TransferFunction output) {
+    static std::mutex mutex;
+    static std::map<std::pair<uint32_t, TransferFunction>, std::unique_ptr<TransferTable>> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<TransferTable>& table = tables[{gamma, output}];
+    if (!table) {
+        table = std::make_unique<TransferTable>();
+        for (int i = 0; i < 256; i++) {
+            const double x = i / 255.0;
+            const double linear = gamma == 0 ? srgb_to_linear(x) : std::pow(x, 100000.0 / gamma);
+            const double out = output == TransferFunction::Linear ? linear : linear_to_srgb(linear);
+            (*table)[i] = static_cast<unsigned char>(std::lround(std::clamp(out, 0.0, 1.0) * 255.0));
+        }
+    }
+    return *table;
+}
+
+TransferCurve make_transfer_curve(const ColorInfo& info, TransferFunction output) {
+    TransferCurve curve{};
+    curve.output = output;
+    // The sRGB chunk wins over gAMA, and with nothing declared sRGB is assumed.
+    curve.source_is_srgb = info.is_srgb || !info.has_gamma;
+    curve.source_exponent = curve.source_is_srgb ? 1.0f : static_cast<float>(100000.0 / info.gamma);
+    curve.active = output != TransferFunction::AsEncoded &&
+                   !info.has_icc_profile &&
+                   !(output == TransferFunction::SRGB && curve.source_is_srgb);
+    if (curve.active) {
+        curve.table = &cached_table(curve.source_is_srgb ? 0 : info.gamma, output);
+    }
+    return curve;
+}
+
+void transfer_16(const TransferCurve& curve, const uint16_t* samples, std::size_t count, unsigned char* out) {
+    kernels().transfer_16(samples, count, curve.source_is_srgb, curve.source_exponent, curve.output == TransferFunction::Linear, out);
+}
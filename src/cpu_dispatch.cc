@@ -0,0 +1,184 @@
+#include "cpu_dispatch.h"
+#include "kernels.h"
+#include "instrumentation.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static constexpr std::size_t number_of_targets = static_cast<std::size_t>(KernelTarget::Count);
+static constexpr std::size_t number_of_kernels = static_cast<std::size_t>(Kernel::Count);
+
+static const char* target_names[number_of_targets] = {"scalar", "sse4", "avx2", "avx512"};
+static const char* kernel_names[number_of_kernels] = {"crc32", "adler32", "unfilter", "palette", "swizzle", "copy_match", "reduce", "premultiply", "float", "transfer16"};
+
+const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = []() {
+        CpuFeatures f{};
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        f.ssse3 = __builtin_cpu_supports("ssse3");
+        f.sse41 = __builtin_cpu_supports("sse4.1");
+        f.pclmul = __builtin_cpu_supports("pclmul");
+        // These also check that the OS saves the wider registers.
+        f.avx2 = __builtin_cpu_supports("avx2");
+        f.avx512f = __builtin_cpu_supports("avx512f");
+        f.avx512bw = __builtin_cpu_supports("avx512bw");
+#endif
+        return f;
+    }();
+    return features;
+}
+
+bool target_supported(KernelTarget target) {
+    const CpuFeatures& f = cpu_features();
+    const bool sse4 = f.ssse3 && f.sse41 && f.pclmul;
+    switch (target) {
+        case KernelTarget::Scalar:
+            return true;
+        case KernelTarget::SSE4:
+            return sse4;
+        // Higher targets fall back on the SSE4 builds for short inputs.
+        case KernelTarget::AVX2:
+            return sse4 && f.avx2;
+        case KernelTarget::AVX512:
+            return sse4 && f.avx2 && f.avx512f && f.avx512bw;
+        default:
+            return false;
+    }
+}
+
+const char* target_name(KernelTarget target) {
+    return target_names[static_cast<std::size_t>(target)];
+}
+
+/**
+ * @brief the build of requested or, if there is none the CPU can run, of
+ * the closest target below it.
+*/
+template <typename F>
+static F pick(const F (&builds)[number_of_targets], KernelTarget requested) {
+    for (std::size_t t = static_cast<std::size_t>(requested) + 1; t-- > 0;) {
+        if (builds[t] && target_supported(static_cast<KernelTarget>(t))) {
+            return builds[t];
+        }
+    }
+    return builds[0];
+}
+
+static KernelTarget best_target() {
+    for (std::size_t t = number_of_targets; t-- > 1;) {
+        if (target_supported(static_cast<KernelTarget>(t))) {
+            return static_cast<KernelTarget>(t);
+        }
+    }
+    return KernelTarget::Scalar;
+}
+
+static bool parse_target(const std::string& name, KernelTarget& target) {
+    for (std::size_t t = 0; t < number_of_targets; t++) {
+        if (name == target_names[t]) {
+            target = static_cast<KernelTarget>(t);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief applies BITMAP_KERNELS, a comma separated list of kernel=target.
+*/
+static void read_overrides(KernelTarget (&targets)[number_of_kernels]) {
+    const char* value = std::getenv("BITMAP_KERNELS");
+    if (!value) {
+        return;
+    }
+    const std::string overrides{value};
+    std::size_t start = 0;
+    while (start <= overrides.size()) {
+        std::size_t end = overrides.find(',', start);
+        if (end == std::string::npos) {
+            end = overrides.size();
+        }
+        const std::string item = overrides.substr(start, end - start);
+        start = end + 1;
+        const std::size_t equals = item.find('=');
+        KernelTarget target;
+        if (equals == std::string::npos || !parse_target(item.substr(equals + 1), target)) {
+            BITMAP_TRACE("BITMAP_KERNELS: ignoring \"%s\"", item.c_str());
+            continue;
+        }
+        const std::string kernel = item.substr(0, equals);
+        bool known = false;
+        for (std::size_t k = 0; k < number_of_kernels; k++) {
+            if (kernel == "all" || kernel == kernel_names[k]) {
+                targets[k] = target;
+                known = true;
+            }
+        }
+        if (!known) {
+            BITMAP_TRACE("BITMAP_KERNELS: unknown kernel \"%s\"", kernel.c_str());
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BUILDS(scalar_build, sse4_build, avx2_build, avx512_build) {scalar_build, sse4_build, avx2_build, avx512_build}
+#else
+#define BUILDS(scalar_build, sse4_build, avx2_build, avx512_build) {scalar_build, nullptr, nullptr, nullptr}
+#endif
+
+static Kernels bind_kernels() {
+    namespace k = kernel_builds;
+    Kernels bound{};
+    for (auto& target : bound.targets) {
+        target = best_target();
+    }
+    read_overrides(bound.targets);
+    const auto target_of = [&](Kernel kernel) {
+        return bound.targets[static_cast<std::size_t>(kernel)];
+    };
+
+    static const Crc32Kernel crc32[] = BUILDS(k::scalar::crc32, k::sse4::crc32, nullptr, nullptr);
+    static const Adler32Kernel adler32[] = BUILDS(k::scalar::adler32, k::sse4::adler32, k::avx2::adler32, k::avx512::adler32);
+    static const UnfilterKernel sub[] = BUILDS(k::scalar::unfilter_sub, k::sse4::unfilter_sub, nullptr, nullptr);
+    static const UnfilterKernel up[] = BUILDS(k::scalar::unfilter_up, k::sse4::unfilter_up, k::avx2::unfilter_up, k::avx512::unfilter_up);
+    static const UnfilterKernel average[] = BUILDS(k::scalar::unfilter_average, k::sse4::unfilter_average, nullptr, nullptr);
+    static const UnfilterKernel paeth[] = BUILDS(k::scalar::unfilter_paeth, k::sse4::unfilter_paeth, nullptr, nullptr);
+    static const ExpandPaletteKernel palette[] = BUILDS(k::scalar::expand_palette, nullptr, k::avx2::expand_palette, k::avx512::expand_palette);
+    static const SwizzleKernel swizzle[] = BUILDS(
+        k::scalar::swizzle_rgba_to_bgra, k::sse4::swizzle_rgba_to_bgra, k::avx2::swizzle_rgba_to_bgra, k::avx512::swizzle_rgba_to_bgra
+    );
+    static const CopyMatchKernel copy_match[] = BUILDS(k::scalar::copy_match, k::sse4::copy_match, k::avx2::copy_match, k::avx512::copy_match);
+    static const ReduceRowKernel reduce_row[] = BUILDS(k::scalar::reduce_row, k::sse4::reduce_row, nullptr, nullptr);
+    static const PremultiplyKernel premultiply[] = BUILDS(
+        k::scalar::premultiply_alpha, k::sse4::premultiply_alpha, k::avx2::premultiply_alpha, nullptr
+    );
+    static const WidenToFloatKernel widen[] = BUILDS(k::scalar::widen_to_float, k::sse4::widen_to_float, k::avx2::widen_to_float, nullptr);
+    static const Transfer16Kernel transfer_16[] = BUILDS(k::scalar::transfer_16, k::sse4::transfer_16, k::avx2::transfer_16, nullptr);
+
+    bound.crc32 = pick(crc32, target_of(Kernel::Crc32));
+    bound.adler32 = pick(adler32, target_of(Kernel::Adler32));
+    bound.unfilter_sub = pick(sub, target_of(Kernel::Unfilter));
+    bound.unfilter_up = pick(up, target_of(Kernel::Unfilter));
+    bound.unfilter_average = pick(average, target_of(Kernel::Unfilter));
+    bound.unfilter_paeth = pick(paeth, target_of(Kernel::Unfilter));
+    bound.expand_palette = pick(palette, target_of(Kernel::ExpandPalette));
+    bound.swizzle_rgba_to_bgra = pick(swizzle, target_of(Kernel::Swizzle));
+    bound.copy_match = pick(copy_match, target_of(Kernel::CopyMatch));
+    bound.reduce_row = pick(reduce_row, target_of(Kernel::ReduceRow));
+    bound.premultiply_alpha = pick(premultiply, target_of(Kernel::Premultiply));
+    bound.widen_to_float = pick(widen, target_of(Kernel::WidenToFloat));
+    bound.transfer_16 = pick(transfer_16, target_of(Kernel::Transfer16));
+    for (std::size_t kernel = 0; kernel < number_of_kernels; kernel++) {
+        BITMAP_TRACE("kernel %s: %s", kernel_names[kernel], target_name(bound.targets[kernel]));
+    }
+    return bound;
+}
+
+#undef BUILDS
+
+const Kernels& kernels() {
+    static const Kernels bound = bind_kernels();
+    return bound;
+}
@@ -0,0 +1,205 @@
+#include "decode.h"
+#include "row_pipeline.h"
+#include "pixel_conversion.h"
+#include "cpu_dispatch.h"
+
+std::optional<DecodedImage> decode(const Png& png, const PixelFormat& format, DecoderContext* context) {
+    const IHDR& header = png.get_header();
+    return decode_region(png, 0, 0, header.width, header.height, format, context);
+}
+
+bool is_decodable(const Png& png) {
+    if (!png.is_parsed()) {
+        return false;
+    }
+    const IHDR& header = png.get_header();
+    return is_supported_header(header) && !(header.color_type == 3 && !png.find_chunk("PLTE"));
+}
+
+/**
+ * @brief stores the w by h window whose top left pixel is (x, y) into data.
+ * The window has to lie inside the image and must not be empty.
+*/
+static PipelineStatus store_region(
+    const Png& png,
+    uint32_t x,
+    uint32_t y,
+    uint32_t w,
+    uint32_t h,
+    const PixelFormat& format,
+    unsigned char* data,
+    const StoreProgress& progress,
+    DecoderContext* context
+) {
+    const IHDR& header = png.get_header();
+    const ColorTables tables = color_tables(png, format.transfer);
+    std::pmr::memory_resource* resource = scratch_resource(context);
+    std::pmr::vector<Color> row_pixels(w, resource);
+    const int final_pass = last_pass(header);
+    return run_row_pipeline(header, IDAT_source(png), [&](int pass, uint32_t row_in_pass, const unsigned char* row) {
+        const Adam7Pass& p = adam7_passes[pass];
+        const uint32_t image_y = p.y_start + row_in_pass * p.y_step;
+        if (image_y >= y && image_y - y < h) {
+            // Pixels of this pass that land in columns x .. x + w - 1
+            const uint32_t width = pass_width(header, pass);
+            const uint32_t first = x > p.x_start ? (x - p.x_start + p.x_step - 1) / p.x_step : 0;
+            const uint32_t end = std::min(width, x + w > p.x_start ? (x + w - p.x_start + p.x_step - 1) / p.x_step : 0);
+            if (first < end) {
+                const std::size_t out_x = p.x_start + first * p.x_step - x;
+                convert_pixels(row, header, tables, first, end - first, row_pixels.data());
+                store_pixels(row_pixels.data(), end - first, format, data, w, h, out_x, image_y - y, p.x_step);
+            }
+            if (progress) {
+                progress(image_y - y + 1);
+            }
+        }
+        // Stop once no later row of the final pass can fall inside the
+        // window. A window that reaches the bottom runs to the end of the
+        // stream, which checks its Adler-32.
+        return !(pass == final_pass && image_y + p.y_step >= y + h && y + h < header.height);
+    }, resource);
+}
+
+std::optional<DecodedImage> decode_region(
+    const Png& png,
+    uint32_t x,
+    uint32_t y,
+    uint32_t w,
+    uint32_t h,
+    const PixelFormat& format,
+    DecoderContext* context
+) {
+    if (!is_decodable(png)) {
+        return std::nullopt;
+    }
+    const IHDR& header = png.get_header();
+    if (x >= header.width || y >= header.height) {
+        w = h = 0;
+    }
+    w = std::min(w, header.width - std::min(x, header.width));
+    h = std::min(h, header.height - std::min(y, header.height));
+    DecodedImage image{w, h, format, std::vector<unsigned char>(bytes_per_image(format, w, h))};
+    if (w == 0 || h == 0) {
+        return image;
+    }
+    if (is_error(store_region(png, x, y, w, h, format, image.data.data(), {}, context))) {
+        return std::nullopt;
+    }
+    return image;
+}
+
+bool decode_into(
+    const Png& png,
+    unsigned char* data,
+    const PixelFormat& format,
+    const StoreProgress& progress,
+    DecoderContext* context
+) {
+    if (!is_decodable(png)) {
+        return false;
+    }
+    const IHDR& header = png.get_header();
+    return !is_error(store_region(png, 0, 0, header.width, header.height, format, data, progress, context));
+}
+
+std::optional<DecodedImage> decode_thumbnail(
+    const Png& png,
+    ThumbnailScale scale,
+    bool adam7_coarse_passes,
+    const PixelFormat& format,
+    DecoderContext* context
+) {
+    if (!is_decodable(png)) {
+        return std::nullopt;
+    }
+    const IHDR& header = png.get_header();
+    const int shift = static_cast<int>(scale);
+    const uint32_t block = 1u << shift;
+    const uint32_t width = (header.width + block - 1) >> shift;
+    const uint32_t height = (header.height + block - 1) >> shift;
+    DecodedImage image{width, height, format, std::vector<unsigned char>(bytes_per_image(format, width, height))};
+    const ColorTables tables = color_tables(png, format.transfer);
+
+    // Passes 1, 3 and 5 complete the 8x8, 4x4 and 2x2 grids of Adam7.
+    const bool coarse = adam7_coarse_passes && header.interlace_method;
+    int stop_pass = 7 - 2 * shift;
+    if (coarse) {
+        while (pass_width(header, stop_pass) == 0 || pass_height(header, stop_pass) == 0) {
+            stop_pass--;
+        }
+    }
+
+    // Sums per thumbnail pixel of the kernels().reduce_row kind. Rows of
+    // blocks of a non interlaced image are finished one after the other, so
+    // one row of sums does. The Adam7 passes come back to every row, an
+    // interlaced image that is not cut short at the coarse passes keeps
+    // sums for the whole thumbnail, see decode.h for what that costs.
+    const bool interlaced = header.interlace_method;
+    const std::size_t rows_of_sums = coarse ? 0 : interlaced ? height : 1;
+    std::pmr::memory_resource* resource = scratch_resource(context);
+    std::pmr::vector<uint32_t> sums(rows_of_sums * width * 4, resource);
+    std::pmr::vector<Color> row_pixels(header.width, resource);
+    const ReduceRowKernel reduce_row = kernels().reduce_row;
+
+    // Colour is averaged weighted by alpha, so transparent pixels do not
+    // bleed their colour into the opaque ones around them.
+    const auto store_row = [&](uint32_t y, const uint32_t* row_sums) {
+        const uint32_t rows = std::min(block, header.height - y * block);
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t n = rows * std::min(block, header.width - x * block);
+            const uint32_t* s = row_sums + static_cast<std::size_t>(x) * 4;
+            const uint32_t alpha = s[3];
+            row_pixels[x] = alpha == 0 ? Color{0, 0, 0, 0} : Color{
+                static_cast<unsigned char>((s[0] + alpha / 2) / alpha),
+                static_cast<unsigned char>((s[1] + alpha / 2) / alpha),
+                static_cast<unsigned char>((s[2] + alpha / 2) / alpha),
+                static_cast<unsigned char>((alpha + n / 2) / n)
+            };
+        }
+        store_pixels(row_pixels.data(), width, format, image.data.data(), width, height, 0, y, 1);
+    };
+
+    const PipelineStatus status = run_row_pipeline(header, IDAT_source(png), [&](int pass, uint32_t row_in_pass, const unsigned char* row) {
+        const Adam7Pass& p = adam7_passes[pass];
+        const uint32_t image_y = p.y_start + row_in_pass * p.y_step;
+        const uint32_t count = pass_width(header, pass);
+        convert_pixels(row, header, tables, 0, count, row_pixels.data());
+        if (coarse) {
+            // Every pass up to stop_pass lies on the block grid, its pixels
+            // map one to one onto thumbnail pixels.
+            store_pixels(row_pixels.data(), count, format, image.data.data(), width, height, p.x_start >> shift, image_y >> shift, p.x_step >> shift);
+            return !(pass == stop_pass && row_in_pass + 1 == pass_height(header, pass));
+        }
+        if (!interlaced) {
+            reduce_row(row_pixels.data(), count, shift, sums.data());
+            if ((image_y + 1) % block == 0 || image_y + 1 == header.height) {
+                store_row(image_y >> shift, sums.data());
+                std::fill(sums.begin(), sums.end(), 0);
+            }
+            return true;
+        }
+        uint32_t* out = &sums[static_cast<std::size_t>(image_y >> shift) * width * 4];
+        if (p.x_step == 1) {
+            reduce_row(row_pixels.data(), count, shift, out);
+            return true;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const Color& c = row_pixels[i];
+            uint32_t* s = out + ((p.x_start + i * p.x_step) >> shift) * 4;
+            s[0] += c.r * c.a;
+            s[1] += c.g * c.a;
+            s[2] += c.b * c.a;
+            s[3] += c.a;
+        }
+        return true;
+    }, resource);
+    if (is_error(status)) {
+        return std::nullopt;
+    }
+    if (interlaced && !coarse) {
+        for (uint32_t y = 0; y < height; y++) {
+            store_row(y, &sums[static_cast<std::size_t>(y) * width * 4]);
+        }
+    }
+    return image;
+}
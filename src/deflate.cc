@@ -1,6 +1,10 @@
 // Most algorithms here are heavily inspired if not outright copied from puff.c
 
 #include "deflate.h"
+#include "instrumentation.h"
+#include "cpu_dispatch.h"
+
+#include <cstring>
 
 constexpr int MaxBitsInACode = 15;
 // LL indicates literal bytes and length codes (which share the same huffman tree)
@@ -12,101 +16,177 @@ constexpr int FixedCodesForLL = 288;
 
 namespace deflate {
 
-HuffmanTree calculate_huffman_tree(const std::vector<int>& bit_lengths, int n) {
+bool is_error(Status status) {
+    return status != Status::Done && status != Status::Stopped;
+}
+
+const char* status_name(Status status) {
+    switch (status) {
+        case Status::Done: return "done";
+        case Status::Stopped: return "stopped";
+        case Status::InputEnded: return "input ended";
+        case Status::BadBlockType: return "bad block type";
+        case Status::BadStoredLength: return "bad stored length";
+        case Status::BadCodeLengths: return "bad code lengths";
+        case Status::BadSymbol: return "bad symbol";
+        case Status::DistanceTooFar: return "distance too far";
+        case Status::BadZlibHeader: return "bad zlib header";
+        case Status::BadGzipHeader: return "bad gzip header";
+        case Status::BadChecksum: return "bad checksum";
+    }
+    return "unknown";
+}
+
+HuffmanTree calculate_huffman_tree(const int* bit_lengths, int n, std::pmr::memory_resource* resource) {
     // Index into vector signifies the bit length
-    std::vector<int> codes_per_bit_length{};
+    std::pmr::vector<int> codes_per_bit_length{resource};
     // +1 because zero is included even though its not possible
     //     This is in an effort to make the code more readable
     codes_per_bit_length.resize(MaxBitsInACode + 1);
     for (auto& e : codes_per_bit_length) {
         e = 0;
     }
-    for (unsigned int i = 0; i < n; i++){
+    for (int i = 0; i < n; i++){
         ++codes_per_bit_length[bit_lengths[i]];
     }
-    // print the bit_length_counts
-    std::cout << "calculate_huffman_tree\ncodes_per_bit_length: ";
-    for (const auto& e : codes_per_bit_length){
-        std::cout << e << " ";
-    }
-    std::cout << "\n";
-
     // sanity check: make sure that number of symbols makes sense for
     // how many bits we have available
 
     // a bit length of zero can only signify one code
     int number_of_codes_left = 1;
-    for (int current_bit_length = 1; current_bit_length < MaxBitsInACode; current_bit_length++){
+    for (int current_bit_length = 1; current_bit_length <= MaxBitsInACode; current_bit_length++){
         number_of_codes_left <<= 1; // adding a bit allows for the code to specify 2 times as many codes
         number_of_codes_left -= codes_per_bit_length[current_bit_length]; // remove number of codes at that bit length
         if (number_of_codes_left < 0){
-            std::cout << "Error: ran out of possible codes with our limited amount of bits. indicates calculating huffman tree is impossible\n";
-            std::exit(EXIT_FAILURE);
+            // ran out of possible codes with our limited amount of bits,
+            // no huffman tree has these lengths
+            return HuffmanTree{std::pmr::vector<int>{resource}, std::pmr::vector<int>{resource}};
         }
     }
 
-    std::vector<int> offsets_into_symbol_array_for_each_length{};
-    offsets_into_symbol_array_for_each_length.resize(MaxBitsInACode + 1);
+    std::array<int, MaxBitsInACode + 1> offsets_into_symbol_array_for_each_length{};
     offsets_into_symbol_array_for_each_length[1] = 0;
     for (int current_bit_length = 1; current_bit_length < MaxBitsInACode; current_bit_length++) {
         offsets_into_symbol_array_for_each_length[current_bit_length + 1] = 
             offsets_into_symbol_array_for_each_length[current_bit_length] + codes_per_bit_length[current_bit_length];
     }
-    // print the offsets_into_symbol_array_for_each_length
-    std::cout << "offsets_into_symbol_array_for_each_length: ";
-    for (const auto& e : offsets_into_symbol_array_for_each_length){
-        std::cout << e << " ";
-    }
-    std::cout << "\n";
 
-
-    std::vector<int> symbols{};
-    symbols.resize(bit_lengths.size());
+    std::pmr::vector<int> symbols{resource};
+    symbols.resize(n);
 
     for (int symbol = 0; symbol < n; symbol++) {
         if (bit_lengths[symbol] != 0) {
             symbols[offsets_into_symbol_array_for_each_length[bit_lengths[symbol]]++] = symbol;
         }
-    }   
-    // print the symbols
-
-    std::cout << "symbols for computed tree: ";
-    for (const auto& e : symbols){
-        std::cout << e << " ";
     }
-    std::cout << "\n";
     return HuffmanTree{std::move(codes_per_bit_length), std::move(symbols)};
 }
 
-static bool get_next_bit(const std::vector<unsigned char>& encoded_bytes) {
-    static int bit_position = 0;
-    assert(bit_position >= 0);
-    assert(bit_position <= 8*encoded_bytes.size());
-    const std::bitset<8> bits {encoded_bytes.at(bit_position/8)};
-    return bits[bit_position++%8];
+// Decoded bytes are kept in a ring twice the size of the largest distance a
+// match can reach back, so a full distance worth of history survives while
+// up to another 32 KiB waits to be flushed to the sink.
+constexpr std::size_t MaxDistance = 32768;
+constexpr std::size_t WindowSize = 2 * MaxDistance;
+constexpr std::size_t WindowMask = WindowSize - 1;
+// Output is handed to the sink whenever this much has piled up. Small enough
+// that a sink which stops early does not wait on much wasted work.
+constexpr std::size_t FlushThreshold = 4096;
+
+struct State {
+    std::pmr::memory_resource* resource;
+    const ByteSource& source;
+    const ByteSink& sink;
+    const unsigned char* input;
+    std::size_t input_left;
+    // Bits not yet consumed, lowest bit first as RFC 1951 packs them.
+    uint32_t bit_buffer;
+    int bit_count;
+    std::pmr::vector<unsigned char> window;
+    std::size_t total_out;
+    std::size_t total_flushed;
+    // Output of earlier gzip members, which matches may not reach into
+    std::size_t member_start;
+    bool stopped;
+    CopyMatchKernel copy_match;
+    // Running Adler-32 (zlib) or CRC-32 (gzip) of the output, none for raw
+    // streams. Both kernels share a signature.
+    Adler32Kernel checksum_kernel;
+    uint32_t checksum;
+    // Published to the calling thread when inflate returns
+    instrumentation::Counters counters;
+};
+
+/**
+ * Thrown where a stream turns out to be corrupt and caught where inflate
+ * returns, the way puff.c longjmps out of its bit reader. Valid streams
+ * never pay for it.
+*/
+struct CorruptStream {
+    Status status;
+};
+
+static unsigned char get_next_byte(State& s) {
+    while (s.input_left == 0) {
+        if (!s.source(s.input, s.input_left)) {
+            throw CorruptStream{Status::InputEnded};
+        }
+    }
+    s.input_left--;
+    s.counters.bits_consumed += 8;
+    return *s.input++;
+}
+
+static bool get_next_bit(State& s) {
+    if (s.bit_count == 0) {
+        s.bit_buffer = get_next_byte(s);
+        s.bit_count = 8;
+    }
+    const bool bit = s.bit_buffer & 1;
+    s.bit_buffer >>= 1;
+    s.bit_count--;
+    return bit;
 }
 
-static int get_next_n_bits(const std::vector<unsigned char>& encoded_bytes, int n) {
-    int result = 0;
+static int get_next_n_bits(State& s, int n) {
     assert(n <= MaxBitsInACode);
-    for (int i = 0; i < n; i++){
-        result |= get_next_bit(encoded_bytes) << i;
+    uint32_t result = s.bit_buffer;
+    while (s.bit_count < n) {
+        result |= static_cast<uint32_t>(get_next_byte(s)) << s.bit_count;
+        s.bit_count += 8;
+    }
+    s.bit_buffer = result >> n;
+    s.bit_count -= n;
+    return static_cast<int>(result & ((1u << n) - 1));
+}
+
+static void flush(State& s) {
+    while (s.total_flushed < s.total_out && !s.stopped) {
+        const std::size_t start = s.total_flushed & WindowMask;
+        const std::size_t n = std::min(s.total_out - s.total_flushed, WindowSize - start);
+        if (s.checksum_kernel) {
+            s.checksum = s.checksum_kernel(s.checksum, s.window.data() + start, n);
+        }
+        if (!s.sink(s.window.data() + start, n)) {
+            s.stopped = true;
+        }
+        s.total_flushed += n;
     }
-    return result;
 }
 
-int decode_symbol(const std::vector<unsigned char>& encoded_bytes, const HuffmanTree& tree) {
+static void put_byte(State& s, unsigned char byte) {
+    s.window[s.total_out++ & WindowMask] = byte;
+}
+
+static int decode_symbol(State& s, const HuffmanTree& tree) {
     int code{};
     int number_of_codes_for_current_bit_length{};
     // Index into tree.symbols for the first symbol at current bit length
     int index{};
     int first{};
-    for (int number_of_bits_in_code = 1; number_of_bits_in_code < MaxBitsInACode; number_of_bits_in_code++){
-        code |= get_next_bit(encoded_bytes);
+    for (int number_of_bits_in_code = 1; number_of_bits_in_code <= MaxBitsInACode; number_of_bits_in_code++){
+        code |= get_next_bit(s);
         number_of_codes_for_current_bit_length = tree.count[number_of_bits_in_code];
-        // printf("code: %d  count: %d  first: %d index: %d\n", code, number_of_codes_for_current_bit_length, first, index);
         if (code - number_of_codes_for_current_bit_length < first) {
-            // printf("symbol: %d\n", tree.symbol[index + (code - first)]);
             return tree.symbol[index + (code - first)];
         }
         index += number_of_codes_for_current_bit_length;
@@ -114,15 +194,14 @@ int decode_symbol(const std::vector<unsigned char>& encoded_bytes, const Huffman
         first <<= 1;
         code <<= 1;
     }
-    std::cout << "not enough bits in maximum bit length to decode the current code\n";
-    std::exit(EXIT_FAILURE);
+    // not enough bits in maximum bit length to decode the current code
+    throw CorruptStream{Status::BadSymbol};
 }
 
-void decode_symbols(
-    const std::vector<unsigned char>& encoded_bytes, 
+static void decode_symbols(
+    State& s,
     const HuffmanTree& ll_tree, 
-    const HuffmanTree& d_tree, 
-    std::size_t size_of_decoded_bytes
+    const HuffmanTree& d_tree
 ) {
     // direct from puff.c
     static const short lens[29] = { /* Size base for length codes 257..285 */
@@ -140,55 +219,83 @@ void decode_symbols(
         7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
         12, 12, 13, 13};
 
-    std::cout << "decode_symbols() called\nll_tree:\n";
-    // std::cout << ll_tree << "\n";
-    std::vector<unsigned char> decoded_bytes{};
-    // std::cout << "decoding:\n";
-    while (decoded_bytes.size() < size_of_decoded_bytes){
-        int decoded_byte = decode_symbol(encoded_bytes, ll_tree);
-        // std::cout << (int) decoded_byte << "\n";
+    while (true) {
+        int decoded_byte = decode_symbol(s, ll_tree);
+        s.counters.symbols_decoded++;
         if (decoded_byte < 256){
-            decoded_bytes.push_back((unsigned char) decoded_byte);
+            s.counters.literals++;
+            put_byte(s, static_cast<unsigned char>(decoded_byte));
         }
         else if (decoded_byte > 256){
             decoded_byte -= 257;
             if (decoded_byte >= 29) {
-                std::cout << "not a valid length\n";
-                std::exit(EXIT_FAILURE);
+                throw CorruptStream{Status::BadSymbol};
             }
-            int len = lens[decoded_byte] + get_next_n_bits(encoded_bytes, lext[decoded_byte]);
-            // std::cout << "len: " << len << "\n";
-
-            decoded_byte = decode_symbol(encoded_bytes, d_tree);
-            // std::cout << "decoded_byte (d_tree): " << decoded_byte << "\n";
+            s.counters.length_histogram[decoded_byte]++;
+            int len = lens[decoded_byte] + get_next_n_bits(s, lext[decoded_byte]);
 
-            int distance = dists[decoded_byte] + get_next_n_bits(encoded_bytes, dext[decoded_byte]);
-            // std::cout << "distance: " << distance << "\n";
-            while (len--) {
-                // std::cout << (int) decoded_bytes[decoded_bytes.size() - distance] << " ";
-                decoded_bytes.push_back(decoded_bytes[decoded_bytes.size() - distance]);
+            decoded_byte = decode_symbol(s, d_tree);
+            if (decoded_byte >= 30) {
+                throw CorruptStream{Status::BadSymbol};
+            }
+            s.counters.distance_histogram[decoded_byte]++;
+            s.counters.matches++;
+            const std::size_t distance = dists[decoded_byte] + get_next_n_bits(s, dext[decoded_byte]);
+            if (distance > s.total_out - s.member_start) {
+                throw CorruptStream{Status::DistanceTooFar};
+            }
+            const std::size_t start = s.total_out & WindowMask;
+            // The kernel needs the match and its source in one piece, with
+            // room for what it writes past the end. Those extra bytes land on
+            // output that is more than 32 KiB old and already flushed.
+            if (distance <= start && start + len + CopyMatchSlack <= WindowSize) {
+                s.copy_match(s.window.data() + start, distance, len);
+                s.total_out += len;
+            }
+            else {
+                while (len--) {
+                    put_byte(s, s.window[(s.total_out - distance) & WindowMask]);
+                }
             }
-            // std::cout << "\ndecoded bytes vector size: " << decoded_bytes.size() << "\n";
         }
         else {
-            std::cout << "not a direct byte lol\n";
-            std::exit(EXIT_FAILURE);
+            // end of block
+            return;
+        }
+        if (s.total_out - s.total_flushed >= FlushThreshold) {
+            flush(s);
+            if (s.stopped) {
+                return;
+            }
         }
     }
-    
-    for (int i = 0; i < decoded_bytes.size(); i += 4){
-        std::cout << (int) decoded_bytes[i + 0] << " ";
-        std::cout << (int) decoded_bytes[i + 1] << " ";
-        std::cout << (int) decoded_bytes[i + 2] << " ";
-        std::cout << (int) decoded_bytes[i + 3] << "\n";
+}
+
+static void decode_stored(State& s) {
+    // Stored blocks start on a byte boundary, drop the rest of the current byte.
+    s.bit_buffer = 0;
+    s.bit_count = 0;
+    const int len = get_next_byte(s) | (get_next_byte(s) << 8);
+    const int nlen = get_next_byte(s) | (get_next_byte(s) << 8);
+    if (len != (~nlen & 0xffff)) {
+        throw CorruptStream{Status::BadStoredLength};
+    }
+    s.counters.stored_bytes += len;
+    for (int i = 0; i < len; i++) {
+        put_byte(s, get_next_byte(s));
+        if (s.total_out - s.total_flushed >= FlushThreshold) {
+            flush(s);
+            if (s.stopped) {
+                return;
+            }
+        }
     }
 }
 
-void decode_fixed(const std::vector<unsigned char>& encoded_bytes, std::size_t size_of_decoded_bytes) {
-    static bool first_call = true;
-    static HuffmanTree fixed_tree{};
-    if (first_call) {
-        std::vector<int> lengths{};
+static HuffmanTree fixed_tree(int number_of_codes) {
+    // Kept for the life of the process, so never from a per decode resource
+    std::vector<int> lengths{};
+    if (number_of_codes == FixedCodesForLL) {
         int symbol{};
         for (symbol = 0; symbol < 144; symbol++) {
             lengths.push_back(8);
@@ -202,35 +309,37 @@ void decode_fixed(const std::vector<unsigned char>& encoded_bytes, std::size_t s
         for (; symbol < FixedCodesForLL; symbol++) {
             lengths.push_back(8);
         }
-        fixed_tree = calculate_huffman_tree(lengths, FixedCodesForLL);
-        first_call = false;
     }
-    // TODO: fix this for d_tree
-    decode_symbols(encoded_bytes, fixed_tree, fixed_tree, size_of_decoded_bytes);
+    else {
+        lengths.assign(MaxCodesForDist, 5);
+    }
+    return calculate_huffman_tree(lengths.data(), number_of_codes);
+}
+
+static void decode_fixed(State& s) {
+    static const HuffmanTree fixed_ll_tree = fixed_tree(FixedCodesForLL);
+    static const HuffmanTree fixed_distance_tree = fixed_tree(MaxCodesForDist);
+    decode_symbols(s, fixed_ll_tree, fixed_distance_tree);
 }
 
-void decode_dynamic(const std::vector<unsigned char>& encoded_bytes, std::size_t size_of_decoded_bytes) {
+static void decode_dynamic(State& s) {
     // RFC 1951
-    int number_of_ll_codes = get_next_n_bits(encoded_bytes, 5) + 257;
-    std::cout << "number_of_LL_codes: " << number_of_ll_codes << "\n";
-    int number_of_distance_codes = get_next_n_bits(encoded_bytes, 5) + 1;
-    std::cout << "number_of_distance_codes: " << number_of_distance_codes << "\n";
-    int number_of_code_length_codes = get_next_n_bits(encoded_bytes, 4) + 4;
-    std::cout << "number_of_code_length_codes: " << number_of_code_length_codes << "\n";
-    if (number_of_ll_codes > MaxCodesForLL) {
-        std::cout << "Error: the dynamic huffman tree specified has too many literal/length codes\n";
-        std::exit(EXIT_FAILURE);
-    }
-    if (number_of_distance_codes > MaxCodesForDist) {
-        std::cout << "Error: the dynamic huffman tree specified has too many distance codes\n";
-        std::exit(EXIT_FAILURE);
-    }
-    const std::vector<int> order {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-    std::vector<int> lengths {};
-    lengths.resize(order.size());
-    for (int i = 0; i < order.size(); i++){
-        if (i < number_of_code_length_codes) {
-            const int current_length = get_next_n_bits(encoded_bytes, 3);
+    int number_of_ll_codes = get_next_n_bits(s, 5) + 257;
+    int number_of_distance_codes = get_next_n_bits(s, 5) + 1;
+    int number_of_code_length_codes = get_next_n_bits(s, 4) + 4;
+    BITMAP_TRACE(
+        "dynamic block: %d literal/length codes, %d distance codes, %d code length codes",
+        number_of_ll_codes, number_of_distance_codes, number_of_code_length_codes
+    );
+    if (number_of_ll_codes > MaxCodesForLL || number_of_distance_codes > MaxCodesForDist) {
+        BITMAP_TRACE("dynamic block: too many literal/length or distance codes");
+        throw CorruptStream{Status::BadCodeLengths};
+    }
+    static constexpr std::array<int, 19> order {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    std::array<int, MaxCodesTotal> lengths {};
+    for (std::size_t i = 0; i < order.size(); i++){
+        if (static_cast<int>(i) < number_of_code_length_codes) {
+            const int current_length = get_next_n_bits(s, 3);
             lengths[order[i]] = current_length;
         }
         else {
@@ -238,13 +347,15 @@ void decode_dynamic(const std::vector<unsigned char>& encoded_bytes, std::size_t
         }
     }
 
-    HuffmanTree treetree = calculate_huffman_tree(lengths, 19);
+    HuffmanTree treetree = calculate_huffman_tree(lengths.data(), 19, s.resource);
+    if (treetree.count.empty()) {
+        throw CorruptStream{Status::BadCodeLengths};
+    }
 
-    lengths.clear();
-    lengths.resize(MaxCodesTotal);
+    lengths.fill(0);
     int index {0};
     while (index < number_of_ll_codes + number_of_distance_codes) {
-        int symbol = decode_symbol(encoded_bytes, treetree);
+        int symbol = decode_symbol(s, treetree);
         if (symbol < 16) {
             lengths[index++] = symbol;
         }
@@ -252,21 +363,21 @@ void decode_dynamic(const std::vector<unsigned char>& encoded_bytes, std::size_t
             int len{0};
             if (symbol == 16) {
                 if (index == 0) {
-                    std::cout << "Error: no tree specified\n";
-                    std:exit(EXIT_FAILURE);
+                    // nothing to repeat
+                    throw CorruptStream{Status::BadCodeLengths};
                 }
                 len = lengths[index - 1];
-                symbol = 3 + get_next_n_bits(encoded_bytes, 2);
+                symbol = 3 + get_next_n_bits(s, 2);
             }
             else if (symbol == 17){
-                symbol = 3 + get_next_n_bits(encoded_bytes, 3);
+                symbol = 3 + get_next_n_bits(s, 3);
             }
             else {
-                symbol = 11 + get_next_n_bits(encoded_bytes, 7);
+                symbol = 11 + get_next_n_bits(s, 7);
             }
             if (index + symbol > number_of_ll_codes + number_of_distance_codes) {
-                std::cout << "Error: to many lengths specified in the tree\n";
-                std::exit(EXIT_FAILURE);
+                // to many lengths specified in the tree
+                throw CorruptStream{Status::BadCodeLengths};
             }
             while (symbol--) {
                 lengths[index++] = len;
@@ -276,16 +387,16 @@ void decode_dynamic(const std::vector<unsigned char>& encoded_bytes, std::size_t
 
     /* check for end-of-block code -- there better be one! */
     if (lengths[256] == 0) {
-        std::cout << "Error: no end-of-block code\n";
-        std::exit(EXIT_FAILURE);
+        throw CorruptStream{Status::BadCodeLengths};
     }
 
-    HuffmanTree ll_tree = calculate_huffman_tree(lengths, number_of_ll_codes);
-    std::cout << ll_tree << "\n";
-    HuffmanTree distance_tree = calculate_huffman_tree(std::vector<int>(lengths.begin() + number_of_ll_codes, lengths.end()), number_of_distance_codes);
-    std::cout << distance_tree << "\n";
+    HuffmanTree ll_tree = calculate_huffman_tree(lengths.data(), number_of_ll_codes, s.resource);
+    HuffmanTree distance_tree = calculate_huffman_tree(lengths.data() + number_of_ll_codes, number_of_distance_codes, s.resource);
+    if (ll_tree.count.empty() || distance_tree.count.empty()) {
+        throw CorruptStream{Status::BadCodeLengths};
+    }
 
-    decode_symbols(encoded_bytes, ll_tree, distance_tree, size_of_decoded_bytes);
+    decode_symbols(s, ll_tree, distance_tree);
 }
 
 enum BTypeCompression {
@@ -295,31 +406,349 @@ enum BTypeCompression {
     Reserved
 };
 
-void inflate(const std::vector<unsigned char>& encoded_bytes, std::size_t size_of_decoded_bytes){
-    bool is_final_block = get_next_bit(encoded_bytes);
-    int compression_type = get_next_n_bits(encoded_bytes, 2);
+static void decode_blocks(State& s) {
+    bool is_final_block = false;
+    while (!is_final_block && !s.stopped) {
+        is_final_block = get_next_bit(s);
+        int compression_type = get_next_n_bits(s, 2);
+
+        if (compression_type == NoCompression){
+            s.counters.blocks[static_cast<std::size_t>(instrumentation::BlockType::Stored)]++;
+            decode_stored(s);
+        }
+        else if (compression_type == FixedHuffmanCodes){
+            s.counters.blocks[static_cast<std::size_t>(instrumentation::BlockType::Fixed)]++;
+            decode_fixed(s);
+        }
+        else if (compression_type == DynamicHuffmanCodes){
+            s.counters.blocks[static_cast<std::size_t>(instrumentation::BlockType::Dynamic)]++;
+            decode_dynamic(s);
+        }
+        else if (compression_type == Reserved){
+            throw CorruptStream{Status::BadBlockType};
+        }
+    }
+    flush(s);
+}
+
+/**
+ * @brief runs decode on s and turns a corrupt stream into its status.
+ * Counters are published either way.
+*/
+template <typename Decode>
+static Status run(State& s, Decode&& decode) {
+    Status status;
+    try {
+        decode(s);
+        status = s.stopped ? Status::Stopped : Status::Done;
+    }
+    catch (const CorruptStream& e) {
+        BITMAP_TRACE("inflate: %s after %zu bytes of output", status_name(e.status), s.total_out);
+        status = e.status;
+        // Everything before the damage is still good output.
+        flush(s);
+    }
+    // Whatever is left in the bit buffer was fetched but never used.
+    s.counters.bits_consumed -= s.bit_count;
+    s.counters.bytes_out += s.total_out;
+    instrumentation::publish(s.counters);
+    return status;
+}
+
+/**
+ * @brief drops the bits left in the current byte, trailers start on a byte
+ * boundary.
+*/
+static void skip_to_byte_boundary(State& s) {
+    s.counters.bits_consumed -= s.bit_count;
+    s.bit_buffer = 0;
+    s.bit_count = 0;
+}
+
+static uint32_t get_big_endian_uint32(State& s) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = value << 8 | get_next_byte(s);
+    }
+    return value;
+}
+
+static uint32_t get_little_endian_uint32(State& s) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= static_cast<uint32_t>(get_next_byte(s)) << 8 * i;
+    }
+    return value;
+}
+
+static bool is_zlib_header(unsigned char cmf, unsigned char flg) {
+    // Deflate with a window of at most 32 KiB, CMF*256 + FLG a multiple of
+    // 31 and no preset dictionary, which png does not allow.
+    return (cmf & 0x0f) == 8 && cmf >> 4 <= 7 && (cmf * 256 + flg) % 31 == 0 && !(flg & 0b00100000);
+}
+
+static void decode_zlib(State& s) {
+    const unsigned char cmf = get_next_byte(s);
+    const unsigned char flg = get_next_byte(s);
+    if (!is_zlib_header(cmf, flg)) {
+        throw CorruptStream{Status::BadZlibHeader};
+    }
+    decode_blocks(s);
+    if (s.stopped) {
+        return;
+    }
+    skip_to_byte_boundary(s);
+    if (get_big_endian_uint32(s) != s.checksum) {
+        throw CorruptStream{Status::BadChecksum};
+    }
+}
+
+enum GzipFlags {
+    GzipText = 1,
+    GzipHeaderCrc = 2,
+    GzipExtra = 4,
+    GzipName = 8,
+    GzipComment = 16,
+    GzipReserved = 0xe0,
+};
+
+/**
+ * @brief reads the header of a gzip member after its two magic bytes,
+ * RFC 1952 2.3. Everything in it but the method and flags is skipped.
+*/
+static void read_gzip_header(State& s) {
+    const Crc32Kernel crc32 = kernels().crc32;
+    static const unsigned char magic[] = {0x1f, 0x8b};
+    uint32_t crc = crc32(0, magic, sizeof(magic));
+    const auto next = [&]() {
+        const unsigned char byte = get_next_byte(s);
+        crc = crc32(crc, &byte, 1);
+        return byte;
+    };
+    const unsigned char method = next();
+    const unsigned char flags = next();
+    if (method != 8 || flags & GzipReserved) {
+        throw CorruptStream{Status::BadGzipHeader};
+    }
+    // MTIME, XFL and OS
+    for (int i = 0; i < 6; i++) {
+        next();
+    }
+    if (flags & GzipExtra) {
+        int length = next();
+        length |= next() << 8;
+        while (length-- > 0) {
+            next();
+        }
+    }
+    if (flags & GzipName) {
+        while (next() != 0) {}
+    }
+    if (flags & GzipComment) {
+        while (next() != 0) {}
+    }
+    if (flags & GzipHeaderCrc) {
+        // The low 16 bits of the CRC-32 of the header so far
+        const uint32_t expected = crc & 0xffff;
+        uint32_t stored = get_next_byte(s);
+        stored |= static_cast<uint32_t>(get_next_byte(s)) << 8;
+        if (stored != expected) {
+            throw CorruptStream{Status::BadGzipHeader};
+        }
+    }
+}
 
-    if (is_final_block) {
-        std::cout << "this is the final block\n";
+/**
+ * @brief true if the source has bytes left, without consuming any.
+*/
+static bool has_more_input(State& s) {
+    while (s.input_left == 0) {
+        if (!s.source(s.input, s.input_left)) {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (compression_type == NoCompression){
-        std::cout << "compression_type: no compression\n";
-        std::cout << "this is unsupported for now\n";
-        std::exit(EXIT_FAILURE);
+/**
+ * @brief consumes the next byte if it is byte.
+ * @return false, with nothing consumed, if it is not or the input has ended.
+*/
+static bool next_byte_is(State& s, unsigned char byte) {
+    if (!has_more_input(s) || *s.input != byte) {
+        return false;
     }
-    else if (compression_type == FixedHuffmanCodes){
-        std::cout << "compression_type: fixed huffman codes\n";
-        decode_fixed(encoded_bytes, size_of_decoded_bytes);
+    get_next_byte(s);
+    return true;
+}
+
+static void decode_gzip(State& s) {
+    if (get_next_byte(s) != 0x1f || get_next_byte(s) != 0x8b) {
+        throw CorruptStream{Status::BadGzipHeader};
     }
-    else if (compression_type == DynamicHuffmanCodes){
-        std::cout << "compression_type: dynamic huffman codes\n";
-        decode_dynamic(encoded_bytes, size_of_decoded_bytes);
+    // A gzip file is any number of members back to back, as cat makes them.
+    // Whatever follows the last member and does not start like another one
+    // is trailing data, zero padding from tape blocks for one, and ignored
+    // as gzip -d does.
+    do {
+        read_gzip_header(s);
+        // The member before was flushed in full, its checksum is done.
+        s.member_start = s.total_out;
+        s.checksum = 0;
+        decode_blocks(s);
+        if (s.stopped) {
+            return;
+        }
+        skip_to_byte_boundary(s);
+        const uint32_t crc = get_little_endian_uint32(s);
+        // ISIZE is the length of the member modulo 2^32.
+        const uint32_t size = get_little_endian_uint32(s);
+        if (crc != s.checksum || size != static_cast<uint32_t>(s.total_out - s.member_start)) {
+            throw CorruptStream{Status::BadChecksum};
+        }
+    } while (next_byte_is(s, 0x1f) && next_byte_is(s, 0x8b));
+}
+
+Framing detect_framing(const unsigned char* bytes, std::size_t size) {
+    if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+        return Framing::Gzip;
+    }
+    if (size >= 2 && is_zlib_header(bytes[0], bytes[1])) {
+        return Framing::Zlib;
+    }
+    return Framing::Raw;
+}
+
+/**
+ * @brief a fresh state for a stream with framing, which must not be Detect.
+*/
+static State start_state(
+    Framing framing,
+    const ByteSource& source,
+    const ByteSink& sink,
+    std::pmr::memory_resource* resource
+) {
+    Adler32Kernel checksum_kernel = nullptr;
+    if (framing == Framing::Zlib) {
+        checksum_kernel = kernels().adler32;
+    }
+    else if (framing == Framing::Gzip) {
+        checksum_kernel = kernels().crc32;
+    }
+    return State{
+        resource, source, sink, nullptr, 0, 0, 0, std::pmr::vector<unsigned char>(WindowSize, resource),
+        0, 0, 0, false, kernels().copy_match, checksum_kernel, framing == Framing::Zlib ? 1u : 0u, {}
+    };
+}
+
+static Status decode_framed(Framing framing, State& s) {
+    switch (framing) {
+        case Framing::Zlib:
+            return run(s, decode_zlib);
+        case Framing::Gzip:
+            return run(s, decode_gzip);
+        default:
+            return run(s, decode_blocks);
     }
-    else if (compression_type == Reserved){
-        std::cout << "compression_type: reserved, probably an error\n";
-        std::exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief decompresses a stream whose framing is known.
+*/
+static Status decompress_framed(
+    Framing framing,
+    const ByteSource& source,
+    const ByteSink& sink,
+    std::pmr::memory_resource* resource
+) {
+    State s = start_state(framing, source, sink, resource);
+    return decode_framed(framing, s);
+}
+
+Status decompress(Framing framing, const ByteSource& source, const ByteSink& sink, std::pmr::memory_resource* resource) {
+    if (framing != Framing::Detect) {
+        return decompress_framed(framing, source, sink, resource);
     }
+    // Peek at the first two bytes, then hand them out again ahead of
+    // whatever the source had left in the span they came from.
+    unsigned char head[2];
+    std::size_t head_size = 0;
+    const unsigned char* rest = nullptr;
+    std::size_t rest_size = 0;
+    while (head_size < 2) {
+        const unsigned char* bytes;
+        std::size_t size;
+        if (!source(bytes, size)) {
+            break;
+        }
+        const std::size_t n = std::min(size, 2 - head_size);
+        std::copy(bytes, bytes + n, head + head_size);
+        head_size += n;
+        rest = bytes + n;
+        rest_size = size - n;
+    }
+    int replayed = 0;
+    const ByteSource replay = [&](const unsigned char*& bytes, std::size_t& size) {
+        // Empty spans are fine, the bit reader asks again.
+        switch (replayed++) {
+            case 0:
+                bytes = head;
+                size = head_size;
+                return true;
+            case 1:
+                bytes = rest;
+                size = rest_size;
+                return true;
+            default:
+                return source(bytes, size);
+        }
+    };
+    return decompress_framed(detect_framing(head, head_size), replay, sink, resource);
+}
+
+Status decompress(
+    Framing framing,
+    const unsigned char* bytes,
+    std::size_t size,
+    std::vector<unsigned char>& out,
+    std::pmr::memory_resource* resource
+) {
+    const ByteSink sink = [&](const unsigned char* output, std::size_t output_size) {
+        out.insert(out.end(), output, output + output_size);
+        return true;
+    };
+    return decompress(framing, buffer_source(bytes, size), sink, resource);
+}
+
+ByteSource buffer_source(const unsigned char* bytes, std::size_t size) {
+    return [bytes, size, given = false](const unsigned char*& span, std::size_t& span_size) mutable {
+        if (given) {
+            return false;
+        }
+        given = true;
+        span = bytes;
+        span_size = size;
+        return true;
+    };
+}
+
+Status inflate(const ByteSource& source, const ByteSink& sink, std::pmr::memory_resource* resource) {
+    return decompress_framed(Framing::Raw, source, sink, resource);
+}
+
+Status inflate_zlib(const ByteSource& source, const ByteSink& sink, std::pmr::memory_resource* resource) {
+    return decompress_framed(Framing::Zlib, source, sink, resource);
+}
+
+std::vector<unsigned char> inflate(const std::vector<unsigned char>& encoded_bytes, std::size_t size_of_decoded_bytes){
+    std::vector<unsigned char> decoded_bytes{};
+    const ByteSink sink = [&](const unsigned char* bytes, std::size_t size) {
+        const std::size_t n = std::min(size, size_of_decoded_bytes - decoded_bytes.size());
+        decoded_bytes.insert(decoded_bytes.end(), bytes, bytes + n);
+        return decoded_bytes.size() < size_of_decoded_bytes;
+    };
+    inflate(buffer_source(encoded_bytes.data(), encoded_bytes.size()), sink);
+    return decoded_bytes;
 }
 
-} // namespace deflate
\ No newline at end of file
+} // namespace deflate
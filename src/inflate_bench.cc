@@ -0,0 +1,118 @@
+/**
+ * inflate_bench: decompresses each file given with this library and with
+ * the system zlib and prints the throughput of both, in MB of output per
+ * second. Files may be gzip, zlib or raw deflate, told apart as
+ * bitmap-inflate -f auto does. Each file is read into memory first and
+ * decompressed into a sink that only counts, so the numbers are inflate
+ * alone. Build with make RELEASE=1 inflate_bench for meaningful numbers.
+ *
+ *     inflate_bench [-t seconds] file...
+*/
+
+#include "deflate.h"
+#include "cpu_dispatch.h"
+#include "zlib_reference.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+struct Result {
+    bool ok;
+    uint64_t bytes_out;
+    // CRC-32 of the output, if asked for
+    uint32_t crc;
+};
+
+static Result run_bitmap(deflate::Framing framing, const std::vector<unsigned char>& file, bool checksum) {
+    Result result{false, 0, 0};
+    const deflate::ByteSink sink = [&](const unsigned char* bytes, std::size_t size) {
+        result.bytes_out += size;
+        if (checksum) {
+            result.crc = kernels().crc32(result.crc, bytes, size);
+        }
+        return true;
+    };
+    const deflate::Status status = deflate::decompress(framing, deflate::buffer_source(file.data(), file.size()), sink);
+    result.ok = !deflate::is_error(status);
+    return result;
+}
+
+static Result run_zlib(deflate::Framing framing, const std::vector<unsigned char>& file, bool checksum) {
+    Result result{false, 0, 0};
+    result.ok = zlib_inflate(file.data(), file.size(), framing == deflate::Framing::Raw, [&](const unsigned char* bytes, std::size_t size) {
+        result.bytes_out += size;
+        if (checksum) {
+            result.crc = kernels().crc32(result.crc, bytes, size);
+        }
+    });
+    return result;
+}
+
+/**
+ * @brief runs decompress over and over for at least seconds.
+ * @return MB of output per second.
+*/
+template <typename Decompress>
+static double throughput(Decompress&& decompress, double seconds) {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    uint64_t bytes_out = 0;
+    double elapsed = 0;
+    do {
+        bytes_out += decompress().bytes_out;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < seconds);
+    return static_cast<double>(bytes_out) / 1e6 / elapsed;
+}
+
+int main(int argc, char** argv) {
+    double seconds = 1.0;
+    int first = 1;
+    if (argc > 2 && std::strcmp(argv[1], "-t") == 0) {
+        seconds = std::atof(argv[2]);
+        first = 3;
+    }
+    if (first >= argc) {
+        std::fprintf(stderr, "usage: %s [-t seconds] file...\n", argv[0]);
+        return 2;
+    }
+    std::printf("%-32s %5s %12s %12s %12s %12s %6s\n", "file", "form", "in", "out", "bitmap", "zlib", "ratio");
+    int failures = 0;
+    for (int i = first; i < argc; i++) {
+        std::ifstream stream{argv[i], std::ios::in | std::ios::binary};
+        if (!stream.good()) {
+            std::fprintf(stderr, "%s: cannot read\n", argv[i]);
+            failures++;
+            continue;
+        }
+        const std::vector<unsigned char> file{std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+        const deflate::Framing framing = deflate::detect_framing(file.data(), file.size());
+        const char* form = framing == deflate::Framing::Gzip ? "gzip" : framing == deflate::Framing::Zlib ? "zlib" : "raw";
+
+        // Both have to agree on the output before their speed means anything.
+        const Result ours = run_bitmap(framing, file, true);
+        const Result theirs = run_zlib(framing, file, true);
+        if (!ours.ok || !theirs.ok || ours.bytes_out != theirs.bytes_out || ours.crc != theirs.crc) {
+            std::fprintf(
+                stderr, "%s: outputs differ (bitmap %s, %llu bytes; zlib %s, %llu bytes)\n", argv[i],
+                ours.ok ? "ok" : "failed", static_cast<unsigned long long>(ours.bytes_out),
+                theirs.ok ? "ok" : "failed", static_cast<unsigned long long>(theirs.bytes_out)
+            );
+            failures++;
+            continue;
+        }
+        const double bitmap_speed = throughput([&]() { return run_bitmap(framing, file, false); }, seconds);
+        const double zlib_speed = throughput([&]() { return run_zlib(framing, file, false); }, seconds);
+        std::printf(
+            "%-32s %5s %12zu %12llu %7.1f MB/s %7.1f MB/s %5.2fx\n", argv[i], form, file.size(),
+            static_cast<unsigned long long>(ours.bytes_out), bitmap_speed, zlib_speed, bitmap_speed / zlib_speed
+        );
+    }
+    return failures == 0 ? 0 : 1;
+}
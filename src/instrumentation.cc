@@ -0,0 +1,221 @@
+#include "instrumentation.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdarg>
+
+namespace instrumentation {
+
+Counters& Counters::operator+=(const Counters& other) {
+    bits_consumed += other.bits_consumed;
+    symbols_decoded += other.symbols_decoded;
+    literals += other.literals;
+    matches += other.matches;
+    stored_bytes += other.stored_bytes;
+    bytes_out += other.bytes_out;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(BlockType::Count); i++) {
+        blocks[i] += other.blocks[i];
+    }
+    for (std::size_t i = 0; i < NumberOfLengthCodes; i++) {
+        length_histogram[i] += other.length_histogram[i];
+    }
+    for (std::size_t i = 0; i < NumberOfDistanceCodes; i++) {
+        distance_histogram[i] += other.distance_histogram[i];
+    }
+    rows += other.rows;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Stage::Count); i++) {
+        stage_nanoseconds[i] += other.stage_nanoseconds[i];
+    }
+    return *this;
+}
+
+namespace {
+
+/**
+ * Counters of one thread. total is what total_counters() sums, thread is
+ * what thread_counters() returns, they only differ in when they were last
+ * reset.
+*/
+struct ThreadSlot {
+    std::mutex mutex;
+    Counters thread{};
+    Counters total{};
+
+    ThreadSlot();
+    ~ThreadSlot();
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadSlot*> slots;
+    // Totals of threads that have exited
+    Counters retired{};
+};
+
+// Never destroyed, threads may still exit after static destruction began.
+Registry& registry() {
+    static Registry* r = new Registry{};
+    return *r;
+}
+
+ThreadSlot::ThreadSlot() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    r.slots.push_back(this);
+}
+
+ThreadSlot::~ThreadSlot() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    r.retired += total;
+    r.slots.erase(std::find(r.slots.begin(), r.slots.end(), this));
+}
+
+ThreadSlot& this_thread_slot() {
+    thread_local ThreadSlot slot;
+    return slot;
+}
+
+std::atomic<bool> stage_timing{false};
+
+} // namespace
+
+void publish(const Counters& delta) {
+    ThreadSlot& slot = this_thread_slot();
+    std::lock_guard<std::mutex> lock{slot.mutex};
+    slot.thread += delta;
+    slot.total += delta;
+}
+
+Counters thread_counters() {
+    ThreadSlot& slot = this_thread_slot();
+    std::lock_guard<std::mutex> lock{slot.mutex};
+    return slot.thread;
+}
+
+void reset_thread_counters() {
+    ThreadSlot& slot = this_thread_slot();
+    std::lock_guard<std::mutex> lock{slot.mutex};
+    slot.thread = Counters{};
+}
+
+Counters total_counters() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    Counters sum = r.retired;
+    for (ThreadSlot* slot : r.slots) {
+        std::lock_guard<std::mutex> slot_lock{slot->mutex};
+        sum += slot->total;
+    }
+    return sum;
+}
+
+void reset_total_counters() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    r.retired = Counters{};
+    for (ThreadSlot* slot : r.slots) {
+        std::lock_guard<std::mutex> slot_lock{slot->mutex};
+        slot->total = Counters{};
+    }
+}
+
+void set_stage_timing(bool enabled) {
+    stage_timing.store(enabled, std::memory_order_relaxed);
+}
+
+bool stage_timing_enabled() {
+    return stage_timing.load(std::memory_order_relaxed);
+}
+
+StageTimer::StageTimer(Counters& counters, Stage stage) :
+    counters_{counters},
+    stage_{stage},
+    enabled_{stage_timing_enabled()},
+    start_{}
+{
+    if (enabled_) {
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+StageTimer::~StageTimer() {
+    if (enabled_) {
+        const auto elapsed = std::chrono::steady_clock::now() - start_;
+        counters_.stage_nanoseconds[static_cast<std::size_t>(stage_)] +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+}
+
+static void append_array(std::string& out, const char* name, const uint64_t* values, std::size_t count) {
+    out += '"';
+    out += name;
+    out += "\":[";
+    for (std::size_t i = 0; i < count; i++) {
+        if (i) {
+            out += ',';
+        }
+        out += std::to_string(values[i]);
+    }
+    out += ']';
+}
+
+static void append_field(std::string& out, const char* name, uint64_t value) {
+    out += '"';
+    out += name;
+    out += "\":";
+    out += std::to_string(value);
+}
+
+std::string to_json(const Counters& counters) {
+    static constexpr const char* block_names[] = {"stored", "fixed", "dynamic"};
+    static constexpr const char* stage_names[] = {"parse", "inflate", "unfilter", "convert"};
+    std::string out = "{";
+    append_field(out, "bits_consumed", counters.bits_consumed);
+    out += ',';
+    append_field(out, "symbols_decoded", counters.symbols_decoded);
+    out += ',';
+    append_field(out, "literals", counters.literals);
+    out += ',';
+    append_field(out, "matches", counters.matches);
+    out += ',';
+    append_field(out, "stored_bytes", counters.stored_bytes);
+    out += ',';
+    append_field(out, "bytes_out", counters.bytes_out);
+    out += ",\"blocks\":{";
+    for (std::size_t i = 0; i < static_cast<std::size_t>(BlockType::Count); i++) {
+        if (i) {
+            out += ',';
+        }
+        append_field(out, block_names[i], counters.blocks[i]);
+    }
+    out += "},";
+    append_array(out, "length_histogram", counters.length_histogram, NumberOfLengthCodes);
+    out += ',';
+    append_array(out, "distance_histogram", counters.distance_histogram, NumberOfDistanceCodes);
+    out += ',';
+    append_field(out, "rows", counters.rows);
+    out += ",\"stage_nanoseconds\":{";
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Stage::Count); i++) {
+        if (i) {
+            out += ',';
+        }
+        append_field(out, stage_names[i], counters.stage_nanoseconds[i]);
+    }
+    out += "}}";
+    return out;
+}
+
+void trace(const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    std::fprintf(stderr, "%s\n", line);
+}
+
+} // namespace instrumentation
@@ -0,0 +1,217 @@
+// Built with -mavx2, only called after cpu_features() reported AVX2.
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace kernel_builds::avx2 {
+
+static constexpr uint32_t adler_base = 65521;
+static constexpr std::size_t adler_nmax = 5552;
+
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size) {
+    constexpr std::size_t block_size = 32;
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    std::size_t blocks = size / block_size;
+    size -= blocks * block_size;
+
+    const __m256i tap = _mm256_setr_epi8(
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+    );
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    while (blocks) {
+        std::size_t n = adler_nmax / block_size;
+        if (n > blocks) {
+            n = blocks;
+        }
+        blocks -= n;
+        __m256i v_ps = _mm256_setr_epi32(static_cast<int>(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s2 = _mm256_setr_epi32(static_cast<int>(s2), 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s1 = zero;
+        do {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(v, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(v, tap), ones));
+            bytes += block_size;
+        } while (--n);
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+
+        __m128i sum1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+        sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 += static_cast<uint32_t>(_mm_cvtsi128_si32(sum1));
+        __m128i sum2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+        sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = static_cast<uint32_t>(_mm_cvtsi128_si32(sum2));
+        s1 %= adler_base;
+        s2 %= adler_base;
+    }
+    return scalar::adler32(s2 << 16 | s1, bytes, size);
+}
+
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    std::size_t i = 0;
+    for (; i + 32 <= row_bytes; i += 32) {
+        const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+        const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(previous_row + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + i), _mm256_add_epi8(r, p));
+    }
+    scalar::unfilter_up(row + i, previous_row + i, row_bytes - i, bpp);
+}
+
+void expand_palette(const unsigned char* indexes, std::size_t count, const Color* palette, Color* out) {
+    const int* table = reinterpret_cast<const int*>(palette);
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indexes + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_i32gather_epi32(table, index, 4));
+    }
+    scalar::expand_palette(indexes + i, count - i, palette, out + i);
+}
+
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out) {
+    const __m256i order = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+    );
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * i), _mm256_shuffle_epi8(v, order));
+    }
+    scalar::swizzle_rgba_to_bgra(pixels + i, count - i, out + 4 * i);
+}
+
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length) {
+    if (distance < 32) {
+        sse4::copy_match(out, distance, length);
+        return;
+    }
+    for (std::size_t i = 0; i < length; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out + i - distance));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+    }
+}
+
+static __m256i multiply_alpha(__m256i x, __m256i a) {
+    const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+void premultiply_alpha(Color* pixels, std::size_t count) {
+    // As the SSE4 build, four pixels per half.
+    const __m256i low_alpha = _mm256_setr_epi8(
+        3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1,
+        3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1
+    );
+    const __m256i high_alpha = _mm256_setr_epi8(
+        11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1,
+        11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1
+    );
+    const __m256i opaque = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+    const __m256i zero = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i* p = reinterpret_cast<__m256i*>(pixels + i);
+        const __m256i v = _mm256_loadu_si256(p);
+        // unpack and pack both work within 128 bit lanes, so the pixel order
+        // comes back unchanged.
+        const __m256i low = multiply_alpha(_mm256_unpacklo_epi8(v, zero), _mm256_or_si256(_mm256_shuffle_epi8(v, low_alpha), opaque));
+        const __m256i high = multiply_alpha(_mm256_unpackhi_epi8(v, zero), _mm256_or_si256(_mm256_shuffle_epi8(v, high_alpha), opaque));
+        _mm256_storeu_si256(p, _mm256_packus_epi16(low, high));
+    }
+    sse4::premultiply_alpha(pixels + i, count - i);
+}
+
+void widen_to_float(const Color* pixels, std::size_t count, bool premultiply, unsigned char* out) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    std::size_t i = 0;
+    for (; i + 2 <= count; i += 2, out += 32) {
+        const __m128i two = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + i));
+        const __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(two)), scale);
+        const __m256 m = premultiply ? _mm256_blend_ps(_mm256_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), one, 0x88) : one;
+        _mm256_storeu_ps(reinterpret_cast<float*>(out), _mm256_mul_ps(v, m));
+    }
+    sse4::widen_to_float(pixels + i, count - i, premultiply, out);
+}
+
+/**
+ * @brief the fast_log2() of the scalar build, eight lanes at a time.
+*/
+static __m256 log2_ps(__m256 x) {
+    const __m256i bits = _mm256_castps_si256(x);
+    const __m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    const __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 y = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    const __m256 y2 = _mm256_mul_ps(y, y);
+    __m256 series = _mm256_add_ps(_mm256_set1_ps(1.0f / 5.0f), _mm256_mul_ps(y2, _mm256_set1_ps(1.0f / 7.0f)));
+    series = _mm256_add_ps(_mm256_set1_ps(1.0f / 3.0f), _mm256_mul_ps(y2, series));
+    series = _mm256_mul_ps(y, _mm256_add_ps(one, _mm256_mul_ps(y2, series)));
+    return _mm256_add_ps(exponent, _mm256_mul_ps(_mm256_set1_ps(2.88539008f), series));
+}
+
+/**
+ * @brief the fast_exp2() of the scalar build, eight lanes at a time.
+*/
+static __m256 exp2_ps(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(-126.0f));
+    const __m256i whole = _mm256_add_epi32(_mm256_cvttps_epi32(x), _mm256_castps_si256(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ)));
+    const __m256 f = _mm256_sub_ps(x, _mm256_cvtepi32_ps(whole));
+    __m256 p = _mm256_add_ps(_mm256_set1_ps(0.00133335581f), _mm256_mul_ps(f, _mm256_set1_ps(0.000154035304f)));
+    p = _mm256_add_ps(_mm256_set1_ps(0.00961812911f), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(0.0555041087f), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(0.240226507f), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(0.693147181f), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(f, p));
+    const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(whole, _mm256_set1_epi32(127)), 23));
+    return _mm256_mul_ps(p, scale);
+}
+
+static __m256 pow_ps(__m256 x, __m256 y) {
+    return _mm256_andnot_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LE_OQ), exp2_ps(_mm256_mul_ps(y, log2_ps(x))));
+}
+
+void transfer_16(const uint16_t* samples, std::size_t count, bool source_is_srgb, float source_exponent, bool linear_output, unsigned char* out) {
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i)));
+        const __m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(wide), _mm256_set1_ps(1.0f / 65535.0f));
+        __m256 linear;
+        if (source_is_srgb) {
+            const __m256 curve = pow_ps(
+                _mm256_mul_ps(_mm256_add_ps(x, _mm256_set1_ps(0.055f)), _mm256_set1_ps(1.0f / 1.055f)), _mm256_set1_ps(2.4f)
+            );
+            linear = _mm256_blendv_ps(curve, _mm256_mul_ps(x, _mm256_set1_ps(1.0f / 12.92f)), _mm256_cmp_ps(x, _mm256_set1_ps(0.04045f), _CMP_LE_OQ));
+        }
+        else {
+            linear = pow_ps(x, _mm256_set1_ps(source_exponent));
+        }
+        __m256 value = linear;
+        if (!linear_output) {
+            const __m256 curve = _mm256_sub_ps(
+                _mm256_mul_ps(_mm256_set1_ps(1.055f), pow_ps(linear, _mm256_set1_ps(1.0f / 2.4f))), _mm256_set1_ps(0.055f)
+            );
+            value = _mm256_blendv_ps(curve, _mm256_mul_ps(linear, _mm256_set1_ps(12.92f)), _mm256_cmp_ps(linear, _mm256_set1_ps(0.0031308f), _CMP_LE_OQ));
+        }
+        const __m256 scaled = _mm256_min_ps(
+            _mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)), _mm256_set1_ps(255.0f)
+        );
+        const __m256i whole = _mm256_cvttps_epi32(scaled);
+        const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(whole), _mm256_extracti128_si256(whole, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(words, words));
+    }
+    sse4::transfer_16(samples + i, count - i, source_is_srgb, source_exponent, linear_output, out + i);
+}
+
+} // namespace kernel_builds::avx2
+
+#endif
@@ -0,0 +1,115 @@
+// Built with -mavx512f -mavx512bw, only called after cpu_features()
+// reported both.
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace kernel_builds::avx512 {
+
+static constexpr uint32_t adler_base = 65521;
+static constexpr std::size_t adler_nmax = 5552;
+
+// GCC 12 implements the unmasked forms of several intrinsics with a source
+// from _mm512_undefined_epi32(), which reads itself to stay uninitialized
+// and trips -Wmaybe-uninitialized at -O2 (GCC bug 105593, fixed in 13).
+// The kernels below use the zero-masked forms and this reduction instead,
+// with every lane selected they compute the same.
+static constexpr __mmask16 all_lanes = 0xffff;
+
+static uint32_t reduce_add(__m512i v) {
+    const __m256i quad = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xff, v, 0), _mm512_maskz_extracti64x4_epi64(0xff, v, 1));
+    __m128i pair = _mm_add_epi32(_mm256_castsi256_si128(quad), _mm256_extracti128_si256(quad, 1));
+    pair = _mm_add_epi32(pair, _mm_shuffle_epi32(pair, 0x4e));
+    pair = _mm_add_epi32(pair, _mm_shuffle_epi32(pair, 0xb1));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(pair));
+}
+
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size) {
+    constexpr std::size_t block_size = 64;
+    alignas(64) static const unsigned char weights[block_size] = {
+        64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49,
+        48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33,
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+    };
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    std::size_t blocks = size / block_size;
+    size -= blocks * block_size;
+
+    const __m512i tap = _mm512_load_si512(weights);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i ones = _mm512_set1_epi16(1);
+    while (blocks) {
+        std::size_t n = adler_nmax / block_size;
+        if (n > blocks) {
+            n = blocks;
+        }
+        blocks -= n;
+        __m512i v_ps = zero;
+        __m512i v_s2 = zero;
+        __m512i v_s1 = zero;
+        const uint32_t s1_start = s1;
+        const std::size_t number_of_blocks = n;
+        do {
+            const __m512i v = _mm512_loadu_si512(bytes);
+            v_ps = _mm512_add_epi32(v_ps, v_s1);
+            v_s1 = _mm512_add_epi32(v_s1, _mm512_sad_epu8(v, zero));
+            v_s2 = _mm512_add_epi32(v_s2, _mm512_madd_epi16(_mm512_maddubs_epi16(v, tap), ones));
+            bytes += block_size;
+        } while (--n);
+        v_s2 = _mm512_add_epi32(v_s2, _mm512_maskz_slli_epi32(all_lanes, v_ps, 6));
+        s2 += s1_start * static_cast<uint32_t>(number_of_blocks * block_size) +
+              reduce_add(v_s2);
+        s1 += reduce_add(v_s1);
+        s1 %= adler_base;
+        s2 %= adler_base;
+    }
+    return scalar::adler32(s2 << 16 | s1, bytes, size);
+}
+
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    std::size_t i = 0;
+    for (; i + 64 <= row_bytes; i += 64) {
+        const __m512i r = _mm512_loadu_si512(row + i);
+        const __m512i p = _mm512_loadu_si512(previous_row + i);
+        _mm512_storeu_si512(row + i, _mm512_add_epi8(r, p));
+    }
+    scalar::unfilter_up(row + i, previous_row + i, row_bytes - i, bpp);
+}
+
+void expand_palette(const unsigned char* indexes, std::size_t count, const Color* palette, Color* out) {
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i index = _mm512_maskz_cvtepu8_epi32(all_lanes, _mm_loadu_si128(reinterpret_cast<const __m128i*>(indexes + i)));
+        _mm512_storeu_si512(out + i, _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), all_lanes, index, palette, 4));
+    }
+    scalar::expand_palette(indexes + i, count - i, palette, out + i);
+}
+
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out) {
+    const __m512i order = _mm512_maskz_broadcast_i32x4(all_lanes, _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15));
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i v = _mm512_loadu_si512(pixels + i);
+        _mm512_storeu_si512(out + 4 * i, _mm512_shuffle_epi8(v, order));
+    }
+    scalar::swizzle_rgba_to_bgra(pixels + i, count - i, out + 4 * i);
+}
+
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length) {
+    if (distance < 64) {
+        sse4::copy_match(out, distance, length);
+        return;
+    }
+    for (std::size_t i = 0; i < length; i += 64) {
+        _mm512_storeu_si512(out + i, _mm512_loadu_si512(out + i - distance));
+    }
+}
+
+} // namespace kernel_builds::avx512
+
+#endif
@@ -0,0 +1,255 @@
+#include "kernels.h"
+
+#include <array>
+#include <cstring>
+#include <cstdlib>
+
+namespace kernel_builds::scalar {
+
+// Slicing by 8: table k holds the CRC of a byte followed by k zero bytes.
+static constexpr std::array<std::array<uint32_t, 256>, 8> crc_tables = []() {
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        tables[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (std::size_t k = 1; k < 8; k++) {
+            tables[k][n] = tables[0][tables[k - 1][n] & 0xff] ^ (tables[k - 1][n] >> 8);
+        }
+    }
+    return tables;
+}();
+
+uint32_t crc32(uint32_t crc, const unsigned char* bytes, std::size_t size) {
+    uint32_t c = ~crc;
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint32_t low, high;
+        std::memcpy(&low, bytes, 4);
+        std::memcpy(&high, bytes + 4, 4);
+        // Little endian loads, as every target this builds for
+        low ^= c;
+        c = crc_tables[7][low & 0xff] ^ crc_tables[6][(low >> 8) & 0xff] ^
+            crc_tables[5][(low >> 16) & 0xff] ^ crc_tables[4][low >> 24] ^
+            crc_tables[3][high & 0xff] ^ crc_tables[2][(high >> 8) & 0xff] ^
+            crc_tables[1][(high >> 16) & 0xff] ^ crc_tables[0][high >> 24];
+    }
+    for (; size; size--) {
+        c = crc_tables[0][(c ^ *bytes++) & 0xff] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+// Largest prime below 2^16, and the most bytes that can be summed before
+// s2 could overflow 32 bits.
+static constexpr uint32_t adler_base = 65521;
+static constexpr std::size_t adler_nmax = 5552;
+
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size) {
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    while (size) {
+        const std::size_t n = size < adler_nmax ? size : adler_nmax;
+        size -= n;
+        for (std::size_t i = 0; i < n; i++) {
+            s1 += bytes[i];
+            s2 += s1;
+        }
+        bytes += n;
+        s1 %= adler_base;
+        s2 %= adler_base;
+    }
+    return s2 << 16 | s1;
+}
+
+void unfilter_sub(unsigned char* row, const unsigned char*, std::size_t row_bytes, std::size_t bpp) {
+    for (std::size_t i = bpp; i < row_bytes; i++) {
+        row[i] += row[i - bpp];
+    }
+}
+
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t) {
+    for (std::size_t i = 0; i < row_bytes; i++) {
+        row[i] += previous_row[i];
+    }
+}
+
+void unfilter_average(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    for (std::size_t i = 0; i < bpp && i < row_bytes; i++) {
+        row[i] += previous_row[i] >> 1;
+    }
+    for (std::size_t i = bpp; i < row_bytes; i++) {
+        row[i] += (row[i - bpp] + previous_row[i]) >> 1;
+    }
+}
+
+static unsigned char paeth_predictor(int a, int b, int c) {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return static_cast<unsigned char>(a);
+    }
+    if (pb <= pc) {
+        return static_cast<unsigned char>(b);
+    }
+    return static_cast<unsigned char>(c);
+}
+
+void unfilter_paeth(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    for (std::size_t i = 0; i < bpp && i < row_bytes; i++) {
+        row[i] += previous_row[i];
+    }
+    for (std::size_t i = bpp; i < row_bytes; i++) {
+        row[i] += paeth_predictor(row[i - bpp], previous_row[i], previous_row[i - bpp]);
+    }
+}
+
+void expand_palette(const unsigned char* indexes, std::size_t count, const Color* palette, Color* out) {
+    for (std::size_t i = 0; i < count; i++) {
+        out[i] = palette[indexes[i]];
+    }
+}
+
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out) {
+    // Swapping bytes 0 and 2 of each little endian word, written so the
+    // compiler can keep it in vector registers.
+    for (std::size_t i = 0; i < count; i++) {
+        uint32_t v;
+        std::memcpy(&v, &pixels[i], 4);
+        v = (v & 0xff00ff00u) | ((v >> 16) & 0xffu) | ((v & 0xffu) << 16);
+        std::memcpy(out + 4 * i, &v, 4);
+    }
+}
+
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length) {
+    const unsigned char* from = out - distance;
+    if (distance == 1) {
+        std::memset(out, *from, length);
+        return;
+    }
+    for (std::size_t i = 0; i < length; i++) {
+        out[i] = from[i];
+    }
+}
+
+void reduce_row(const Color* pixels, std::size_t count, int shift, uint32_t* sums) {
+    const std::size_t block = std::size_t{1} << shift;
+    for (std::size_t start = 0; start < count; start += block, sums += 4) {
+        const std::size_t end = count - start < block ? count : start + block;
+        uint32_t r = 0, g = 0, b = 0, a = 0;
+        for (std::size_t i = start; i < end; i++) {
+            r += pixels[i].r * pixels[i].a;
+            g += pixels[i].g * pixels[i].a;
+            b += pixels[i].b * pixels[i].a;
+            a += pixels[i].a;
+        }
+        sums[0] += r;
+        sums[1] += g;
+        sums[2] += b;
+        sums[3] += a;
+    }
+}
+
+void premultiply_alpha(Color* pixels, std::size_t count) {
+    // c * a / 255 rounded to nearest, as multiply_alpha()
+    const auto multiply = [](unsigned c, unsigned a) {
+        const unsigned t = c * a + 128;
+        return static_cast<unsigned char>((t + (t >> 8)) >> 8);
+    };
+    for (std::size_t i = 0; i < count; i++) {
+        const unsigned a = pixels[i].a;
+        pixels[i].r = multiply(pixels[i].r, a);
+        pixels[i].g = multiply(pixels[i].g, a);
+        pixels[i].b = multiply(pixels[i].b, a);
+    }
+}
+
+void widen_to_float(const Color* pixels, std::size_t count, bool premultiply, unsigned char* out) {
+    constexpr float scale = 1.0f / 255.0f;
+    for (std::size_t i = 0; i < count; i++, out += 4 * sizeof(float)) {
+        const float a = pixels[i].a * scale;
+        const float m = premultiply ? a : 1.0f;
+        const float values[4] = {pixels[i].r * scale * m, pixels[i].g * scale * m, pixels[i].b * scale * m, a};
+        std::memcpy(out, values, sizeof(values));
+    }
+}
+
+/**
+ * @brief log2 and exp2 by polynomial, close enough that a 16 bit sample
+ * taken through a power curve lands within one step of the 8 bit output
+ * pow would give, and on the same one for all but about 0.1% of samples.
+ * The SIMD builds of transfer_16 repeat these operations in the same order
+ * and agree to the bit.
+*/
+static float fast_log2(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    const float exponent = static_cast<float>(static_cast<int>(bits >> 23) - 127);
+    bits = (bits & 0x007fffffu) | 0x3f800000u;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+    // log2(m) = 2 / ln(2) * atanh((m - 1) / (m + 1)), m in [1, 2)
+    const float y = (m - 1.0f) / (m + 1.0f);
+    const float y2 = y * y;
+    const float series = y * (1.0f + y2 * (1.0f / 3.0f + y2 * (1.0f / 5.0f + y2 * (1.0f / 7.0f))));
+    return exponent + 2.88539008f * series;
+}
+
+static float fast_exp2(float x) {
+    x = x < -126.0f ? -126.0f : x;
+    const int whole = static_cast<int>(x) - (x < 0.0f ? 1 : 0);
+    const float f = x - static_cast<float>(whole);
+    // 2^f for f in [0, 1), Taylor series of e^(f ln 2)
+    const float p = 1.0f + f * (0.693147181f + f * (0.240226507f + f * (0.0555041087f +
+                    f * (0.00961812911f + f * (0.00133335581f + f * 0.000154035304f)))));
+    const uint32_t bits = static_cast<uint32_t>(whole + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+static float fast_pow(float x, float y) {
+    return x <= 0.0f ? 0.0f : fast_exp2(y * fast_log2(x));
+}
+
+template <bool source_is_srgb, bool linear_output>
+static void transfer_16(const uint16_t* samples, std::size_t count, float source_exponent, unsigned char* out) {
+    for (std::size_t i = 0; i < count; i++) {
+        const float x = samples[i] * (1.0f / 65535.0f);
+        float linear;
+        if constexpr (source_is_srgb) {
+            linear = x <= 0.04045f ? x * (1.0f / 12.92f) : fast_pow((x + 0.055f) * (1.0f / 1.055f), 2.4f);
+        }
+        else {
+            linear = fast_pow(x, source_exponent);
+        }
+        float value = linear;
+        if constexpr (!linear_output) {
+            value = linear <= 0.0031308f ? linear * 12.92f : 1.055f * fast_pow(linear, 1.0f / 2.4f) - 0.055f;
+        }
+        const float scaled = value * 255.0f + 0.5f;
+        out[i] = static_cast<unsigned char>(scaled < 255.0f ? scaled : 255.0f);
+    }
+}
+
+void transfer_16(const uint16_t* samples, std::size_t count, bool source_is_srgb, float source_exponent, bool linear_output, unsigned char* out) {
+    if (source_is_srgb && linear_output) {
+        transfer_16<true, true>(samples, count, source_exponent, out);
+    }
+    else if (source_is_srgb) {
+        transfer_16<true, false>(samples, count, source_exponent, out);
+    }
+    else if (linear_output) {
+        transfer_16<false, true>(samples, count, source_exponent, out);
+    }
+    else {
+        transfer_16<false, false>(samples, count, source_exponent, out);
+    }
+}
+
+} // namespace kernel_builds::scalar
@@ -0,0 +1,422 @@
+// Built with -mssse3 -msse4.1 -mpclmul, only called after cpu_features()
+// reported all three.
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+#include <cstring>
+
+namespace kernel_builds::sse4 {
+
+/**
+ * @brief folds 16 byte blocks of bytes into crc with carry-less multiplies,
+ * after "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ"
+ * (Intel, 2009). size is at least 64 and a multiple of 16, crc is the
+ * running (inverted) state.
+*/
+static uint32_t crc32_fold(const unsigned char* bytes, std::size_t size, uint32_t crc) {
+    alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+    __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x00));
+    __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x10));
+    __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x20));
+    __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    __m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+    bytes += 64;
+    size -= 64;
+
+    // Four blocks in parallel
+    while (size >= 64) {
+        const __m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        const __m128i x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        const __m128i x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        const __m128i x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 0x30)));
+        bytes += 64;
+        size -= 64;
+    }
+
+    // Down to one block
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+    const __m128i* rest[] = {&x2, &x3, &x4};
+    for (const __m128i* next : rest) {
+        const __m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, *next), x5);
+    }
+    while (size >= 16) {
+        const __m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes))), x5);
+        bytes += 16;
+        size -= 16;
+    }
+
+    // 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+uint32_t crc32(uint32_t crc, const unsigned char* bytes, std::size_t size) {
+    if (size < 64) {
+        return scalar::crc32(crc, bytes, size);
+    }
+    const std::size_t folded = size & ~static_cast<std::size_t>(15);
+    crc = ~crc32_fold(bytes, folded, ~crc);
+    return scalar::crc32(crc, bytes + folded, size - folded);
+}
+
+static constexpr uint32_t adler_base = 65521;
+static constexpr std::size_t adler_nmax = 5552;
+
+uint32_t adler32(uint32_t adler, const unsigned char* bytes, std::size_t size) {
+    constexpr std::size_t block_size = 32;
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    std::size_t blocks = size / block_size;
+    size -= blocks * block_size;
+
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    while (blocks) {
+        std::size_t n = adler_nmax / block_size;
+        if (n > blocks) {
+            n = blocks;
+        }
+        blocks -= n;
+        // s1 before the first block goes into s2 once per byte, v_ps
+        // collects s1 at the start of every later block.
+        __m128i v_ps = _mm_set_epi32(0, 0, 0, static_cast<int>(s1 * n));
+        __m128i v_s2 = _mm_set_epi32(0, 0, 0, static_cast<int>(s2));
+        __m128i v_s1 = zero;
+        do {
+            const __m128i bytes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+            const __m128i bytes2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 16));
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            bytes += block_size;
+        } while (--n);
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 += static_cast<uint32_t>(_mm_cvtsi128_si32(v_s1));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = static_cast<uint32_t>(_mm_cvtsi128_si32(v_s2));
+        s1 %= adler_base;
+        s2 %= adler_base;
+    }
+    return scalar::adler32(s2 << 16 | s1, bytes, size);
+}
+
+// Pixels of three and four bytes are unfiltered one at a time in the low
+// lanes of a register, as libpng does. Other pixel sizes are rare enough
+// to leave to the scalar code.
+static __m128i load4(const unsigned char* p) {
+    int v;
+    std::memcpy(&v, p, 4);
+    return _mm_cvtsi32_si128(v);
+}
+
+static void store4(unsigned char* p, __m128i v) {
+    const int w = _mm_cvtsi128_si32(v);
+    std::memcpy(p, &w, 4);
+}
+
+static __m128i load3(const unsigned char* p) {
+    int v = 0;
+    std::memcpy(&v, p, 3);
+    return _mm_cvtsi32_si128(v);
+}
+
+static void store3(unsigned char* p, __m128i v) {
+    const int w = _mm_cvtsi128_si32(v);
+    std::memcpy(p, &w, 3);
+}
+
+/**
+ * @brief loads one pixel, all four bytes when they are inside the row.
+*/
+static __m128i load_pixel(const unsigned char* p, std::size_t bpp, std::size_t left) {
+    return bpp == 4 || left >= 4 ? load4(p) : load3(p);
+}
+
+static void store_pixel(unsigned char* p, __m128i v, std::size_t bpp) {
+    if (bpp == 4) {
+        store4(p, v);
+    }
+    else {
+        store3(p, v);
+    }
+}
+
+void unfilter_sub(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    if (bpp != 3 && bpp != 4) {
+        scalar::unfilter_sub(row, previous_row, row_bytes, bpp);
+        return;
+    }
+    __m128i d = _mm_setzero_si128();
+    for (std::size_t i = 0; i + bpp <= row_bytes; i += bpp) {
+        d = _mm_add_epi8(load_pixel(row + i, bpp, row_bytes - i), d);
+        store_pixel(row + i, d, bpp);
+    }
+}
+
+void unfilter_up(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    std::size_t i = 0;
+    for (; i + 16 <= row_bytes; i += 16) {
+        const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous_row + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), _mm_add_epi8(r, p));
+    }
+    scalar::unfilter_up(row + i, previous_row + i, row_bytes - i, bpp);
+}
+
+void unfilter_average(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    if (bpp != 3 && bpp != 4) {
+        scalar::unfilter_average(row, previous_row, row_bytes, bpp);
+        return;
+    }
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i d = _mm_setzero_si128();
+    for (std::size_t i = 0; i + bpp <= row_bytes; i += bpp) {
+        const __m128i a = d;
+        const __m128i b = load_pixel(previous_row + i, bpp, row_bytes - i);
+        // _mm_avg_epu8 rounds up, the png average truncates.
+        const __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        d = _mm_add_epi8(load_pixel(row + i, bpp, row_bytes - i), average);
+        store_pixel(row + i, d, bpp);
+    }
+}
+
+void unfilter_paeth(unsigned char* row, const unsigned char* previous_row, std::size_t row_bytes, std::size_t bpp) {
+    if (bpp != 3 && bpp != 4) {
+        scalar::unfilter_paeth(row, previous_row, row_bytes, bpp);
+        return;
+    }
+    // Samples widened to 16 bits so the differences can go negative.
+    const __m128i zero = _mm_setzero_si128();
+    __m128i b = zero;
+    __m128i d = zero;
+    for (std::size_t i = 0; i + bpp <= row_bytes; i += bpp) {
+        const __m128i c = b;
+        const __m128i a = d;
+        b = _mm_unpacklo_epi8(load_pixel(previous_row + i, bpp, row_bytes - i), zero);
+        d = _mm_unpacklo_epi8(load_pixel(row + i, bpp, row_bytes - i), zero);
+        // p - a, p - b and p - c for p = a + b - c
+        const __m128i pa = _mm_sub_epi16(b, c);
+        const __m128i pb = _mm_sub_epi16(a, c);
+        const __m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+        const __m128i abs_pa = _mm_abs_epi16(pa);
+        const __m128i abs_pb = _mm_abs_epi16(pb);
+        const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(abs_pa, abs_pb));
+        const __m128i nearest = _mm_blendv_epi8(
+            _mm_blendv_epi8(c, b, _mm_cmpeq_epi16(smallest, abs_pb)),
+            a,
+            _mm_cmpeq_epi16(smallest, abs_pa)
+        );
+        d = _mm_add_epi8(d, nearest);
+        store_pixel(row + i, _mm_packus_epi16(d, d), bpp);
+    }
+}
+
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out) {
+    const __m128i order = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), _mm_shuffle_epi8(v, order));
+    }
+    scalar::swizzle_rgba_to_bgra(pixels + i, count - i, out + 4 * i);
+}
+
+void copy_match(unsigned char* out, std::size_t distance, std::size_t length) {
+    if (distance < 16) {
+        scalar::copy_match(out, distance, length);
+        return;
+    }
+    // Each load ends at or before the start of its store, so it only reads
+    // bytes that are final.
+    for (std::size_t i = 0; i < length; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(out + i - distance));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    }
+}
+
+void reduce_row(const Color* pixels, std::size_t count, int shift, uint32_t* sums) {
+    // Pixels 0 and 1 of four as 16 bit lanes r0 r1 g0 g1 b0 b1 a0 a1, and
+    // their weights a0 a1 a0 a1 a0 a1 1 1. One madd then gives the weighted
+    // sums of the pair, 2 * 255 * 255 at most.
+    const __m128i low_pair = _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+    const __m128i high_pair = _mm_setr_epi8(8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1);
+    const __m128i low_weights = _mm_setr_epi8(3, -1, 7, -1, 3, -1, 7, -1, 3, -1, 7, -1, -1, -1, -1, -1);
+    const __m128i high_weights = _mm_setr_epi8(11, -1, 15, -1, 11, -1, 15, -1, 11, -1, 15, -1, -1, -1, -1, -1);
+    const __m128i alpha_weight = _mm_setr_epi16(0, 0, 0, 0, 0, 0, 1, 1);
+
+    // Whole blocks of four pixels or more, the rest starts on a block.
+    const std::size_t group = shift == 1 ? 4 : std::size_t{1} << shift;
+    const std::size_t end = count / group * group;
+    for (std::size_t i = 0; i < end; i += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+        const __m128i low = _mm_madd_epi16(
+            _mm_shuffle_epi8(v, low_pair), _mm_or_si128(_mm_shuffle_epi8(v, low_weights), alpha_weight)
+        );
+        const __m128i high = _mm_madd_epi16(
+            _mm_shuffle_epi8(v, high_pair), _mm_or_si128(_mm_shuffle_epi8(v, high_weights), alpha_weight)
+        );
+        __m128i* out = reinterpret_cast<__m128i*>(sums + 4 * (i >> shift));
+        if (shift == 1) {
+            _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), low));
+            _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), high));
+        }
+        else {
+            _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), _mm_add_epi32(low, high)));
+        }
+    }
+    scalar::reduce_row(pixels + end, count - end, shift, sums + 4 * (end >> shift));
+}
+
+/**
+ * @brief x * a / 255 rounded to nearest in 16 bit lanes, as t = x * a + 128
+ * and (t + (t >> 8)) >> 8 like the scalar build. t stays below 65536.
+*/
+static __m128i multiply_alpha(__m128i x, __m128i a) {
+    const __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+void premultiply_alpha(Color* pixels, std::size_t count) {
+    // Two pixels per half as 16 bit lanes, each channel times its alpha and
+    // alpha times 255, which leaves it as it was.
+    const __m128i low_alpha = _mm_setr_epi8(3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1);
+    const __m128i high_alpha = _mm_setr_epi8(11, -1, 11, -1, 11, -1, -1, -1, 15, -1, 15, -1, 15, -1, -1, -1);
+    const __m128i opaque = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(pixels + i);
+        const __m128i v = _mm_loadu_si128(p);
+        const __m128i low = multiply_alpha(_mm_unpacklo_epi8(v, zero), _mm_or_si128(_mm_shuffle_epi8(v, low_alpha), opaque));
+        const __m128i high = multiply_alpha(_mm_unpackhi_epi8(v, zero), _mm_or_si128(_mm_shuffle_epi8(v, high_alpha), opaque));
+        _mm_storeu_si128(p, _mm_packus_epi16(low, high));
+    }
+    scalar::premultiply_alpha(pixels + i, count - i);
+}
+
+void widen_to_float(const Color* pixels, std::size_t count, bool premultiply, unsigned char* out) {
+    // The same two multiplies in the same order as the scalar build, so the
+    // results are identical.
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (std::size_t i = 0; i < count; i++, out += 16) {
+        int32_t word;
+        std::memcpy(&word, pixels + i, 4);
+        const __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(word))), scale);
+        // alpha in every lane but the last, which keeps 1
+        const __m128 m = premultiply ? _mm_blend_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), one, 8) : one;
+        _mm_storeu_ps(reinterpret_cast<float*>(out), _mm_mul_ps(v, m));
+    }
+}
+
+/**
+ * @brief the fast_log2() of the scalar build, four lanes at a time.
+*/
+static __m128 log2_ps(__m128 x) {
+    const __m128i bits = _mm_castps_si128(x);
+    const __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    const __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 y = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    const __m128 y2 = _mm_mul_ps(y, y);
+    __m128 series = _mm_add_ps(_mm_set1_ps(1.0f / 5.0f), _mm_mul_ps(y2, _mm_set1_ps(1.0f / 7.0f)));
+    series = _mm_add_ps(_mm_set1_ps(1.0f / 3.0f), _mm_mul_ps(y2, series));
+    series = _mm_mul_ps(y, _mm_add_ps(one, _mm_mul_ps(y2, series)));
+    return _mm_add_ps(exponent, _mm_mul_ps(_mm_set1_ps(2.88539008f), series));
+}
+
+/**
+ * @brief the fast_exp2() of the scalar build, four lanes at a time.
+*/
+static __m128 exp2_ps(__m128 x) {
+    x = _mm_max_ps(x, _mm_set1_ps(-126.0f));
+    // Truncated, then one less for negative x as the scalar build does. The
+    // compare gives -1 in those lanes.
+    const __m128i whole = _mm_add_epi32(_mm_cvttps_epi32(x), _mm_castps_si128(_mm_cmplt_ps(x, _mm_setzero_ps())));
+    const __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(whole));
+    __m128 p = _mm_add_ps(_mm_set1_ps(0.00133335581f), _mm_mul_ps(f, _mm_set1_ps(0.000154035304f)));
+    p = _mm_add_ps(_mm_set1_ps(0.00961812911f), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(0.0555041087f), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(0.240226507f), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(0.693147181f), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, p));
+    const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(whole, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(p, scale);
+}
+
+static __m128 pow_ps(__m128 x, __m128 y) {
+    return _mm_andnot_ps(_mm_cmple_ps(x, _mm_setzero_ps()), exp2_ps(_mm_mul_ps(y, log2_ps(x))));
+}
+
+void transfer_16(const uint16_t* samples, std::size_t count, bool source_is_srgb, float source_exponent, bool linear_output, unsigned char* out) {
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i wide = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples + i)));
+        const __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(1.0f / 65535.0f));
+        __m128 linear;
+        if (source_is_srgb) {
+            const __m128 curve = pow_ps(_mm_mul_ps(_mm_add_ps(x, _mm_set1_ps(0.055f)), _mm_set1_ps(1.0f / 1.055f)), _mm_set1_ps(2.4f));
+            linear = _mm_blendv_ps(curve, _mm_mul_ps(x, _mm_set1_ps(1.0f / 12.92f)), _mm_cmple_ps(x, _mm_set1_ps(0.04045f)));
+        }
+        else {
+            linear = pow_ps(x, _mm_set1_ps(source_exponent));
+        }
+        __m128 value = linear;
+        if (!linear_output) {
+            const __m128 curve = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(1.055f), pow_ps(linear, _mm_set1_ps(1.0f / 2.4f))), _mm_set1_ps(0.055f));
+            value = _mm_blendv_ps(curve, _mm_mul_ps(linear, _mm_set1_ps(12.92f)), _mm_cmple_ps(linear, _mm_set1_ps(0.0031308f)));
+        }
+        const __m128 scaled = _mm_min_ps(_mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)), _mm_set1_ps(255.0f));
+        const __m128i words = _mm_packus_epi32(_mm_cvttps_epi32(scaled), _mm_setzero_si128());
+        const int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        std::memcpy(out + i, &bytes, 4);
+    }
+    scalar::transfer_16(samples + i, count - i, source_is_srgb, source_exponent, linear_output, out + i);
+}
+
+} // namespace kernel_builds::sse4
+
+#endif
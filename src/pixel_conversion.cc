@@ -0,0 +1,247 @@
+#include "pixel_conversion.h"
+#include "cpu_dispatch.h"
+
+#include <algorithm>
+
+ColorTables color_tables(const Png& png, TransferFunction transfer) {
+    ColorTables tables{};
+    for (auto& entry : tables.palette) {
+        entry = Color{0, 0, 0, 255};
+    }
+    const unsigned char color_type = png.get_header().color_type;
+    if (const Chunk* plte = png.find_chunk("PLTE")) {
+        const unsigned char* data = png.get_chunk_data(*plte);
+        const std::size_t entries = std::min<std::size_t>(plte->length / 3, 256);
+        for (std::size_t i = 0; i < entries; i++) {
+            tables.palette[i] = Color{data[3 * i], data[3 * i + 1], data[3 * i + 2], 255};
+        }
+    }
+    if (const Chunk* trns = png.find_chunk("tRNS")) {
+        const unsigned char* data = png.get_chunk_data(*trns);
+        if (color_type == 3) {
+            const std::size_t entries = std::min<std::size_t>(trns->length, 256);
+            for (std::size_t i = 0; i < entries; i++) {
+                tables.palette[i].a = data[i];
+            }
+        }
+        else if (color_type == 0 && trns->length >= 2) {
+            tables.has_transparent_key = true;
+            tables.transparent_key[0] = static_cast<uint16_t>(data[0] << 8 | data[1]);
+        }
+        else if (color_type == 2 && trns->length >= 6) {
+            tables.has_transparent_key = true;
+            for (int i = 0; i < 3; i++) {
+                tables.transparent_key[i] = static_cast<uint16_t>(data[2 * i] << 8 | data[2 * i + 1]);
+            }
+        }
+    }
+    tables.curve = make_transfer_curve(read_color_info(png), transfer);
+    if (tables.curve.active) {
+        for (auto& entry : tables.palette) {
+            entry.r = transfer_8(tables.curve, entry.r);
+            entry.g = transfer_8(tables.curve, entry.g);
+            entry.b = transfer_8(tables.curve, entry.b);
+        }
+    }
+    return tables;
+}
+
+/**
+ * @brief sample number index of a row packed with bit_depth bits per sample,
+ * bit depths below 8 pack the leftmost sample into the high bits.
+*/
+static unsigned packed_sample(const unsigned char* row, std::size_t index, int bit_depth) {
+    const std::size_t bit = index * bit_depth;
+    return (row[bit / 8] >> (8 - bit_depth - bit % 8)) & ((1u << bit_depth) - 1);
+}
+
+static uint16_t sample_16(const unsigned char* row, std::size_t index) {
+    return static_cast<uint16_t>(row[2 * index] << 8 | row[2 * index + 1]);
+}
+
+/**
+ * @brief an 8 bit sample, or a sample scaled up to 8 bits, after the
+ * transfer curve if there is one.
+*/
+template <bool transform>
+static unsigned char color_8(const ColorTables& tables, unsigned char sample) {
+    if constexpr (transform) {
+        return transfer_8(tables.curve, sample);
+    }
+    return sample;
+}
+
+static unsigned char color_16(uint16_t sample) {
+    return static_cast<unsigned char>(sample >> 8);
+}
+
+/**
+ * @brief convert_pixels() for 16 bit samples and an active curve. The
+ * colour samples of a batch of pixels are gathered first and taken
+ * through the curve in one pass, which vectorizes where a call per sample
+ * inside the loop over pixels would not.
+*/
+static void convert_pixels_16(
+    const unsigned char* row,
+    const IHDR& header,
+    const ColorTables& tables,
+    std::size_t first,
+    std::size_t count,
+    Color* out
+) {
+    const bool grey = header.color_type == 0 || header.color_type == 4;
+    const bool has_alpha = header.color_type == 4 || header.color_type == 6;
+    const std::size_t colors = grey ? 1 : 3;
+    const std::size_t channels = colors + (has_alpha ? 1 : 0);
+    const uint16_t* k = tables.transparent_key;
+    constexpr std::size_t batch = 64;
+    uint16_t samples[3 * batch];
+    unsigned char mapped[3 * batch];
+    for (std::size_t start = 0; start < count; start += batch) {
+        const std::size_t n = std::min(batch, count - start);
+        for (std::size_t i = 0; i < n; i++) {
+            for (std::size_t c = 0; c < colors; c++) {
+                samples[colors * i + c] = sample_16(row, channels * (first + start + i) + c);
+            }
+        }
+        transfer_16(tables.curve, samples, colors * n, mapped);
+        for (std::size_t i = 0; i < n; i++, out++) {
+            const uint16_t* s = samples + colors * i;
+            const unsigned char* m = mapped + colors * i;
+            unsigned char a = 255;
+            if (has_alpha) {
+                a = row[2 * (channels * (first + start + i) + colors)];
+            }
+            else if (tables.has_transparent_key && s[0] == k[0] && (grey || (s[1] == k[1] && s[2] == k[2]))) {
+                a = 0;
+            }
+            *out = grey ? Color{m[0], m[0], m[0], a} : Color{m[0], m[1], m[2], a};
+        }
+    }
+}
+
+template <bool transform>
+static void convert_pixels(
+    const unsigned char* row,
+    const IHDR& header,
+    const ColorTables& tables,
+    std::size_t first,
+    std::size_t count,
+    Color* out
+) {
+    const int d = header.bit_depth;
+    const bool key = tables.has_transparent_key;
+    const uint16_t* k = tables.transparent_key;
+    if constexpr (transform) {
+        if (d == 16) {
+            convert_pixels_16(row, header, tables, first, count, out);
+            return;
+        }
+    }
+    switch (header.color_type) {
+        case 0:
+            if (d == 16) {
+                for (std::size_t i = 0; i < count; i++, out++) {
+                    const uint16_t v = sample_16(row, first + i);
+                    const unsigned char g = color_16(v);
+                    *out = Color{g, g, g, static_cast<unsigned char>(key && v == k[0] ? 0 : 255)};
+                }
+            }
+            else {
+                const unsigned scale = 255 / ((1u << d) - 1);
+                for (std::size_t i = 0; i < count; i++, out++) {
+                    const unsigned v = packed_sample(row, first + i, d);
+                    const unsigned char g = color_8<transform>(tables, static_cast<unsigned char>(v * scale));
+                    *out = Color{g, g, g, static_cast<unsigned char>(key && v == k[0] ? 0 : 255)};
+                }
+            }
+            break;
+        case 2:
+            if (d == 16) {
+                for (std::size_t i = 0; i < count; i++, out++) {
+                    const std::size_t s = 3 * (first + i);
+                    const uint16_t r = sample_16(row, s), g = sample_16(row, s + 1), b = sample_16(row, s + 2);
+                    const bool transparent = key && r == k[0] && g == k[1] && b == k[2];
+                    *out = Color{
+                        color_16(r),
+                        color_16(g),
+                        color_16(b),
+                        static_cast<unsigned char>(transparent ? 0 : 255)
+                    };
+                }
+            }
+            else {
+                for (std::size_t i = 0; i < count; i++, out++) {
+                    const unsigned char* p = row + 3 * (first + i);
+                    const bool transparent = key && p[0] == k[0] && p[1] == k[1] && p[2] == k[2];
+                    *out = Color{
+                        color_8<transform>(tables, p[0]),
+                        color_8<transform>(tables, p[1]),
+                        color_8<transform>(tables, p[2]),
+                        static_cast<unsigned char>(transparent ? 0 : 255)
+                    };
+                }
+            }
+            break;
+        case 3:
+            if (d == 8) {
+                kernels().expand_palette(row + first, count, tables.palette, out);
+                break;
+            }
+            for (std::size_t i = 0; i < count; i++, out++) {
+                *out = tables.palette[packed_sample(row, first + i, d)];
+            }
+            break;
+        case 4:
+            for (std::size_t i = 0; i < count; i++, out++) {
+                if (d == 16) {
+                    const unsigned char g = color_16(sample_16(row, 2 * (first + i)));
+                    *out = Color{g, g, g, row[4 * (first + i) + 2]};
+                }
+                else {
+                    const unsigned char* p = row + 2 * (first + i);
+                    const unsigned char g = color_8<transform>(tables, p[0]);
+                    *out = Color{g, g, g, p[1]};
+                }
+            }
+            break;
+        case 6:
+            for (std::size_t i = 0; i < count; i++, out++) {
+                if (d == 16) {
+                    const std::size_t s = 4 * (first + i);
+                    *out = Color{
+                        color_16(sample_16(row, s)),
+                        color_16(sample_16(row, s + 1)),
+                        color_16(sample_16(row, s + 2)),
+                        row[2 * (s + 3)]
+                    };
+                }
+                else {
+                    const unsigned char* p = row + 4 * (first + i);
+                    *out = Color{
+                        color_8<transform>(tables, p[0]),
+                        color_8<transform>(tables, p[1]),
+                        color_8<transform>(tables, p[2]),
+                        p[3]
+                    };
+                }
+            }
+            break;
+    }
+}
+
+void convert_pixels(
+    const unsigned char* row,
+    const IHDR& header,
+    const ColorTables& tables,
+    std::size_t first,
+    std::size_t count,
+    Color* out
+) {
+    if (tables.curve.active) {
+        convert_pixels<true>(row, header, tables, first, count, out);
+    }
+    else {
+        convert_pixels<false>(row, header, tables, first, count, out);
+    }
+}
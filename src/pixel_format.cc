@@ -0,0 +1,116 @@
+#include "pixel_format.h"
+#include "cpu_dispatch.h"
+
+#include <algorithm>
+#include <cstring>
+
+static_assert(sizeof(Color) == 4, "Color is stored as four bytes in interleaved 8 bit formats");
+
+std::size_t bytes_per_sample(const PixelFormat& format) {
+    return format.sample_type == SampleType::F32 ? sizeof(float) : 1;
+}
+
+std::size_t bytes_per_image(const PixelFormat& format, uint32_t width, uint32_t height) {
+    return static_cast<std::size_t>(width) * height * 4 * bytes_per_sample(format);
+}
+
+void premultiply_alpha(Color* pixels, std::size_t count) {
+    kernels().premultiply_alpha(pixels, count);
+}
+
+void swizzle_rgba_to_bgra(const Color* pixels, std::size_t count, unsigned char* out, std::size_t out_step) {
+    if (out_step == 1) {
+        kernels().swizzle_rgba_to_bgra(pixels, count, out);
+        return;
+    }
+    for (std::size_t i = 0; i < count; i++, out += 4 * out_step) {
+        out[0] = pixels[i].b;
+        out[1] = pixels[i].g;
+        out[2] = pixels[i].r;
+        out[3] = pixels[i].a;
+    }
+}
+
+static void store_float(
+    const Color* pixels,
+    std::size_t count,
+    const PixelFormat& format,
+    unsigned char* data,
+    std::size_t plane_size,
+    std::size_t first,
+    std::size_t x_step
+) {
+    const WidenToFloatKernel widen = kernels().widen_to_float;
+    const bool bgra = format.order == ChannelOrder::BGRA;
+    if (!format.planar && !bgra && x_step == 1) {
+        widen(pixels, count, format.premultiplied, data + first * 4 * sizeof(float));
+        return;
+    }
+    // Otherwise widen a batch at a time and scatter the samples from there.
+    constexpr std::size_t batch = 64;
+    float values[batch * 4];
+    // Offsets of R, G, B and A counted in samples
+    const std::size_t channel_offset[4] = {
+        bgra ? 2u : 0u, 1u, bgra ? 0u : 2u, 3u
+    };
+    const std::size_t channel_stride = format.planar ? plane_size : 1;
+    const std::size_t pixel_stride = format.planar ? 1 : 4;
+    for (std::size_t start = 0; start < count; start += batch) {
+        const std::size_t n = std::min(batch, count - start);
+        widen(pixels + start, n, format.premultiplied, reinterpret_cast<unsigned char*>(values));
+        for (std::size_t i = 0; i < n; i++) {
+            const std::size_t p = (first + (start + i) * x_step) * pixel_stride;
+            for (int c = 0; c < 4; c++) {
+                std::memcpy(data + (p + channel_offset[c] * channel_stride) * sizeof(float), &values[4 * i + c], sizeof(float));
+            }
+        }
+    }
+}
+
+void store_pixels(
+    Color* pixels,
+    std::size_t count,
+    const PixelFormat& format,
+    unsigned char* data,
+    uint32_t width,
+    uint32_t height,
+    std::size_t x,
+    std::size_t y,
+    std::size_t x_step
+) {
+    const std::size_t first = y * width + x;
+    if (format.sample_type == SampleType::F32) {
+        store_float(pixels, count, format, data, static_cast<std::size_t>(width) * height, first, x_step);
+        return;
+    }
+    if (format.premultiplied) {
+        premultiply_alpha(pixels, count);
+    }
+    if (format.planar) {
+        const std::size_t plane_size = static_cast<std::size_t>(width) * height;
+        const bool bgra = format.order == ChannelOrder::BGRA;
+        unsigned char* r = data + (bgra ? 2 : 0) * plane_size + first;
+        unsigned char* g = data + plane_size + first;
+        unsigned char* b = data + (bgra ? 0 : 2) * plane_size + first;
+        unsigned char* a = data + 3 * plane_size + first;
+        for (std::size_t i = 0; i < count; i++) {
+            r[i * x_step] = pixels[i].r;
+            g[i * x_step] = pixels[i].g;
+            b[i * x_step] = pixels[i].b;
+            a[i * x_step] = pixels[i].a;
+        }
+        return;
+    }
+    unsigned char* out = data + 4 * first;
+    if (format.order == ChannelOrder::BGRA) {
+        swizzle_rgba_to_bgra(pixels, count, out, x_step);
+        return;
+    }
+    if (x_step == 1) {
+        std::memcpy(out, pixels, 4 * count);
+        return;
+    }
+    for (std::size_t i = 0; i < count; i++) {
+        std::memcpy(out + 4 * i * x_step, &pixels[i], 4);
+    }
+}
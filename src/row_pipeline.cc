@@ -0,0 +1,235 @@
+#include "row_pipeline.h"
+#include "instrumentation.h"
+#include "cpu_dispatch.h"
+
+#include <vector>
+#include <cstdlib>
+
+enum FilterType {
+    FilterNone,
+    FilterSub,
+    FilterUp,
+    FilterAverage,
+    FilterPaeth,
+};
+
+int channels_for_color_type(unsigned char color_type) {
+    switch (color_type) {
+        case 0: return 1; // greyscale
+        case 2: return 3; // truecolour
+        case 3: return 1; // indexed
+        case 4: return 2; // greyscale with alpha
+        case 6: return 4; // truecolour with alpha
+    }
+    return 0;
+}
+
+bool is_supported_header(const IHDR& header) {
+    if (header.width == 0 || header.height == 0) {
+        return false;
+    }
+    if (header.compression_method != 0 || header.filter_method != 0 || header.interlace_method > 1) {
+        return false;
+    }
+    const int d = header.bit_depth;
+    switch (header.color_type) {
+        case 0: return d == 1 || d == 2 || d == 4 || d == 8 || d == 16;
+        case 3: return d == 1 || d == 2 || d == 4 || d == 8;
+        case 2:
+        case 4:
+        case 6: return d == 8 || d == 16;
+    }
+    return false;
+}
+
+int bits_per_pixel(const IHDR& header) {
+    return channels_for_color_type(header.color_type) * header.bit_depth;
+}
+
+std::size_t bytes_per_row(uint32_t width, int bits_per_pixel) {
+    return (static_cast<std::size_t>(width) * bits_per_pixel + 7) / 8;
+}
+
+uint32_t pass_width(const IHDR& header, int pass) {
+    const Adam7Pass& p = adam7_passes[pass];
+    if (header.width <= p.x_start) {
+        return 0;
+    }
+    return (header.width - p.x_start + p.x_step - 1) / p.x_step;
+}
+
+uint32_t pass_height(const IHDR& header, int pass) {
+    const Adam7Pass& p = adam7_passes[pass];
+    if (header.height <= p.y_start) {
+        return 0;
+    }
+    return (header.height - p.y_start + p.y_step - 1) / p.y_step;
+}
+
+int last_pass(const IHDR& header) {
+    if (!header.interlace_method) {
+        return 0;
+    }
+    for (int pass = 7; pass > 1; pass--) {
+        if (pass_width(header, pass) && pass_height(header, pass)) {
+            return pass;
+        }
+    }
+    return 1;
+}
+
+bool unfilter_row(
+    unsigned char filter_type,
+    unsigned char* row,
+    const unsigned char* previous_row,
+    std::size_t row_bytes,
+    std::size_t bytes_per_pixel
+) {
+    const Kernels& k = kernels();
+    switch (filter_type) {
+        case FilterNone:
+            break;
+        case FilterSub:
+            k.unfilter_sub(row, previous_row, row_bytes, bytes_per_pixel);
+            break;
+        case FilterUp:
+            k.unfilter_up(row, previous_row, row_bytes, bytes_per_pixel);
+            break;
+        case FilterAverage:
+            k.unfilter_average(row, previous_row, row_bytes, bytes_per_pixel);
+            break;
+        case FilterPaeth:
+            k.unfilter_paeth(row, previous_row, row_bytes, bytes_per_pixel);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+bool is_error(PipelineStatus status) {
+    return status != PipelineStatus::Done && status != PipelineStatus::Stopped;
+}
+
+PipelineStatus run_row_pipeline(
+    const IHDR& header,
+    const deflate::ByteSource& compressed,
+    const RowHandler& on_row,
+    std::pmr::memory_resource* resource
+) {
+    const int bits = bits_per_pixel(header);
+    const std::size_t filter_bpp = std::max(1, bits / 8);
+    const int first_pass = header.interlace_method ? 1 : 0;
+    const int final_pass = last_pass(header);
+
+    std::size_t max_row_bytes = 0;
+    for (int p = first_pass; p <= final_pass; p++) {
+        max_row_bytes = std::max(max_row_bytes, bytes_per_row(pass_width(header, p), bits));
+    }
+    std::pmr::vector<unsigned char> current(1 + max_row_bytes, resource);
+    std::pmr::vector<unsigned char> previous(1 + max_row_bytes, resource);
+
+    int pass = first_pass;
+    uint32_t row_in_pass = 0;
+    std::size_t row_bytes = 0;
+    std::size_t filled = 0;
+    bool finished = false;
+    PipelineStatus status = PipelineStatus::Done;
+    instrumentation::Counters counters{};
+
+    const auto start_pass = [&]() {
+        while (pass <= final_pass && (pass_width(header, pass) == 0 || pass_height(header, pass) == 0)) {
+            pass++;
+        }
+        if (pass > final_pass) {
+            finished = true;
+            return;
+        }
+        row_in_pass = 0;
+        row_bytes = bytes_per_row(pass_width(header, pass), bits);
+        std::fill(previous.begin(), previous.end(), 0);
+    };
+    start_pass();
+
+    const deflate::ByteSink sink = [&](const unsigned char* bytes, std::size_t size) {
+        while (size && !finished) {
+            const std::size_t n = std::min(size, 1 + row_bytes - filled);
+            std::copy(bytes, bytes + n, current.begin() + filled);
+            filled += n;
+            bytes += n;
+            size -= n;
+            if (filled < 1 + row_bytes) {
+                break;
+            }
+            filled = 0;
+            counters.rows++;
+            bool known_filter;
+            {
+                instrumentation::StageTimer timer{counters, instrumentation::Stage::Unfilter};
+                known_filter = unfilter_row(current[0], current.data() + 1, previous.data() + 1, row_bytes, filter_bpp);
+            }
+            if (!known_filter) {
+                BITMAP_TRACE("row %u of pass %d: unknown filter type %d", row_in_pass, pass, current[0]);
+                status = PipelineStatus::BadFilterType;
+                return false;
+            }
+            bool keep_going;
+            {
+                instrumentation::StageTimer timer{counters, instrumentation::Stage::Convert};
+                keep_going = on_row(pass, row_in_pass, current.data() + 1);
+            }
+            if (!keep_going) {
+                status = PipelineStatus::Stopped;
+                return false;
+            }
+            std::swap(current, previous);
+            if (++row_in_pass == pass_height(header, pass)) {
+                pass++;
+                start_pass();
+            }
+        }
+        // Anything after the last scanline is ignored, but inflate goes on
+        // to the end of the stream so that its Adler-32 gets checked.
+        return true;
+    };
+    deflate::Status inflated;
+    {
+        instrumentation::StageTimer timer{counters, instrumentation::Stage::Inflate};
+        inflated = deflate::inflate_zlib(compressed, sink, resource);
+    }
+    // The inflate timer ran around the other two stages as well. If timing
+    // was switched on during the decode, the inner timers ran while the
+    // inflate one did not, and there is nothing to take them out of.
+    uint64_t& inflate_time = counters.stage_nanoseconds[static_cast<std::size_t>(instrumentation::Stage::Inflate)];
+    const uint64_t inner_time =
+        counters.stage_nanoseconds[static_cast<std::size_t>(instrumentation::Stage::Unfilter)] +
+        counters.stage_nanoseconds[static_cast<std::size_t>(instrumentation::Stage::Convert)];
+    inflate_time = inflate_time > inner_time ? inflate_time - inner_time : 0;
+    instrumentation::publish(counters);
+    if (status != PipelineStatus::Done) {
+        return status;
+    }
+    if (finished) {
+        // Every row is out, a bad checksum or a stream that ends before it
+        // still means the data is damaged.
+        return inflated == deflate::Status::Done ? PipelineStatus::Done : PipelineStatus::BadStream;
+    }
+    if (inflated == deflate::Status::Done || inflated == deflate::Status::InputEnded) {
+        return PipelineStatus::Truncated;
+    }
+    return PipelineStatus::BadStream;
+}
+
+deflate::ByteSource IDAT_source(const Png& png) {
+    std::size_t next_IDAT = 0;
+    return [&png, next_IDAT](const unsigned char*& bytes, std::size_t& size) mutable {
+        const std::pmr::vector<int>& indexes = png.get_IDAT_chunk_indexes();
+        if (next_IDAT == indexes.size()) {
+            return false;
+        }
+        const Chunk& chunk = png.get_chunks()[indexes[next_IDAT++]];
+        bytes = png.get_chunk_data(chunk);
+        size = chunk.length;
+        return true;
+    };
+}
@@ -1,13 +1,1454 @@
 #include <iostream>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <sstream>
 
 #include "test_images.h"
 #include "Png.h"
+#include "BatchLoader.h"
+#include "decode.h"
+#include "ApngDecoder.h"
+#include "DecoderContext.h"
+#include "DecodeCache.h"
+#include "instrumentation.h"
+#include "validate.h"
+#include "MappedImage.h"
+#include "cpu_dispatch.h"
+#include "kernels.h"
+#include "pixel_format.h"
+#include "color_management.h"
+#include "deflate.h"
+
+static int failures = 0;
+
+/**
+ * @brief reports a failed check, the checks after it still run.
+*/
+static void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+static std::vector<unsigned char> read_file(const std::string& path) {
+    std::ifstream file{path, std::ios::in | std::ios::binary};
+    return std::vector<unsigned char>{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+/**
+ * Every file comes back in list order holding the bytes on disk, through
+ * io_uring where the kernel has it as well as through the pread pool.
+*/
+static void test_batch_loader(const std::vector<std::string>& files) {
+    std::vector<std::string> paths = files;
+    // An empty file reads as zero bytes, a directory and a missing file fail.
+    const std::string empty_path = "/tmp/bitmap_batch_loader_empty_" + std::to_string(getpid());
+    std::ofstream{empty_path};
+    paths.push_back(empty_path);
+    paths.push_back("test_images");
+    paths.push_back("test_images/does_not_exist.png");
+    for (bool allow_io_uring : {true, false}) {
+        const std::string name = allow_io_uring ? "BatchLoader: " : "BatchLoader (pread): ";
+        BatchLoader loader{paths, 4, 2, allow_io_uring};
+        check(allow_io_uring || !loader.using_io_uring(), name + "io_uring used although not allowed");
+        LoadedFile file;
+        std::size_t i = 0;
+        while (loader.next(file)) {
+            check(i < paths.size() && file.path == paths[i], name + "file out of order " + file.path);
+            if (i + 2 >= paths.size()) {
+                check(!file.success, name + "directory or missing file reported as read");
+            }
+            else if (file.path == empty_path) {
+                check(file.success && file.data.empty(), name + "empty file not read as empty");
+            }
+            else {
+                const std::vector<unsigned char> on_disk = read_file(paths[i]);
+                check(
+                    file.success && file.data.size() == on_disk.size() &&
+                    std::memcmp(file.data.data(), on_disk.data(), on_disk.size()) == 0,
+                    name + "bytes differ from the file " + file.path
+                );
+                const Png from_path{file.path};
+                const Png from_bytes{file.path, std::move(file.data)};
+                check(
+                    from_path.is_parsed() == from_bytes.is_parsed() &&
+                    from_path.get_chunks().size() == from_bytes.get_chunks().size(),
+                    name + "parses differently from the file " + file.path
+                );
+            }
+            i++;
+        }
+        check(i == paths.size(), name + "not every file was handed out");
+    }
+    std::remove(empty_path.c_str());
+}
+
+struct ReferenceDecode {
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+    // CRC-32 of the rgba8 pixels, from an independent decoder
+    uint32_t crc;
+};
+
+static const ReferenceDecode reference_decodes[] = {
+    {"basi0g01.png", 32, 32, 0x0da28714},
+    {"basi0g02.png", 32, 32, 0x2e3fe285},
+    {"basi0g04.png", 32, 32, 0x8d0f641b},
+    {"basi0g08.png", 32, 32, 0xc395683c},
+    {"basi0g16.png", 32, 32, 0x8b47d810},
+    {"basi2c08.png", 32, 32, 0x2fb54036},
+    {"basi2c16.png", 32, 32, 0xf3bb75e6},
+    {"basi3p01.png", 32, 32, 0x4d8431a4},
+    {"basi3p02.png", 32, 32, 0xe4dbb6bc},
+    {"basi3p04.png", 32, 32, 0x671f880f},
+    {"basi3p08.png", 32, 32, 0x39528682},
+    {"basi4a08.png", 32, 32, 0x905d5b60},
+    {"basi4a16.png", 32, 32, 0x9c7c3556},
+    {"basi6a08.png", 32, 32, 0xa74df32c},
+    {"basi6a16.png", 32, 32, 0x285be560},
+    {"basn0g01.png", 32, 32, 0x0da28714},
+    {"basn0g02.png", 32, 32, 0x2e3fe285},
+    {"basn0g04.png", 32, 32, 0x8d0f641b},
+    {"basn0g08.png", 32, 32, 0xc395683c},
+    {"basn0g16.png", 32, 32, 0x8b47d810},
+    {"basn2c08.png", 32, 32, 0x2fb54036},
+    {"basn2c16.png", 32, 32, 0xf3bb75e6},
+    {"basn3p01.png", 32, 32, 0x4d8431a4},
+    {"basn3p02.png", 32, 32, 0xe4dbb6bc},
+    {"basn3p04.png", 32, 32, 0x671f880f},
+    {"basn3p08.png", 32, 32, 0x39528682},
+    {"basn4a08.png", 32, 32, 0x905d5b60},
+    {"basn4a16.png", 32, 32, 0x9c7c3556},
+    {"basn6a08.png", 32, 32, 0xa74df32c},
+    {"basn6a16.png", 32, 32, 0x285be560},
+    {"bgai4a08.png", 32, 32, 0x905d5b60},
+    {"bgai4a16.png", 32, 32, 0x9c7c3556},
+    {"bgan6a08.png", 32, 32, 0xa74df32c},
+    {"bgan6a16.png", 32, 32, 0x285be560},
+    {"bgbn4a08.png", 32, 32, 0x905d5b60},
+    {"bggn4a16.png", 32, 32, 0x9c7c3556},
+    {"bgwn6a08.png", 32, 32, 0xa74df32c},
+    {"bgyn6a16.png", 32, 32, 0x285be560},
+    {"ccwn2c08.png", 32, 32, 0x40a6a67c},
+    {"ccwn3p08.png", 32, 32, 0x9192bfaa},
+    {"cdfn2c08.png", 8, 32, 0x2af2ddf8},
+    {"cdhn2c08.png", 32, 8, 0x23cb0319},
+    {"cdsn2c08.png", 8, 8, 0xd81f3e6b},
+    {"cdun2c08.png", 32, 32, 0x878a46a3},
+    {"ch1n3p04.png", 32, 32, 0x671f880f},
+    {"ch2n3p08.png", 32, 32, 0x39528682},
+    {"cm0n0g04.png", 32, 32, 0xb743ec84},
+    {"cm7n0g04.png", 32, 32, 0xb743ec84},
+    {"cm9n0g04.png", 32, 32, 0xb743ec84},
+    {"cs3n2c16.png", 32, 32, 0x0a0758b6},
+    {"cs3n3p08.png", 32, 32, 0xe1ccec94},
+    {"cs5n2c08.png", 32, 32, 0x8423bc98},
+    {"cs5n3p08.png", 32, 32, 0x8423bc98},
+    {"cs8n2c08.png", 32, 32, 0x0a0758b6},
+    {"cs8n3p08.png", 32, 32, 0x0a0758b6},
+    {"ct0n0g04.png", 32, 32, 0xb743ec84},
+    {"ct1n0g04.png", 32, 32, 0xb743ec84},
+    {"cten0g04.png", 32, 32, 0x77c3d4de},
+    {"ctfn0g04.png", 32, 32, 0xfb03c836},
+    {"ctgn0g04.png", 32, 32, 0x1495e441},
+    {"cthn0g04.png", 32, 32, 0x6b22f4da},
+    {"ctjn0g04.png", 32, 32, 0x7ac255fd},
+    {"ctzn0g04.png", 32, 32, 0xb743ec84},
+    {"exif2c08.png", 32, 32, 0x80d91236},
+    {"f00n0g08.png", 32, 32, 0x0b907dec},
+    {"f00n2c08.png", 32, 32, 0x9ad4b08b},
+    {"f01n0g08.png", 32, 32, 0x2119c97f},
+    {"f01n2c08.png", 32, 32, 0xe31d06f2},
+    {"f02n0g08.png", 32, 32, 0xc03634d7},
+    {"f02n2c08.png", 32, 32, 0xba0d4b27},
+    {"f03n0g08.png", 32, 32, 0x3a9c7b91},
+    {"f03n2c08.png", 32, 32, 0x6d296175},
+    {"f04n0g08.png", 32, 32, 0x28fca0b1},
+    {"f04n2c08.png", 32, 32, 0xc5c4baad},
+    {"f99n0g04.png", 32, 32, 0xf8617313},
+    {"g03n0g16.png", 32, 32, 0x7c364c58},
+    {"g03n2c08.png", 32, 32, 0xf6882c1f},
+    {"g03n3p04.png", 32, 32, 0x13427f49},
+    {"g04n0g16.png", 32, 32, 0x71d8adfd},
+    {"g04n2c08.png", 32, 32, 0x92bcece3},
+    {"g04n3p04.png", 32, 32, 0x8441c56f},
+    {"g05n0g16.png", 32, 32, 0xf968c4a8},
+    {"g05n2c08.png", 32, 32, 0x754dcc75},
+    {"g05n3p04.png", 32, 32, 0x2788ce48},
+    {"g07n0g16.png", 32, 32, 0x3bd60fba},
+    {"g07n2c08.png", 32, 32, 0x304cc4f1},
+    {"g07n3p04.png", 32, 32, 0x3977f102},
+    {"g10n0g16.png", 32, 32, 0xa360b8f0},
+    {"g10n2c08.png", 32, 32, 0x6df63c8c},
+    {"g10n3p04.png", 32, 32, 0x810df60d},
+    {"g25n0g16.png", 32, 32, 0x1197ce63},
+    {"g25n2c08.png", 32, 32, 0xf3f12041},
+    {"g25n3p04.png", 32, 32, 0xfb71efa9},
+    {"oi1n0g16.png", 32, 32, 0x8b47d810},
+    {"oi1n2c16.png", 32, 32, 0xf3bb75e6},
+    {"oi2n0g16.png", 32, 32, 0x8b47d810},
+    {"oi2n2c16.png", 32, 32, 0xf3bb75e6},
+    {"oi4n0g16.png", 32, 32, 0x8b47d810},
+    {"oi4n2c16.png", 32, 32, 0xf3bb75e6},
+    {"oi9n0g16.png", 32, 32, 0x8b47d810},
+    {"oi9n2c16.png", 32, 32, 0xf3bb75e6},
+    {"pp0n2c16.png", 32, 32, 0xf3bb75e6},
+    {"pp0n6a08.png", 32, 32, 0x0ee05c61},
+    {"ps1n0g08.png", 32, 32, 0xc395683c},
+    {"ps1n2c16.png", 32, 32, 0xf3bb75e6},
+    {"ps2n0g08.png", 32, 32, 0xc395683c},
+    {"ps2n2c16.png", 32, 32, 0xf3bb75e6},
+    {"s01i3p01.png", 1, 1, 0x9f62cde3},
+    {"s01n3p01.png", 1, 1, 0x9f62cde3},
+    {"s02i3p01.png", 2, 2, 0xfc958ebf},
+    {"s02n3p01.png", 2, 2, 0xfc958ebf},
+    {"s03i3p01.png", 3, 3, 0xf53615d1},
+    {"s03n3p01.png", 3, 3, 0xf53615d1},
+    {"s04i3p01.png", 4, 4, 0xce2b2aa8},
+    {"s04n3p01.png", 4, 4, 0xce2b2aa8},
+    {"s05i3p02.png", 5, 5, 0x71f99a5f},
+    {"s05n3p02.png", 5, 5, 0x71f99a5f},
+    {"s06i3p02.png", 6, 6, 0x1707ae6e},
+    {"s06n3p02.png", 6, 6, 0x1707ae6e},
+    {"s07i3p02.png", 7, 7, 0xf3a27b20},
+    {"s07n3p02.png", 7, 7, 0xf3a27b20},
+    {"s08i3p02.png", 8, 8, 0x2eb65a34},
+    {"s08n3p02.png", 8, 8, 0x2eb65a34},
+    {"s09i3p02.png", 9, 9, 0x44d29bb4},
+    {"s09n3p02.png", 9, 9, 0x44d29bb4},
+    {"s32i3p04.png", 32, 32, 0x9410d2a5},
+    {"s32n3p04.png", 32, 32, 0x9410d2a5},
+    {"s33i3p04.png", 33, 33, 0xd001d86b},
+    {"s33n3p04.png", 33, 33, 0xd001d86b},
+    {"s34i3p04.png", 34, 34, 0x17cfe1ad},
+    {"s34n3p04.png", 34, 34, 0x17cfe1ad},
+    {"s35i3p04.png", 35, 35, 0xb8c8407d},
+    {"s35n3p04.png", 35, 35, 0xb8c8407d},
+    {"s36i3p04.png", 36, 36, 0xd5aec69b},
+    {"s36n3p04.png", 36, 36, 0xd5aec69b},
+    {"s37i3p04.png", 37, 37, 0xa1563224},
+    {"s37n3p04.png", 37, 37, 0xa1563224},
+    {"s38i3p04.png", 38, 38, 0xbdaf2e8a},
+    {"s38n3p04.png", 38, 38, 0xbdaf2e8a},
+    {"s39i3p04.png", 39, 39, 0x5cb9f129},
+    {"s39n3p04.png", 39, 39, 0x5cb9f129},
+    {"s40i3p04.png", 40, 40, 0xbf29afa5},
+    {"s40n3p04.png", 40, 40, 0xbf29afa5},
+    {"tbbn0g04.png", 32, 32, 0x5c8eaf83},
+    {"tbbn2c16.png", 32, 32, 0x0370ef89},
+    {"tbbn3p08.png", 32, 32, 0x9d56cd67},
+    {"tbgn2c16.png", 32, 32, 0x0370ef89},
+    {"tbgn3p08.png", 32, 32, 0x9d56cd67},
+    {"tbrn2c08.png", 32, 32, 0x0370ef89},
+    {"tbwn0g16.png", 32, 32, 0xb24d0a34},
+    {"tbwn3p08.png", 32, 32, 0x9d56cd67},
+    {"tbyn3p08.png", 32, 32, 0x9d56cd67},
+    {"tm3n3p02.png", 32, 32, 0xe7daa7f5},
+    {"tp0n0g08.png", 32, 32, 0x57965874},
+    {"tp0n2c08.png", 32, 32, 0x679d24b4},
+    {"tp0n3p08.png", 32, 32, 0x130aa165},
+    {"tp1n3p08.png", 32, 32, 0x9d56cd67},
+    {"z00n2c08.png", 32, 32, 0x67290c15},
+    {"z03n2c08.png", 32, 32, 0x67290c15},
+    {"z06n2c08.png", 32, 32, 0x67290c15},
+    {"z09n2c08.png", 32, 32, 0x67290c15},
+};
+
+static uint32_t crc_of(const std::vector<unsigned char>& bytes) {
+    return kernels().crc32(0, bytes.data(), bytes.size());
+}
+
+/**
+ * @brief the file at path with the bytes of data replaced by patch at offset.
+*/
+static std::vector<unsigned char> patched(const std::string& path, std::size_t offset, const std::vector<unsigned char>& patch) {
+    std::vector<unsigned char> bytes = read_file(path);
+    std::copy(patch.begin(), patch.end(), bytes.begin() + offset);
+    return bytes;
+}
+
+static void test_reference_decodes() {
+    for (const auto& reference : reference_decodes) {
+        const std::string name = reference.name;
+        const Png png{"test_images/" + name};
+        const std::optional<DecodedImage> image = decode(png);
+        check(
+            image && image->width == reference.width && image->height == reference.height && crc_of(image->data) == reference.crc,
+            "decode: " + name + " differs from the reference"
+        );
+    }
+}
+
+/**
+ * Every window is the matching crop of the full decode, clipped to the image.
+*/
+static void test_decode_region() {
+    for (const char* name : {"basn6a08.png", "basi3p02.png", "basi0g16.png", "s35i3p04.png", "s01n3p01.png"}) {
+        const Png png{std::string{"test_images/"} + name};
+        const DecodedImage full = decode(png).value();
+        const uint32_t w = full.width;
+        const uint32_t h = full.height;
+        const uint32_t windows[][4] = {{0, 0, w, h}, {5, 7, 10, 3}, {w - 1, h - 1, 5, 5}, {3, 0, 1, h}, {0, h / 2, w, h}, {w, 0, 1, 1}};
+        for (const auto& window : windows) {
+            const std::optional<DecodedImage> region = decode_region(png, window[0], window[1], window[2], window[3]);
+            const uint32_t x = std::min(window[0], w);
+            const uint32_t y = std::min(window[1], h);
+            uint32_t rw = std::min(window[2], w - x);
+            uint32_t rh = std::min(window[3], h - y);
+            if (rw == 0 || rh == 0) {
+                rw = rh = 0;
+            }
+            bool same = region && region->width == rw && region->height == rh;
+            for (uint32_t row = 0; same && row < rh; row++) {
+                same = std::memcmp(
+                    &region->data[static_cast<std::size_t>(row) * rw * 4],
+                    &full.data[(static_cast<std::size_t>(y + row) * w + x) * 4],
+                    static_cast<std::size_t>(rw) * 4
+                ) == 0;
+            }
+            check(same, "decode_region: " + std::string{name} + " window at " + std::to_string(window[0]) + "," + std::to_string(window[1]));
+        }
+    }
+}
+
+/**
+ * A damaged Adler-32 fails every decode that reads to the end of the
+ * stream, a window that stops above the last row never gets to it.
+*/
+static void test_zlib_trailer() {
+    const std::string path = "test_images/basn2c08.png";
+    const Png original{path};
+    const Chunk& last_IDAT = original.get_chunks()[original.get_IDAT_chunk_indexes().back()];
+    const std::size_t checksum_end = last_IDAT.chunk_data_start + last_IDAT.length;
+    const unsigned char last_byte = original.get_chunk_data(last_IDAT)[last_IDAT.length - 1];
+    const Png damaged{path, as_png_bytes(patched(path, checksum_end - 1, {static_cast<unsigned char>(last_byte ^ 1)}))};
+    check(damaged.is_parsed(), "zlib trailer: damaged file no longer parses");
+    check(!decode(damaged), "zlib trailer: bad Adler-32 decoded");
+    check(!decode_region(damaged, 0, 16, 32, 16), "zlib trailer: bad Adler-32 decoded in a window at the bottom");
+    check(decode_region(damaged, 0, 0, 32, 16).has_value(), "zlib trailer: window above the damage failed");
+}
+
+/**
+ * A chunk name that is not four letters ends the chunk list, the chunk
+ * is not kept.
+*/
+static void test_bad_chunk_name() {
+    const std::vector<unsigned char> original = read_file("test_images/basn0g08.png");
+    const Png png{"test_images/basn0g08.png"};
+    const std::vector<unsigned char> garbage = png_chunk("ab\x01" "d", {1, 2, 3});
+    const auto with_garbage_at = [&](std::size_t offset) {
+        std::vector<unsigned char> bytes = original;
+        bytes.insert(bytes.begin() + offset, garbage.begin(), garbage.end());
+        return Png{"garbage", as_png_bytes(bytes)};
+    };
+    const auto all_names_ascii = [](const Png& p) {
+        return std::all_of(p.get_chunks().begin(), p.get_chunks().end(), [](const Chunk& chunk) {
+            return std::all_of(chunk.type, chunk.type + 4, [](unsigned char c) {
+                return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+            });
+        });
+    };
+    // Right after IHDR, before any IDAT
+    const Png early{with_garbage_at(8 + 25)};
+    check(!early.is_parsed() && all_names_ascii(early), "bad chunk name: chunks after it were kept");
+    // Right before IEND
+    const Png late{with_garbage_at(original.size() - 12)};
+    check(late.is_parsed() && all_names_ascii(late), "bad chunk name: kept in the chunk list");
+    check(decode(late).has_value() && decode(late)->data == decode(png)->data, "bad chunk name: image data lost");
+}
+
+/**
+ * @brief the thumbnail of an rgba8 image the slow way, colour averaged
+ * weighted by alpha.
+*/
+static std::vector<unsigned char> box_filter(const DecodedImage& full, int shift) {
+    const uint32_t block = 1u << shift;
+    const uint32_t width = (full.width + block - 1) >> shift;
+    const uint32_t height = (full.height + block - 1) >> shift;
+    std::vector<unsigned char> out;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t sums[4] = {};
+            uint32_t n = 0;
+            for (uint32_t v = y * block; v < std::min(full.height, (y + 1) * block); v++) {
+                for (uint32_t u = x * block; u < std::min(full.width, (x + 1) * block); u++) {
+                    const unsigned char* pixel = &full.data[(static_cast<std::size_t>(v) * full.width + u) * 4];
+                    for (int c = 0; c < 3; c++) {
+                        sums[c] += pixel[c] * pixel[3];
+                    }
+                    sums[3] += pixel[3];
+                    n++;
+                }
+            }
+            for (int c = 0; c < 3; c++) {
+                out.push_back(sums[3] ? static_cast<unsigned char>((sums[c] + sums[3] / 2) / sums[3]) : 0);
+            }
+            out.push_back(static_cast<unsigned char>((sums[3] + n / 2) / n));
+        }
+    }
+    return out;
+}
+
+static void test_thumbnails() {
+    for (const auto& reference : reference_decodes) {
+        const std::string name = reference.name;
+        const Png png{"test_images/" + name};
+        const DecodedImage full = decode(png).value();
+        for (ThumbnailScale scale : {ThumbnailScale::Half, ThumbnailScale::Quarter, ThumbnailScale::Eighth}) {
+            const int shift = static_cast<int>(scale);
+            const std::optional<DecodedImage> thumbnail = decode_thumbnail(png, scale, false);
+            check(
+                thumbnail && thumbnail->data == box_filter(full, shift),
+                "decode_thumbnail: " + name + " at 1/" + std::to_string(1 << shift)
+            );
+            if (!png.get_header().interlace_method) {
+                continue;
+            }
+            // The coarse passes, the default for interlaced images, hold the
+            // top left pixel of every block.
+            const std::optional<DecodedImage> coarse = decode_thumbnail(png, scale);
+            bool same = coarse.has_value();
+            for (uint32_t y = 0; same && y < coarse->height; y++) {
+                for (uint32_t x = 0; same && x < coarse->width; x++) {
+                    same = std::memcmp(
+                        &coarse->data[(static_cast<std::size_t>(y) * coarse->width + x) * 4],
+                        &full.data[((static_cast<std::size_t>(y) << shift) * full.width + (x << shift)) * 4],
+                        4
+                    ) == 0;
+                }
+            }
+            check(same, "decode_thumbnail: coarse passes of " + name + " at 1/" + std::to_string(1 << shift));
+        }
+    }
+    // A transparent red pixel next to an opaque blue one gives half
+    // transparent blue, not purple.
+    const std::vector<unsigned char> scanline{0, 255, 0, 0, 0, 0, 0, 255, 255};
+    const Png png{"bleed", as_png_bytes(png_file({
+        png_chunk("IHDR", IHDR_data(2, 1, 8, 6)), png_chunk("IDAT", zlib_stored(scanline)), png_chunk("IEND", {})
+    }))};
+    const std::optional<DecodedImage> thumbnail = decode_thumbnail(png, ThumbnailScale::Half);
+    check(thumbnail && thumbnail->data == std::vector<unsigned char>{0, 0, 255, 128}, "decode_thumbnail: transparent colour bleeds");
+}
+
+static void test_pixel_kernels() {
+    namespace k = kernel_builds;
+    // Every pair of colour and alpha, plus a few odd lengths for the tails.
+    // The kernels start at the second pixel to run unaligned, hence one more.
+    std::vector<Color> pixels(65536 + 1);
+    for (std::size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = Color{static_cast<unsigned char>(i), static_cast<unsigned char>(255 - i), static_cast<unsigned char>(i >> 3), static_cast<unsigned char>(i >> 8)};
+    }
+    std::vector<Color> expected = pixels;
+    for (Color& pixel : expected) {
+        pixel.r = multiply_alpha(pixel.r, pixel.a);
+        pixel.g = multiply_alpha(pixel.g, pixel.a);
+        pixel.b = multiply_alpha(pixel.b, pixel.a);
+    }
+    struct Build {
+        KernelTarget target;
+        PremultiplyKernel premultiply;
+        WidenToFloatKernel widen;
+    };
+    const Build builds[] = {
+        {KernelTarget::Scalar, k::scalar::premultiply_alpha, k::scalar::widen_to_float},
+#if defined(__x86_64__) || defined(__i386__)
+        {KernelTarget::SSE4, k::sse4::premultiply_alpha, k::sse4::widen_to_float},
+        {KernelTarget::AVX2, k::avx2::premultiply_alpha, k::avx2::widen_to_float},
+#endif
+    };
+    for (const Build& build : builds) {
+        if (!target_supported(build.target)) {
+            continue;
+        }
+        const std::string name = target_name(build.target);
+        for (std::size_t count : {std::size_t{65536}, std::size_t{7}, std::size_t{13}}) {
+            std::vector<Color> out(pixels.begin() + 1, pixels.begin() + 1 + count);
+            build.premultiply(out.data(), count);
+            check(
+                std::memcmp(out.data(), expected.data() + 1, count * sizeof(Color)) == 0,
+                "premultiply_alpha: " + name + " differs from multiply_alpha, " + std::to_string(count) + " pixels"
+            );
+            for (bool premultiply : {false, true}) {
+                std::vector<unsigned char> wide(count * 16), reference(count * 16);
+                build.widen(pixels.data() + 1, count, premultiply, wide.data());
+                k::scalar::widen_to_float(pixels.data() + 1, count, premultiply, reference.data());
+                check(wide == reference, "widen_to_float: " + name + " differs from scalar, " + std::to_string(count) + " pixels");
+            }
+        }
+    }
+
+    // The kernels as decode() uses them
+    for (const char* name : {"basn6a08.png", "basn4a16.png", "tbrn2c08.png", "s09i3p02.png"}) {
+        const Png png{std::string{"test_images/"} + name};
+        const DecodedImage straight = decode(png).value();
+        const std::size_t count = straight.data.size() / 4;
+        std::vector<unsigned char> premultiplied = straight.data;
+        for (std::size_t i = 0; i < count; i++) {
+            for (int c = 0; c < 3; c++) {
+                premultiplied[4 * i + c] = multiply_alpha(straight.data[4 * i + c], straight.data[4 * i + 3]);
+            }
+        }
+        const std::optional<DecodedImage> u8 = decode(png, rgba8_premultiplied);
+        check(u8 && u8->data == premultiplied, std::string{"decode: rgba8_premultiplied of "} + name);
+
+        std::vector<float> planes(count * 4);
+        for (std::size_t i = 0; i < count; i++) {
+            const float a = straight.data[4 * i + 3] * (1.0f / 255.0f);
+            for (int c = 0; c < 4; c++) {
+                planes[c * count + i] = c == 3 ? a : straight.data[4 * i + c] * (1.0f / 255.0f) * a;
+            }
+        }
+        PixelFormat format = planar_float32;
+        format.premultiplied = true;
+        const std::optional<DecodedImage> f32 = decode(png, format);
+        check(
+            f32 && f32->data.size() == planes.size() * sizeof(float) && std::memcmp(f32->data.data(), planes.data(), f32->data.size()) == 0,
+            std::string{"decode: premultiplied planar_float32 of "} + name
+        );
+    }
+}
+
+static void test_transfer_16() {
+    std::vector<uint16_t> samples(65536);
+    for (std::size_t i = 0; i < samples.size(); i++) {
+        samples[i] = static_cast<uint16_t>(i);
+    }
+    struct Case {
+        bool is_srgb;
+        uint32_t gamma;
+        TransferFunction output;
+    };
+    for (const Case& c : {Case{true, 0, TransferFunction::Linear}, Case{false, 45455, TransferFunction::Linear}, Case{false, 45455, TransferFunction::SRGB}, Case{false, 100000, TransferFunction::SRGB}}) {
+        ColorInfo info{};
+        info.is_srgb = c.is_srgb;
+        info.has_gamma = c.gamma != 0;
+        info.gamma = c.gamma;
+        const TransferCurve curve = make_transfer_curve(info, c.output);
+        std::vector<unsigned char> out(samples.size());
+        transfer_16(curve, samples.data(), samples.size(), out.data());
+        std::size_t off_by_one = 0;
+        bool close = true;
+        for (std::size_t i = 0; i < samples.size(); i++) {
+            const double x = i / 65535.0;
+            const double linear = c.is_srgb
+                ? (x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4))
+                : std::pow(x, 100000.0 / c.gamma);
+            const double value = c.output == TransferFunction::Linear
+                ? linear
+                : (linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055);
+            const long expected = std::lround(std::clamp(value, 0.0, 1.0) * 255.0);
+            const long difference = std::abs(expected - out[i]);
+            close = close && difference <= 1;
+            off_by_one += difference == 1;
+        }
+        const std::string name = "transfer_16: gamma " + std::to_string(c.gamma) + " to " + (c.output == TransferFunction::Linear ? "linear" : "sRGB");
+        check(close, name + " is more than one step from pow");
+        check(off_by_one * 200 < samples.size(), name + " is off by one for " + std::to_string(off_by_one) + " samples");
+
+        // Every build repeats the polynomial of the scalar one to the bit,
+        // odd lengths and offsets run into the tails.
+        const struct {
+            KernelTarget target;
+            Transfer16Kernel transfer_16;
+        } builds[] = {
+#if defined(__x86_64__) || defined(__i386__)
+            {KernelTarget::SSE4, kernel_builds::sse4::transfer_16},
+            {KernelTarget::AVX2, kernel_builds::avx2::transfer_16},
+#endif
+            {KernelTarget::Scalar, kernel_builds::scalar::transfer_16},
+        };
+        const bool linear = c.output == TransferFunction::Linear;
+        for (const auto& build : builds) {
+            if (!target_supported(build.target)) {
+                continue;
+            }
+            bool same = true;
+            for (std::size_t count : {samples.size() - 1, std::size_t{3}, std::size_t{13}}) {
+                std::vector<unsigned char> built(count), expected(count);
+                build.transfer_16(samples.data() + 1, count, curve.source_is_srgb, curve.source_exponent, linear, built.data());
+                kernel_builds::scalar::transfer_16(samples.data() + 1, count, curve.source_is_srgb, curve.source_exponent, linear, expected.data());
+                same = same && built == expected;
+            }
+            check(same, name + ": " + target_name(build.target) + " differs from scalar");
+        }
+    }
+
+    // iCCP overrides gAMA, and is not interpreted, so samples pass through.
+    ColorInfo profiled{};
+    profiled.has_gamma = true;
+    profiled.gamma = 45455;
+    profiled.has_icc_profile = true;
+    check(!make_transfer_curve(profiled, TransferFunction::Linear).active, "transfer curve: gAMA used although iCCP overrides it");
+
+    // tRNS keys and alpha are read from the raw samples whatever the curve.
+    for (const char* name : {"tbbn2c16.png", "tbwn0g16.png", "basn4a16.png", "basn6a16.png"}) {
+        const Png png{std::string{"test_images/"} + name};
+        PixelFormat format = rgba8;
+        format.transfer = TransferFunction::Linear;
+        const DecodedImage encoded = decode(png).value();
+        const std::optional<DecodedImage> linear = decode(png, format);
+        bool same_alpha = linear && linear->data.size() == encoded.data.size();
+        for (std::size_t i = 3; same_alpha && i < encoded.data.size(); i += 4) {
+            same_alpha = linear->data[i] == encoded.data[i];
+        }
+        check(same_alpha, std::string{"decode: alpha of "} + name + " changes with the transfer curve");
+    }
+}
+
+static void put_uint32(std::vector<unsigned char>& bytes, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        bytes.push_back(static_cast<unsigned char>(value >> shift));
+    }
+}
+
+static std::vector<unsigned char> fcTL_data(uint32_t sequence_number, FrameRect rect, DisposeOp dispose_op, BlendOp blend_op) {
+    std::vector<unsigned char> data;
+    for (uint32_t value : {sequence_number, rect.width, rect.height, rect.x, rect.y}) {
+        put_uint32(data, value);
+    }
+    data.insert(data.end(), {0, 1, 0, 10, static_cast<unsigned char>(dispose_op), static_cast<unsigned char>(blend_op)});
+    return data;
+}
+
+static std::vector<unsigned char> fdAT_data(uint32_t sequence_number, const std::vector<unsigned char>& scanlines) {
+    std::vector<unsigned char> data;
+    put_uint32(data, sequence_number);
+    const std::vector<unsigned char> stream = zlib_stored(scanlines);
+    data.insert(data.end(), stream.begin(), stream.end());
+    return data;
+}
+
+static bool same_color(const Color& a, const Color& b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static bool canvas_is(const std::vector<Color>& canvas, const std::vector<Color>& expected) {
+    return canvas.size() == expected.size() && std::equal(canvas.begin(), canvas.end(), expected.begin(), same_color);
+}
+
+/**
+ * @brief a 2x2 animation: frame 0 is the default image, all red. Frame 1
+ * blends half transparent blue over pixel (1, 1) and disposes to the
+ * background, frame 2 replaces pixel (0, 0) with green.
+ * @param sequence_numbers of the fcTL, fdAT, fcTL, fdAT after the first fcTL
+*/
+static std::vector<unsigned char> apng_file(
+    const std::vector<uint32_t>& sequence_numbers = {1, 2, 3, 4},
+    unsigned char color_type = 6,
+    bool damage_frame_1 = false
+) {
+    const std::vector<unsigned char> red{0, 255, 0, 0, 255, 255, 0, 0, 255, 0, 255, 0, 0, 255, 255, 0, 0, 255};
+    std::vector<unsigned char> frame_1 = fdAT_data(sequence_numbers[1], {0, 0, 0, 255, 128});
+    if (damage_frame_1) {
+        frame_1.back() ^= 1;
+    }
+    return png_file({
+        png_chunk("IHDR", IHDR_data(2, 2, 8, color_type)),
+        png_chunk("acTL", {0, 0, 0, 3, 0, 0, 0, 0}),
+        png_chunk("fcTL", fcTL_data(0, FrameRect{0, 0, 2, 2}, DisposeOp::None, BlendOp::Source)),
+        png_chunk("IDAT", zlib_stored(red)),
+        png_chunk("fcTL", fcTL_data(sequence_numbers[0], FrameRect{1, 1, 1, 1}, DisposeOp::Background, BlendOp::Over)),
+        png_chunk("fdAT", frame_1),
+        png_chunk("fcTL", fcTL_data(sequence_numbers[2], FrameRect{0, 0, 1, 1}, DisposeOp::None, BlendOp::Source)),
+        png_chunk("fdAT", fdAT_data(sequence_numbers[3], {0, 0, 255, 0, 255})),
+        png_chunk("IEND", {}),
+    });
+}
+
+static void test_apng() {
+    const Color red{255, 0, 0, 255};
+    const Color green{0, 255, 0, 255};
+    const Color clear{0, 0, 0, 0};
+    // (0, 0, 255, 128) over red
+    const Color purple{127, 0, 128, 255};
+    const std::vector<std::vector<Color>> canvases{
+        {red, red, red, red},
+        {red, red, red, purple},
+        {green, red, red, clear},
+    };
+
+    const Png png{"animation", as_png_bytes(apng_file())};
+    ApngDecoder decoder{png};
+    check(decoder.is_animated() && decoder.frame_count() == 3, "ApngDecoder: frame count");
+    for (std::size_t frame = 0; frame < canvases.size(); frame++) {
+        check(decoder.next_frame() && canvas_is(decoder.canvas(), canvases[frame]), "ApngDecoder: frame " + std::to_string(frame));
+    }
+    const FrameRect& dirty = decoder.dirty_rect();
+    check(dirty.x == 0 && dirty.y == 0 && dirty.width == 2 && dirty.height == 2, "ApngDecoder: dirty rect of frame 2");
+    check(!decoder.next_frame() && decoder.current_frame() == 2, "ApngDecoder: next_frame after the last frame");
+
+    // Room for one cached canvas, so seeks drop and replay keyframes.
+    ApngDecoder seeker{png, 1, 4 * sizeof(Color)};
+    for (uint32_t frame : {2u, 1u, 0u, 2u, 1u}) {
+        check(seeker.seek(frame) && canvas_is(seeker.canvas(), canvases[frame]), "ApngDecoder: seek to frame " + std::to_string(frame));
+    }
+
+    const Png damaged{"damaged", as_png_bytes(apng_file({1, 2, 3, 4}, 6, true))};
+    ApngDecoder damaged_decoder{damaged};
+    check(damaged_decoder.next_frame(), "ApngDecoder: frame 0 before a damaged frame");
+    check(!damaged_decoder.next_frame() && damaged_decoder.current_frame() == 1, "ApngDecoder: damaged frame 1 is reported");
+    ApngDecoder damaged_seeker{damaged};
+    check(!damaged_seeker.seek(2), "ApngDecoder: seek through a damaged frame");
+
+    const Png out_of_order{"out of order", as_png_bytes(apng_file({1, 4, 3, 2}))};
+    check(!read_animation(out_of_order) && !ApngDecoder{out_of_order}.is_animated(), "ApngDecoder: out of order sequence numbers");
+    const Png gap{"gap", as_png_bytes(apng_file({1, 2, 4, 5}))};
+    check(!read_animation(gap), "ApngDecoder: gap in sequence numbers");
+
+    const Png no_palette{"no palette", as_png_bytes(apng_file({1, 2, 3, 4}, 3))};
+    check(read_animation(no_palette) && !ApngDecoder{no_palette}.is_animated(), "ApngDecoder: colour type 3 without PLTE");
+}
+
+static bool aligned(const void* pointer, std::size_t alignment) {
+    return reinterpret_cast<std::uintptr_t>(pointer) % alignment == 0;
+}
+
+// Heap allocations made by this thread, counted by the operator new below
+static thread_local std::size_t heap_allocations = 0;
+
+void* operator new(std::size_t size) {
+    heap_allocations++;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    heap_allocations++;
+    const std::size_t a = static_cast<std::size_t>(alignment);
+    if (void* p = std::aligned_alloc(a, (std::max<std::size_t>(size, 1) + a - 1) / a * a)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+/**
+ * Once one decode has grown the blocks of a context, the next decodes are
+ * served from them: the chunk index, the inflate window, the huffman
+ * tables and the scanlines never reach the heap, reset() keeps the blocks,
+ * and what is left is the output image and the row callback.
+*/
+static void test_decoder_context() {
+    DecoderContext scratch{4096};
+    std::pmr::memory_resource* resource = scratch.resource();
+    void* first = resource->allocate(1000, 64);
+    const std::size_t reserved = scratch.bytes_reserved();
+    std::size_t before = heap_allocations;
+    bool within_block = true;
+    for (int i = 0; i < 3; i++) {
+        within_block = within_block && resource->allocate(500, 16) != nullptr;
+    }
+    // Computed before check() builds its message string.
+    const bool served = within_block && heap_allocations == before && scratch.bytes_reserved() == reserved;
+    check(served, "DecoderContext: small allocations are served from the arena");
+    scratch.reset();
+    before = heap_allocations;
+    const bool reused = resource->allocate(1000, 64) == first && heap_allocations == before;
+    check(reused, "DecoderContext: reset reuses the first block");
+
+    for (const char* name : {"basn6a08.png", "basi3p02.png", "basn0g16.png", "s35i3p04.png"}) {
+        const std::vector<unsigned char> bytes = read_file(std::string{"test_images/"} + name);
+        // The file name fits the small string buffer, so the Png constructor
+        // itself does not allocate.
+        const std::string short_name = name;
+        DecoderContext context;
+        std::size_t context_reserved = 0;
+        std::size_t allocations[3];
+        bool decoded = true;
+        bool stable = true;
+        for (int round = 0; round < 3; round++) {
+            std::vector<PngByte> file = as_png_bytes(bytes);
+            before = heap_allocations;
+            {
+                const Png png{short_name, std::move(file), context.resource()};
+                decoded = decoded && decode(png, rgba8, &context).has_value();
+            }
+            allocations[round] = heap_allocations - before;
+            context.reset();
+            stable = stable && (round == 0 || context.bytes_reserved() == context_reserved);
+            context_reserved = context.bytes_reserved();
+        }
+        std::vector<PngByte> file = as_png_bytes(bytes);
+        before = heap_allocations;
+        {
+            const Png png{short_name, std::move(file)};
+            decoded = decoded && decode(png).has_value();
+        }
+        const std::size_t without_context = heap_allocations - before;
+
+        check(decoded, std::string{"DecoderContext: "} + name + " decodes");
+        check(stable, std::string{"DecoderContext: "} + name + " grew after the first decode");
+        // The output image, the row callback of store_region and the one of
+        // run_row_pipeline.
+        check(allocations[1] <= 3 && allocations[2] <= 3, std::string{"DecoderContext: "} + name + " made " + std::to_string(allocations[2]) + " heap allocations in a warmed decode");
+        check(allocations[2] < without_context, std::string{"DecoderContext: "} + name + " allocates less than a decode without a context");
+    }
+}
+
+static void test_arena_alignment() {
+    DecoderContext context{4096};
+    std::pmr::memory_resource* resource = context.resource();
+    // The second round reuses the blocks of the first.
+    for (int round = 0; round < 2; round++) {
+        bool all_aligned = true;
+        for (std::size_t alignment : {std::size_t{64}, std::size_t{1}, std::size_t{256}, std::size_t{8}, std::size_t{4096}, std::size_t{64}}) {
+            all_aligned = all_aligned && aligned(resource->allocate(100, alignment), alignment);
+        }
+        check(all_aligned, "Arena: allocations are aligned in round " + std::to_string(round));
+        context.reset();
+    }
+}
+
+/**
+ * @brief waits, for at most 10 seconds, until condition holds.
+*/
+template <typename Condition>
+static bool wait_for(Condition&& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void test_decode_cache() {
+    const Png png{"test_images/basn6a08.png"};
+    constexpr int number_of_threads = 8;
+
+    // Every thread misses on one key while the first decode is held back,
+    // only that one decodes and the rest wait for its image.
+    {
+        DecodeCache cache{std::size_t{1} << 20};
+        std::atomic<int> decodes{0};
+        const DecodeCache::Decoder slow = [&](const Png& png, const PixelFormat& format) {
+            decodes++;
+            wait_for([&]() { return cache.stats().coalesced == number_of_threads - 1; });
+            return decode(png, format);
+        };
+        std::vector<DecodeCache::ImagePtr> images(number_of_threads);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < number_of_threads; i++) {
+            threads.emplace_back([&, i]() { images[i] = cache.get(png, rgba8, slow); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const DecodeCacheStats stats = cache.stats();
+        check(decodes == 1 && stats.misses == 1 && stats.coalesced == number_of_threads - 1, "DecodeCache: one decode for concurrent misses");
+        check(images[0] && std::all_of(images.begin(), images.end(), [&](const auto& image) { return image == images[0]; }), "DecodeCache: waiters share the image");
+        check(images[0] && images[0]->data == decode(png).value().data, "DecodeCache: cached image");
+        check(cache.get(png) == images[0] && cache.stats().hits == 1, "DecodeCache: hit after the decode");
+    }
+
+    // A decoder that throws hands its exception to the waiters, and the key
+    // can be decoded again afterwards.
+    {
+        DecodeCache cache{std::size_t{1} << 20};
+        const DecodeCache::Decoder failing = [&](const Png&, const PixelFormat&) -> std::optional<DecodedImage> {
+            wait_for([&]() { return cache.stats().coalesced == 1; });
+            throw std::runtime_error("decoder failed");
+        };
+        const auto outcome = [&]() {
+            try {
+                cache.get(png, rgba8, failing);
+                return std::string{"returned"};
+            }
+            catch (const std::runtime_error& error) {
+                return std::string{error.what()};
+            }
+            catch (const std::exception& error) {
+                return std::string{"other exception: "} + error.what();
+            }
+        };
+        std::string first, second;
+        std::thread thread{[&]() { first = outcome(); }};
+        second = outcome();
+        thread.join();
+        check(first == "decoder failed" && second == "decoder failed", "DecodeCache: the exception reaches every caller, got " + first + " and " + second);
+        check(cache.get(png) != nullptr && cache.stats().misses == 2, "DecodeCache: decodes again after a throw");
+    }
+
+    // One shard with room for two 32x32 rgba8 images out of three, so the
+    // third miss evicts the least recently used one.
+    {
+        const Png a{"test_images/basn6a08.png"};
+        const Png b{"test_images/basn2c08.png"};
+        const Png c{"test_images/basn0g08.png"};
+        const std::size_t entry_bytes = sizeof(DecodedImage) + 32 * 32 * 4;
+        DecodeCache cache{2 * entry_bytes + 1, 1};
+        const DecodeCache::ImagePtr first_a = cache.get(a);
+        const DecodeCache::ImagePtr first_b = cache.get(b);
+        check(cache.get(a) == first_a, "DecodeCache: hit returns the cached image");
+        // a was used last, so c pushes out b.
+        const DecodeCache::ImagePtr first_c = cache.get(c);
+        DecodeCacheStats stats = cache.stats();
+        check(stats.hits == 1 && stats.misses == 3 && stats.evictions == 1, "DecodeCache: counters after the first eviction");
+        check(stats.entries == 2 && stats.bytes == 2 * entry_bytes, "DecodeCache: the budget holds two images");
+        check(cache.get(a) == first_a, "DecodeCache: the recently used image survives eviction");
+        const DecodeCache::ImagePtr second_b = cache.get(b);
+        check(second_b && second_b != first_b && second_b->data == first_b->data, "DecodeCache: the least recently used image was evicted and decodes again");
+        // b came back in place of c, the least recently used after the hit on a.
+        check(cache.get(c) != first_c, "DecodeCache: c was evicted by b");
+        stats = cache.stats();
+        check(stats.hits == 2 && stats.misses == 5 && stats.evictions == 3 && stats.bytes <= 2 * entry_bytes, "DecodeCache: counters after three evictions");
+
+        cache.clear();
+        stats = cache.stats();
+        check(stats.entries == 0 && stats.bytes == 0 && first_a->data.size() == 32 * 32 * 4, "DecodeCache: clear drops the entries, handed out images stay");
+
+        DecodeCache small{entry_bytes - 1, 1};
+        check(small.get(a) != nullptr && small.stats().entries == 0 && small.stats().evictions == 0, "DecodeCache: an image over the budget is decoded but not kept");
+    }
+
+    // Format, scale and full or thumbnail decode are each part of the key.
+    {
+        DecodeCache cache{std::size_t{1} << 20, 1};
+        const DecodeCache::ImagePtr full = cache.get(png);
+        const DecodeCache::ImagePtr bgra = cache.get(png, bgra8);
+        const DecodeCache::ImagePtr half = cache.get_thumbnail(png, ThumbnailScale::Half);
+        const DecodeCache::ImagePtr quarter = cache.get_thumbnail(png, ThumbnailScale::Quarter);
+        const DecodeCache::ImagePtr quarter_bgra = cache.get_thumbnail(png, ThumbnailScale::Quarter, true, bgra8);
+        check(cache.stats().misses == 5 && cache.stats().entries == 5 && cache.stats().hits == 0, "DecodeCache: format and scale give different keys");
+        check(half && half->width == 16 && quarter && quarter->width == 8 && bgra && bgra->format == bgra8, "DecodeCache: each key holds its own image");
+        check(half && half->data == decode_thumbnail(png, ThumbnailScale::Half).value().data, "DecodeCache: cached thumbnail");
+        check(cache.get_thumbnail(png, ThumbnailScale::Half) == half && cache.get_thumbnail(png, ThumbnailScale::Quarter, true, bgra8) == quarter_bgra && cache.get(png) == full, "DecodeCache: thumbnail keys hit");
+        // png is not interlaced, so the Adam7 flag does not split the key.
+        check(cache.get_thumbnail(png, ThumbnailScale::Half, false) == half && cache.stats().hits == 4, "DecodeCache: coarse passes only matter for interlaced pngs");
+    }
+}
+
+static void test_instrumentation() {
+    // Timing switched on halfway through a decode leaves the inflate timer,
+    // started before, off while the ones inside it run.
+    const Png png{"test_images/basn6a16.png"};
+    std::vector<unsigned char> data(bytes_per_image(rgba8, png.get_header().width, png.get_header().height));
+    instrumentation::reset_thread_counters();
+    const bool decoded = decode_into(png, data.data(), rgba8, [](uint32_t rows_stored) {
+        if (rows_stored == 1) {
+            instrumentation::set_stage_timing(true);
+        }
+    });
+    instrumentation::set_stage_timing(false);
+    const instrumentation::Counters counters = instrumentation::thread_counters();
+    const uint64_t inflate_time = counters.stage_nanoseconds[static_cast<std::size_t>(instrumentation::Stage::Inflate)];
+    check(decoded && counters.rows == png.get_header().height, "instrumentation: rows counted");
+    check(inflate_time < uint64_t{1} << 40, "instrumentation: inflate time wrapped to " + std::to_string(inflate_time));
+
+    std::ostringstream hex;
+    png.print_data_hex(hex);
+    check(hex.str().rfind("file size: " + std::to_string(std::filesystem::file_size("test_images/basn6a16.png")) + "\n", 0) == 0, "Png: print_data_hex writes to the stream given");
+}
+
+/**
+ * @brief deterministic bytes for the kernel checks.
+*/
+static std::vector<unsigned char> noise(std::size_t size, uint32_t seed) {
+    std::vector<unsigned char> bytes(size);
+    for (auto& byte : bytes) {
+        seed = seed * 1664525u + 1013904223u;
+        byte = static_cast<unsigned char>(seed >> 24);
+    }
+    return bytes;
+}
+
+static std::vector<Color> noise_pixels(std::size_t count, uint32_t seed) {
+    const std::vector<unsigned char> bytes = noise(4 * count, seed);
+    std::vector<Color> pixels(count);
+    if (count > 0) {
+        std::memcpy(pixels.data(), bytes.data(), bytes.size());
+    }
+    return pixels;
+}
+
+/**
+ * @brief every build of every kernel against its scalar build, on lengths
+ * around the vector widths so that the tails are covered too. Builds a
+ * target leaves out, or the CPU can not run, are skipped.
+*/
+static void test_kernel_builds() {
+    namespace k = kernel_builds;
+    struct Builds {
+        KernelTarget target;
+        Crc32Kernel crc32;
+        Adler32Kernel adler32;
+        UnfilterKernel unfilter[4];
+        ExpandPaletteKernel expand_palette;
+        SwizzleKernel swizzle;
+        CopyMatchKernel copy_match;
+        ReduceRowKernel reduce_row;
+    };
+    const Builds scalar{
+        KernelTarget::Scalar, k::scalar::crc32, k::scalar::adler32,
+        {k::scalar::unfilter_sub, k::scalar::unfilter_up, k::scalar::unfilter_average, k::scalar::unfilter_paeth},
+        k::scalar::expand_palette, k::scalar::swizzle_rgba_to_bgra, k::scalar::copy_match, k::scalar::reduce_row
+    };
+    const Builds builds[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {
+            KernelTarget::SSE4, k::sse4::crc32, k::sse4::adler32,
+            {k::sse4::unfilter_sub, k::sse4::unfilter_up, k::sse4::unfilter_average, k::sse4::unfilter_paeth},
+            nullptr, k::sse4::swizzle_rgba_to_bgra, k::sse4::copy_match, k::sse4::reduce_row
+        },
+        {
+            KernelTarget::AVX2, nullptr, k::avx2::adler32, {nullptr, k::avx2::unfilter_up, nullptr, nullptr},
+            k::avx2::expand_palette, k::avx2::swizzle_rgba_to_bgra, k::avx2::copy_match, nullptr
+        },
+        {
+            KernelTarget::AVX512, nullptr, k::avx512::adler32, {nullptr, k::avx512::unfilter_up, nullptr, nullptr},
+            k::avx512::expand_palette, k::avx512::swizzle_rgba_to_bgra, k::avx512::copy_match, nullptr
+        },
+#endif
+        scalar,
+    };
+    const std::size_t sizes[] = {0, 1, 3, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 200, 1000, 6000, 70000};
+    for (const Builds& build : builds) {
+        if (!target_supported(build.target)) {
+            continue;
+        }
+        const std::string target = target_name(build.target);
+        bool crc32_same = true, adler32_same = true, palette_same = true, swizzle_same = true, copy_same = true, reduce_same = true;
+        bool unfilter_same[4] = {true, true, true, true};
+        for (std::size_t size : sizes) {
+            const std::vector<unsigned char> bytes = noise(size, static_cast<uint32_t>(size));
+            if (build.crc32) {
+                crc32_same = crc32_same && build.crc32(0x12345678, bytes.data(), size) == scalar.crc32(0x12345678, bytes.data(), size);
+            }
+            if (build.adler32) {
+                adler32_same = adler32_same && build.adler32(0x00ff00f0, bytes.data(), size) == scalar.adler32(0x00ff00f0, bytes.data(), size);
+            }
+            for (std::size_t bpp : {1, 2, 3, 4, 6, 8}) {
+                const std::size_t row_bytes = size / bpp * bpp;
+                const std::vector<unsigned char> previous = noise(row_bytes, 7);
+                for (int filter = 0; filter < 4; filter++) {
+                    if (!build.unfilter[filter]) {
+                        continue;
+                    }
+                    std::vector<unsigned char> row(bytes.begin(), bytes.begin() + row_bytes), expected = row;
+                    build.unfilter[filter](row.data(), previous.data(), row_bytes, bpp);
+                    scalar.unfilter[filter](expected.data(), previous.data(), row_bytes, bpp);
+                    unfilter_same[filter] = unfilter_same[filter] && row == expected;
+                }
+            }
+            const std::vector<Color> palette = noise_pixels(256, 3);
+            const std::vector<Color> pixels = noise_pixels(size, 5);
+            const auto same_pixels = [](const std::vector<Color>& a, const std::vector<Color>& b) {
+                // memcmp may not be given the null data() of empty vectors
+                return a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(Color)) == 0;
+            };
+            if (build.expand_palette) {
+                std::vector<Color> out(size), expected(size);
+                build.expand_palette(bytes.data(), size, palette.data(), out.data());
+                scalar.expand_palette(bytes.data(), size, palette.data(), expected.data());
+                palette_same = palette_same && same_pixels(out, expected);
+            }
+            if (build.swizzle) {
+                std::vector<unsigned char> out(4 * size), expected(4 * size);
+                build.swizzle(pixels.data(), size, out.data());
+                scalar.swizzle(pixels.data(), size, expected.data());
+                swizzle_same = swizzle_same && out == expected;
+            }
+            if (build.copy_match) {
+                for (std::size_t distance : {1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 64, 100}) {
+                    std::vector<unsigned char> window = noise(distance + size + CopyMatchSlack, 9), expected = window;
+                    build.copy_match(window.data() + distance, distance, size);
+                    scalar.copy_match(expected.data() + distance, distance, size);
+                    copy_same = copy_same && std::equal(window.begin(), window.begin() + distance + size, expected.begin());
+                }
+            }
+            if (build.reduce_row) {
+                for (int shift = 1; shift <= 3; shift++) {
+                    const std::size_t groups = (size + (std::size_t{1} << shift) - 1) >> shift;
+                    std::vector<uint32_t> sums(4 * groups, 1), expected(4 * groups, 1);
+                    build.reduce_row(pixels.data(), size, shift, sums.data());
+                    scalar.reduce_row(pixels.data(), size, shift, expected.data());
+                    reduce_same = reduce_same && sums == expected;
+                }
+            }
+        }
+        check(crc32_same, "kernels: crc32 " + target + " differs from scalar");
+        check(adler32_same, "kernels: adler32 " + target + " differs from scalar");
+        const char* filter_names[] = {"sub", "up", "average", "paeth"};
+        for (int filter = 0; filter < 4; filter++) {
+            check(unfilter_same[filter], std::string{"kernels: unfilter_"} + filter_names[filter] + " " + target + " differs from scalar");
+        }
+        check(palette_same, "kernels: expand_palette " + target + " differs from scalar");
+        check(swizzle_same, "kernels: swizzle_rgba_to_bgra " + target + " differs from scalar");
+        check(copy_same, "kernels: copy_match " + target + " differs from scalar");
+        check(reduce_same, "kernels: reduce_row " + target + " differs from scalar");
+    }
+
+    // The scalar builds themselves, against known values
+    const char* text = "123456789";
+    const unsigned char* digits = reinterpret_cast<const unsigned char*>(text);
+    check(scalar.crc32(0, digits, 9) == 0xcbf43926u, "kernels: crc32 check value");
+    check(scalar.adler32(1, digits, 9) == 0x091e01deu, "kernels: adler32 check value");
+}
+
+static void check_verdict(const PngVerdict& verdict, ValidationError error, const char* chunk, uint64_t offset, const std::string& name) {
+    check(
+        verdict.error == error && std::string{verdict.error_chunk} == chunk && verdict.error_offset == offset,
+        "validate_png: " + name + " gave " + validation_error_name(verdict.error) + " in \"" + verdict.error_chunk +
+        "\" at " + std::to_string(verdict.error_offset)
+    );
+}
+
+static void test_validate() {
+    struct Expected {
+        const char* name;
+        ValidationError error;
+        const char* chunk;
+        uint64_t offset;
+    };
+    const Expected corrupt_files[] = {
+        {"xc1n0g08.png", ValidationError::BadIHDR, "IHDR", 8},
+        {"xc9n2c08.png", ValidationError::BadIHDR, "IHDR", 8},
+        {"xcrn0g04.png", ValidationError::BadSignature, "", 0},
+        {"xcsn0g01.png", ValidationError::BadCrc, "IDAT", 49},
+        {"xd0n2c08.png", ValidationError::BadIHDR, "IHDR", 8},
+        {"xd3n2c08.png", ValidationError::BadIHDR, "IHDR", 8},
+        {"xd9n2c08.png", ValidationError::BadIHDR, "IHDR", 8},
+        {"xdtn0g01.png", ValidationError::MissingIDAT, "IEND", 49},
+        {"xhdn0g08.png", ValidationError::BadCrc, "IHDR", 8},
+        {"xlfn0g04.png", ValidationError::BadSignature, "", 0},
+        {"xs1n0g01.png", ValidationError::BadSignature, "", 0},
+        {"xs2n0g01.png", ValidationError::BadSignature, "", 0},
+        {"xs4n0g01.png", ValidationError::BadSignature, "", 0},
+        {"xs7n0g01.png", ValidationError::BadSignature, "", 0},
+    };
+    for (const Expected& expected : corrupt_files) {
+        check_verdict(validate_png_file(std::string{"test_images/"} + expected.name), expected.error, expected.chunk, expected.offset, expected.name);
+    }
+    for (const auto& reference : reference_decodes) {
+        check(validate_png_file(std::string{"test_images/"} + reference.name).ok(), std::string{"validate_png: "} + reference.name + " is fine");
+    }
+    check(validate_png_file("test_images/missing.png").error == ValidationError::CannotRead, "validate_png: a file that is not there");
+
+    // A zlib stream cut short and followed by IEND is reported in the last
+    // IDAT chunk, whose CRC is intact, not in IEND.
+    std::vector<unsigned char> scanlines(1 + 3 * 4);
+    scanlines.resize(4 * scanlines.size());
+    const std::vector<unsigned char> stream = zlib_stored(scanlines);
+    const std::vector<unsigned char> first_half(stream.begin(), stream.begin() + 20);
+    const std::vector<unsigned char> second_half(stream.begin() + 20, stream.end() - 10);
+    // signature, IHDR and the first IDAT header
+    constexpr uint64_t first_IDAT = 8 + 25;
+    const std::vector<unsigned char> one_IDAT = png_file({
+        png_chunk("IHDR", IHDR_data(4, 4, 8, 2)), png_chunk("IDAT", first_half), png_chunk("IEND", {})
+    });
+    check_verdict(validate_png(one_IDAT.data(), one_IDAT.size()), ValidationError::ImageDataTruncated, "IDAT", first_IDAT, "truncated IDAT");
+    const std::vector<unsigned char> two_IDAT = png_file({
+        png_chunk("IHDR", IHDR_data(4, 4, 8, 2)), png_chunk("IDAT", first_half), png_chunk("IDAT", second_half), png_chunk("IEND", {})
+    });
+    check_verdict(
+        validate_png(two_IDAT.data(), two_IDAT.size()), ValidationError::ImageDataTruncated, "IDAT", first_IDAT + 12 + first_half.size(),
+        "truncated second IDAT"
+    );
+    // The same with a bad filter type, found after the whole stream was read
+    std::vector<unsigned char> bad_filter = scanlines;
+    bad_filter[2 * 13] = 5;
+    const std::vector<unsigned char> filter_file = png_file({
+        png_chunk("IHDR", IHDR_data(4, 4, 8, 2)), png_chunk("IDAT", zlib_stored(bad_filter)), png_chunk("IEND", {})
+    });
+    check_verdict(validate_png(filter_file.data(), filter_file.size()), ValidationError::BadFilterType, "IDAT", first_IDAT, "bad filter type");
+    // A flipped byte inside IDAT data is a bad CRC, not bad image data.
+    std::vector<unsigned char> flipped = filter_file;
+    flipped[first_IDAT + 8 + 2 + 5 + 2 * 13] = 0;
+    flipped[first_IDAT + 8 + 2 + 5 + 3] ^= 0x55;
+    check_verdict(validate_png(flipped.data(), flipped.size()), ValidationError::BadCrc, "IDAT", first_IDAT, "flipped IDAT byte");
+}
+
+static void test_decode_to_file() {
+    const std::string path = (std::filesystem::temp_directory_path() / ("bitmap_test_" + std::to_string(getpid()) + ".raw")).string();
+    for (const char* name : {"basn6a08.png", "basi2c16.png", "s09i3p02.png", "tbrn2c08.png"}) {
+        const Png png{std::string{"test_images/"} + name};
+        for (const PixelFormat& format : {rgba8, bgra8_premultiplied, planar_float32}) {
+            const DecodedImage expected = decode(png, format).value();
+            const bool decoded = decode_to_file(png, path, format);
+            check(decoded && read_file(path) == expected.data, std::string{"decode_to_file: "} + name + " differs from decode()");
+        }
+        // One row tiles and a sync every page release every row of every
+        // pass as soon as it is done.
+        const DecodedImage expected = decode(png).value();
+        bool written = false;
+        {
+            MappedImage image{path, png.get_header().width, png.get_header().height, rgba8, 1, 4096};
+            written = image.is_open() && image.size() == expected.data.size() &&
+                decode_into(png, image.data(), rgba8, [&](uint32_t rows) { image.rows_stored(rows); }) &&
+                image.finish();
+        }
+        check(written && read_file(path) == expected.data, std::string{"MappedImage: "} + name + " with one row tiles");
+    }
+    std::remove(path.c_str());
+
+    // A damaged image leaves no file behind.
+    const Png damaged{"damaged", as_png_bytes(patched("test_images/basn2c08.png", 0x80, {0xff, 0xff, 0xff, 0xff}))};
+    check(damaged.is_parsed() && !decode_to_file(damaged, path) && !std::filesystem::exists(path), "decode_to_file: damaged image");
+}
+
+/**
+ * What zlib -9 made of decompress_text() as raw deflate, one dynamic block.
+*/
+static const unsigned char zlib_deflated_text[] = {
+    0x85, 0xd5, 0xc9, 0x4d, 0x05, 0x31, 0x10, 0x40, 0xc1, 0x3b, 0x51, 0x38, 0x04, 0xdc, 0xed, 0x36,
+    0x10, 0x0f, 0xf8, 0x0b, 0xa4, 0xbf, 0x20, 0x66, 0xf2, 0x17, 0x22, 0x00, 0xca, 0xe7, 0x77, 0x2b,
+    0xf5, 0x72, 0xfd, 0xba, 0xaf, 0xf6, 0xdc, 0x1e, 0x97, 0x76, 0x7e, 0xae, 0xf6, 0xb1, 0xde, 0x1f,
+    0xb7, 0xef, 0x9f, 0x75, 0x1c, 0xed, 0x5c, 0xc7, 0xf9, 0x74, 0xfd, 0xab, 0x9d, 0x35, 0x58, 0x93,
+    0x75, 0xb0, 0x16, 0xeb, 0x64, 0x7d, 0x61, 0x7d, 0x65, 0x7d, 0xb3, 0xc6, 0x06, 0xcb, 0x5a, 0xdd,
+    0x5c, 0xdd, 0x5e, 0xdd, 0x60, 0xdd, 0x62, 0xdd, 0x64, 0xdd, 0x66, 0xdd, 0x68, 0xdd, 0x6a, 0x61,
+    0xb5, 0xd8, 0xcc, 0x98, 0xd5, 0xc2, 0x6a, 0x61, 0xb5, 0xb0, 0x5a, 0x58, 0x2d, 0xac, 0x16, 0x56,
+    0x0b, 0xab, 0xa5, 0xd5, 0xd2, 0x6a, 0xb9, 0x59, 0x4d, 0xab, 0xa5, 0xd5, 0xd2, 0x6a, 0x69, 0xb5,
+    0xb4, 0x5a, 0x5a, 0x2d, 0xad, 0x36, 0xac, 0x36, 0xac, 0x36, 0xac, 0x36, 0x36, 0x17, 0xcd, 0x6a,
+    0xc3, 0x6a, 0xc3, 0x6a, 0xc3, 0x6a, 0xc3, 0x6a, 0xc3, 0x6a, 0x65, 0xb5, 0xb2, 0x5a, 0x59, 0xad,
+    0xac, 0x56, 0x9b, 0x47, 0x60, 0xb5, 0xb2, 0x5a, 0x59, 0xad, 0xac, 0x56, 0x56, 0x9b, 0x56, 0x9b,
+    0x56, 0x9b, 0x56, 0x9b, 0xff, 0xaa, 0xfd, 0x02,
+};
+// zlib's raw deflate of "hello hello hello\n", one fixed block
+static const unsigned char zlib_deflated_hello[] = {0xcb, 0x48, 0xcd, 0xc9, 0xc9, 0x57, 0xc8, 0x40, 0x90, 0x5c, 0x00};
+
+static std::vector<unsigned char> decompress_text() {
+    std::string text;
+    for (int i = 0; i < 64; i++) {
+        text += "line " + std::to_string(i) + " of the decompress test\n";
+    }
+    return std::vector<unsigned char>(text.begin(), text.end());
+}
+
+static void put_little_endian_uint32(std::vector<unsigned char>& bytes, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        bytes.push_back(static_cast<unsigned char>(value >> shift));
+    }
+}
+
+static std::vector<unsigned char> zlib_framed(const std::vector<unsigned char>& raw, const std::vector<unsigned char>& original) {
+    std::vector<unsigned char> stream{0x78, 0xda};
+    stream.insert(stream.end(), raw.begin(), raw.end());
+    put_uint32(stream, kernels().adler32(1, original.data(), original.size()));
+    return stream;
+}
+
+/**
+ * @brief a gzip member around raw, with a file name and a header CRC if
+ * name is not empty.
+*/
+static std::vector<unsigned char> gzip_member(
+    const std::vector<unsigned char>& raw,
+    const std::vector<unsigned char>& original,
+    const std::string& name = ""
+) {
+    std::vector<unsigned char> member{0x1f, 0x8b, 8, static_cast<unsigned char>(name.empty() ? 0 : 8 | 2), 0, 0, 0, 0, 2, 3};
+    if (!name.empty()) {
+        member.insert(member.end(), name.begin(), name.end());
+        member.push_back(0);
+        const uint32_t header_crc = crc_of(member);
+        member.push_back(static_cast<unsigned char>(header_crc));
+        member.push_back(static_cast<unsigned char>(header_crc >> 8));
+    }
+    member.insert(member.end(), raw.begin(), raw.end());
+    put_little_endian_uint32(member, crc_of(original));
+    put_little_endian_uint32(member, static_cast<uint32_t>(original.size()));
+    return member;
+}
+
+static void check_decompress(
+    deflate::Framing framing,
+    const std::vector<unsigned char>& stream,
+    deflate::Status status,
+    const std::vector<unsigned char>& expected,
+    const std::string& name
+) {
+    std::vector<unsigned char> out;
+    const deflate::Status result = deflate::decompress(framing, stream.data(), stream.size(), out);
+    check(result == status, "decompress: " + name + " gave " + deflate::status_name(result));
+    check(status != deflate::Status::Done || out == expected, "decompress: " + name + " output differs");
+}
+
+/**
+ * @brief decompresses stream handed out in_step bytes at a time, into a
+ * sink that stops once it holds stop_after bytes.
+*/
+static deflate::Status decompress_in_steps(
+    deflate::Framing framing,
+    const std::vector<unsigned char>& stream,
+    std::size_t in_step,
+    std::size_t stop_after,
+    std::vector<unsigned char>& out
+) {
+    std::size_t given = 0;
+    const deflate::ByteSource source = [&](const unsigned char*& bytes, std::size_t& size) {
+        if (given == stream.size()) {
+            return false;
+        }
+        bytes = stream.data() + given;
+        size = std::min(in_step, stream.size() - given);
+        given += size;
+        return true;
+    };
+    const deflate::ByteSink sink = [&](const unsigned char* bytes, std::size_t size) {
+        out.insert(out.end(), bytes, bytes + std::min(size, stop_after - out.size()));
+        return out.size() < stop_after;
+    };
+    return deflate::decompress(framing, source, sink);
+}
+
+/**
+ * Streams zlib made are decompressed to what it was given in every
+ * framing, gzip members may follow each other and be followed by padding,
+ * and the output is the same however the input is cut.
+*/
+static void test_decompress() {
+    using deflate::Framing;
+    using deflate::Status;
+    const std::vector<unsigned char> text = decompress_text();
+    const std::vector<unsigned char> hello{'h', 'e', 'l', 'l', 'o', ' ', 'h', 'e', 'l', 'l', 'o', ' ', 'h', 'e', 'l', 'l', 'o', '\n'};
+    const std::vector<unsigned char> raw_text{std::begin(zlib_deflated_text), std::end(zlib_deflated_text)};
+    const std::vector<unsigned char> raw_hello{std::begin(zlib_deflated_hello), std::end(zlib_deflated_hello)};
+    const std::vector<unsigned char> zlib_text = zlib_framed(raw_text, text);
+    const std::vector<unsigned char> gzip_text = gzip_member(raw_text, text);
+    const std::vector<unsigned char> gzip_hello = gzip_member(raw_hello, hello, "hello.txt");
+
+    check(crc_of(text) == 0x7fd8cc66, "decompress: test text differs from what was compressed");
+    check_decompress(Framing::Raw, raw_text, Status::Done, text, "raw dynamic block");
+    check_decompress(Framing::Raw, raw_hello, Status::Done, hello, "raw fixed block");
+    check_decompress(Framing::Zlib, zlib_text, Status::Done, text, "zlib");
+    check_decompress(Framing::Gzip, gzip_text, Status::Done, text, "gzip");
+    check_decompress(Framing::Gzip, gzip_hello, Status::Done, hello, "gzip with name and header CRC");
+    check_decompress(Framing::Detect, raw_text, Status::Done, text, "detected raw");
+    check_decompress(Framing::Detect, zlib_text, Status::Done, text, "detected zlib");
+    check_decompress(Framing::Detect, gzip_hello, Status::Done, hello, "detected gzip");
+    check(deflate::detect_framing(raw_text.data(), raw_text.size()) == Framing::Raw, "decompress: raw deflate detected as framed");
+
+    std::vector<unsigned char> members = gzip_text;
+    members.insert(members.end(), gzip_hello.begin(), gzip_hello.end());
+    std::vector<unsigned char> text_and_hello = text;
+    text_and_hello.insert(text_and_hello.end(), hello.begin(), hello.end());
+    check_decompress(Framing::Gzip, members, Status::Done, text_and_hello, "two gzip members");
+
+    const std::vector<std::pair<std::vector<unsigned char>, std::string>> trailers = {
+        {std::vector<unsigned char>(512, 0), "zero padding"},
+        {{'j', 'u', 'n', 'k'}, "trailing garbage"},
+        {{0x1f}, "half a gzip magic"},
+        {{0x1f, 0x8c}, "a wrong gzip magic"},
+    };
+    for (const auto& [trailer, name] : trailers) {
+        std::vector<unsigned char> stream = members;
+        stream.insert(stream.end(), trailer.begin(), trailer.end());
+        check_decompress(Framing::Gzip, stream, Status::Done, text_and_hello, name + " after gzip members");
+    }
+
+    std::vector<unsigned char> bad_crc = gzip_text;
+    bad_crc[bad_crc.size() - 8] ^= 1;
+    check_decompress(Framing::Gzip, bad_crc, Status::BadChecksum, text, "gzip with a bad CRC-32");
+    std::vector<unsigned char> bad_size = gzip_text;
+    bad_size[bad_size.size() - 4] ^= 1;
+    check_decompress(Framing::Gzip, bad_size, Status::BadChecksum, text, "gzip with a bad ISIZE");
+    std::vector<unsigned char> bad_header_crc = gzip_hello;
+    bad_header_crc[20] ^= 1;
+    check_decompress(Framing::Gzip, bad_header_crc, Status::BadGzipHeader, hello, "gzip with a bad header CRC");
+    check_decompress(Framing::Gzip, zlib_text, Status::BadGzipHeader, text, "zlib as gzip");
+    std::vector<unsigned char> bad_adler = zlib_text;
+    bad_adler.back() ^= 1;
+    check_decompress(Framing::Zlib, bad_adler, Status::BadChecksum, text, "zlib with a bad Adler-32");
+    std::vector<unsigned char> second_truncated = members;
+    second_truncated.pop_back();
+    check_decompress(Framing::Gzip, second_truncated, Status::InputEnded, text, "truncated second gzip member");
+
+    const struct {
+        Framing framing;
+        std::vector<unsigned char> stream;
+        std::vector<unsigned char> expected;
+        const char* name;
+    } streams[] = {
+        {Framing::Raw, raw_text, text, "raw"},
+        {Framing::Zlib, zlib_text, text, "zlib"},
+        {Framing::Gzip, members, text_and_hello, "gzip"},
+        {Framing::Detect, gzip_hello, hello, "detected gzip"},
+    };
+    for (const auto& stream : streams) {
+        for (const std::size_t in_step : {std::size_t{1}, std::size_t{3}, std::size_t{4096}}) {
+            std::vector<unsigned char> out;
+            const Status result = decompress_in_steps(stream.framing, stream.stream, in_step, SIZE_MAX, out);
+            check(
+                result == Status::Done && out == stream.expected,
+                std::string{"decompress: "} + stream.name + " in steps of " + std::to_string(in_step)
+            );
+        }
+        // A sink that has all it wants stops the stream, and got a prefix.
+        std::vector<unsigned char> out;
+        const Status result = decompress_in_steps(stream.framing, stream.stream, 5, 10, out);
+        check(
+            result == Status::Stopped && std::equal(out.begin(), out.end(), stream.expected.begin()) && out.size() == 10,
+            std::string{"decompress: "} + stream.name + " stopped by the sink"
+        );
+    }
+
+    // Bytes after a raw or zlib stream are not read as part of it.
+    for (const auto& [framing, stream] : {std::pair{Framing::Raw, raw_text}, std::pair{Framing::Zlib, zlib_text}}) {
+        std::vector<unsigned char> followed = stream;
+        followed.insert(followed.end(), {'n', 'e', 'x', 't'});
+        check_decompress(framing, followed, Status::Done, text, "data after the stream");
+    }
+
+    std::vector<unsigned char> out;
+    const Status truncated = decompress_in_steps(Framing::Zlib, {zlib_text.begin(), zlib_text.end() - 2}, 16, SIZE_MAX, out);
+    check(truncated == Status::InputEnded, "decompress: truncated zlib stream did not end as such");
+}
 
 int main() {
     std::vector<std::string> test_pngs = get_files_in_directory("test_images");
-    // for (auto const& e : test_pngs) {
-    //     Png test_png{e};
-    // }
-    Png test_png{test_pngs[0]};
+    std::sort(test_pngs.begin(), test_pngs.end());
+
+    test_batch_loader(test_pngs);
+    test_reference_decodes();
+    test_decode_region();
+    test_zlib_trailer();
+    test_bad_chunk_name();
+    test_thumbnails();
+    test_pixel_kernels();
+    test_transfer_16();
+    test_apng();
+    test_arena_alignment();
+    test_decoder_context();
+    test_decode_cache();
+    test_instrumentation();
+    test_kernel_builds();
+    test_validate();
+    test_decode_to_file();
+    test_decompress();
 
-}
\ No newline at end of file
+    if (failures) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "all checks passed\n";
+    return 0;
+}
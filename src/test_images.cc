@@ -1,4 +1,7 @@
 #include "test_images.h"
+#include "cpu_dispatch.h"
+
+#include <algorithm>
 
 std::vector<std::string> get_files_in_directory(const std::string& path) {
     std::vector<std::string> test_files{};
@@ -6,4 +9,64 @@ std::vector<std::string> get_files_in_directory(const std::string& path) {
         test_files.push_back(file.path().string());
     }
     return test_files;
-}
\ No newline at end of file
+}
+
+static void put_big_endian(std::vector<unsigned char>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+}
+
+std::vector<unsigned char> png_chunk(const char* type, const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> chunk;
+    put_big_endian(chunk, static_cast<uint32_t>(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    // The CRC covers the type and the data.
+    put_big_endian(chunk, kernels().crc32(0, chunk.data() + 4, chunk.size() - 4));
+    return chunk;
+}
+
+std::vector<unsigned char> IHDR_data(
+    uint32_t width,
+    uint32_t height,
+    unsigned char bit_depth,
+    unsigned char color_type,
+    unsigned char interlace_method
+) {
+    std::vector<unsigned char> data;
+    put_big_endian(data, width);
+    put_big_endian(data, height);
+    data.insert(data.end(), {bit_depth, color_type, 0, 0, interlace_method});
+    return data;
+}
+
+std::vector<unsigned char> zlib_stored(const std::vector<unsigned char>& bytes) {
+    std::vector<unsigned char> stream{0x78, 0x01};
+    std::size_t offset = 0;
+    do {
+        const std::size_t n = std::min<std::size_t>(bytes.size() - offset, 65535);
+        const bool final_block = offset + n == bytes.size();
+        stream.push_back(final_block ? 1 : 0);
+        stream.push_back(static_cast<unsigned char>(n));
+        stream.push_back(static_cast<unsigned char>(n >> 8));
+        stream.push_back(static_cast<unsigned char>(~n));
+        stream.push_back(static_cast<unsigned char>(~n >> 8));
+        stream.insert(stream.end(), bytes.begin() + offset, bytes.begin() + offset + n);
+        offset += n;
+    } while (offset < bytes.size());
+    put_big_endian(stream, kernels().adler32(1, bytes.data(), bytes.size()));
+    return stream;
+}
+
+std::vector<unsigned char> png_file(const std::vector<std::vector<unsigned char>>& chunks) {
+    std::vector<unsigned char> file{0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+    for (const auto& chunk : chunks) {
+        file.insert(file.end(), chunk.begin(), chunk.end());
+    }
+    return file;
+}
+
+std::vector<PngByte> as_png_bytes(const std::vector<unsigned char>& bytes) {
+    return std::vector<PngByte>(bytes.begin(), bytes.end());
+}
@@ -0,0 +1,550 @@
+#include "validate.h"
+#include "row_pipeline.h"
+#include "cpu_dispatch.h"
+#include "instrumentation.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+static constexpr unsigned char png_signature[] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+static constexpr uint32_t max_chunk_length = 0x7fffffff;
+static constexpr uint32_t max_dimension = 0x7fffffff;
+static constexpr uint32_t sizeof_IHDR_data = 13;
+static constexpr uint32_t sizeof_acTL_data = 8;
+// The largest chunk whose data is looked at, a palette of 256 entries
+static constexpr std::size_t max_kept_data = 3 * 256;
+// Read size of validate_png_file
+static constexpr std::size_t file_block_size = 1 << 16;
+
+const char* validation_error_name(ValidationError error) {
+    switch (error) {
+        case ValidationError::None: return "none";
+        case ValidationError::CannotRead: return "cannot read";
+        case ValidationError::BadSignature: return "bad signature";
+        case ValidationError::Truncated: return "truncated";
+        case ValidationError::BadChunkLength: return "bad chunk length";
+        case ValidationError::BadChunkName: return "bad chunk name";
+        case ValidationError::BadCrc: return "bad crc";
+        case ValidationError::MissingIHDR: return "missing IHDR";
+        case ValidationError::BadIHDR: return "bad IHDR";
+        case ValidationError::BadChunkOrder: return "bad chunk order";
+        case ValidationError::DuplicateChunk: return "duplicate chunk";
+        case ValidationError::UnknownCriticalChunk: return "unknown critical chunk";
+        case ValidationError::BadPalette: return "bad palette";
+        case ValidationError::MissingPalette: return "missing palette";
+        case ValidationError::BadChunkData: return "bad chunk data";
+        case ValidationError::MissingIDAT: return "missing IDAT";
+        case ValidationError::MissingIEND: return "missing IEND";
+        case ValidationError::BadImageData: return "bad image data";
+        case ValidationError::ImageDataTruncated: return "image data truncated";
+        case ValidationError::TooMuchImageData: return "too much image data";
+        case ValidationError::BadFilterType: return "bad filter type";
+    }
+    return "unknown";
+}
+
+bool PngVerdict::ok() const {
+    return error == ValidationError::None;
+}
+
+enum Placement {
+    Anywhere,
+    BeforePLTE,
+    // After PLTE if there is one
+    BeforeIDATAfterPLTE,
+    BeforeIDAT,
+};
+
+struct ChunkRule {
+    char name[5];
+    Placement placement;
+    bool only_once;
+};
+
+/**
+ * Where the ancillary chunks the spec and APNG place may go. Chunks that
+ * are not listed may appear anywhere and any number of times.
+*/
+static constexpr ChunkRule chunk_rules[] = {
+    {"cHRM", BeforePLTE, true},
+    {"gAMA", BeforePLTE, true},
+    {"iCCP", BeforePLTE, true},
+    {"sBIT", BeforePLTE, true},
+    {"sRGB", BeforePLTE, true},
+    {"bKGD", BeforeIDATAfterPLTE, true},
+    {"hIST", BeforeIDATAfterPLTE, true},
+    {"tRNS", BeforeIDATAfterPLTE, true},
+    {"pHYs", BeforeIDAT, true},
+    {"sPLT", BeforeIDAT, false},
+    {"acTL", BeforeIDAT, true},
+    {"tIME", Anywhere, true},
+};
+static constexpr std::size_t number_of_chunk_rules = sizeof(chunk_rules) / sizeof(chunk_rules[0]);
+
+struct ChunkHeader {
+    uint64_t offset;
+    uint32_t length;
+    unsigned char type[4];
+};
+
+struct Scan {
+    const deflate::ByteSource& file;
+    const Crc32Kernel crc32;
+    PngVerdict& verdict;
+    const unsigned char* input;
+    std::size_t input_left;
+    uint64_t offset;
+
+    // The chunk being read
+    ChunkHeader chunk;
+    uint32_t chunk_left;
+    uint32_t crc;
+    // chunk was read by the IDAT source but not looked at yet
+    bool chunk_pending;
+
+    bool seen_PLTE;
+    bool seen_after_PLTE;
+    bool seen_IDAT;
+    bool IDAT_ended;
+    bool seen_IEND;
+    bool seen_rule[number_of_chunk_rules];
+};
+
+static bool chunk_is(const ChunkHeader& chunk, const char* name) {
+    return std::memcmp(chunk.type, name, 4) == 0;
+}
+
+static uint32_t get_uint32_t_h(const unsigned char* bytes) {
+    return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+           static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+}
+
+/**
+ * @brief records error as found in chunk, or in the signature when chunk
+ * is null, unless an earlier error was recorded.
+ * @return false so callers can stop with return fail_in(...).
+*/
+static bool fail_in(Scan& s, ValidationError error, const ChunkHeader* chunk) {
+    if (s.verdict.error == ValidationError::None) {
+        s.verdict.error = error;
+        if (chunk) {
+            s.verdict.error_offset = chunk->offset;
+            std::memcpy(s.verdict.error_chunk, chunk->type, 4);
+        }
+        BITMAP_TRACE("validate: %s at %llu", validation_error_name(error), static_cast<unsigned long long>(s.verdict.error_offset));
+    }
+    return false;
+}
+
+/**
+ * @brief fail_in() for the chunk being read, or the signature.
+ * @return false so callers can stop with return fail(...).
+*/
+static bool fail(Scan& s, ValidationError error, bool in_chunk = true) {
+    return fail_in(s, error, in_chunk ? &s.chunk : nullptr);
+}
+
+/**
+ * @brief up to max bytes of the file without copying them.
+ * @return false at the end of the file.
+*/
+static bool next_span(Scan& s, const unsigned char*& bytes, std::size_t& size, std::size_t max) {
+    while (s.input_left == 0) {
+        if (!s.file(s.input, s.input_left)) {
+            return false;
+        }
+    }
+    size = std::min(s.input_left, max);
+    bytes = s.input;
+    s.input += size;
+    s.input_left -= size;
+    s.offset += size;
+    return true;
+}
+
+/**
+ * @return how many bytes were read, less than size only at the end of the file.
+*/
+static std::size_t read_bytes(Scan& s, unsigned char* out, std::size_t size) {
+    std::size_t done = 0;
+    const unsigned char* bytes;
+    std::size_t n;
+    while (done < size && next_span(s, bytes, n, size - done)) {
+        std::memcpy(out + done, bytes, n);
+        done += n;
+    }
+    return done;
+}
+
+static bool read_chunk_header(Scan& s) {
+    unsigned char fields[8];
+    s.chunk.offset = s.offset;
+    std::memset(s.chunk.type, 0, 4);
+    const std::size_t got = read_bytes(s, fields, sizeof(fields));
+    if (got == 0) {
+        return fail(s, ValidationError::MissingIEND);
+    }
+    if (got < sizeof(fields)) {
+        return fail(s, ValidationError::Truncated);
+    }
+    s.chunk.length = get_uint32_t_h(fields);
+    std::memcpy(s.chunk.type, fields + 4, 4);
+    s.verdict.number_of_chunks++;
+    for (const unsigned char c : s.chunk.type) {
+        if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))) {
+            return fail(s, ValidationError::BadChunkName);
+        }
+    }
+    if (s.chunk.length > max_chunk_length) {
+        return fail(s, ValidationError::BadChunkLength);
+    }
+    s.chunk_left = s.chunk.length;
+    s.crc = s.crc32(0, s.chunk.type, 4);
+    return true;
+}
+
+/**
+ * @brief reads the rest of the data of the chunk into the CRC and keeps
+ * its first keep_size bytes.
+*/
+static bool read_chunk_data(Scan& s, unsigned char* keep, std::size_t keep_size) {
+    const unsigned char* bytes;
+    std::size_t n;
+    while (s.chunk_left) {
+        if (!next_span(s, bytes, n, s.chunk_left)) {
+            return fail(s, ValidationError::Truncated);
+        }
+        const std::size_t position = s.chunk.length - s.chunk_left;
+        if (position < keep_size) {
+            std::memcpy(keep + position, bytes, std::min(n, keep_size - position));
+        }
+        s.crc = s.crc32(s.crc, bytes, n);
+        s.chunk_left -= static_cast<uint32_t>(n);
+    }
+    return true;
+}
+
+static bool check_crc(Scan& s) {
+    unsigned char stored[4];
+    if (read_bytes(s, stored, sizeof(stored)) < sizeof(stored)) {
+        return fail(s, ValidationError::Truncated);
+    }
+    if (get_uint32_t_h(stored) != s.crc) {
+        return fail(s, ValidationError::BadCrc);
+    }
+    return true;
+}
+
+/**
+ * @brief checks that the chunk just read may appear where it is.
+*/
+static bool check_placement(Scan& s) {
+    const ChunkHeader& chunk = s.chunk;
+    const bool is_IDAT = chunk_is(chunk, "IDAT");
+    if (s.verdict.number_of_chunks == 1) {
+        return chunk_is(chunk, "IHDR") ? true : fail(s, ValidationError::MissingIHDR);
+    }
+    if (s.seen_IDAT && !is_IDAT) {
+        s.IDAT_ended = true;
+    }
+    if (chunk_is(chunk, "IHDR")) {
+        return fail(s, ValidationError::DuplicateChunk);
+    }
+    if (chunk_is(chunk, "PLTE")) {
+        if (s.seen_PLTE) {
+            return fail(s, ValidationError::DuplicateChunk);
+        }
+        if (s.seen_IDAT || s.seen_after_PLTE) {
+            return fail(s, ValidationError::BadChunkOrder);
+        }
+        s.seen_PLTE = true;
+        return true;
+    }
+    if (is_IDAT) {
+        if (s.IDAT_ended) {
+            return fail(s, ValidationError::BadChunkOrder);
+        }
+        if (s.verdict.header.color_type == 3 && !s.seen_PLTE) {
+            return fail(s, ValidationError::MissingPalette);
+        }
+        return true;
+    }
+    if (chunk_is(chunk, "IEND")) {
+        return s.seen_IDAT ? true : fail(s, ValidationError::MissingIDAT);
+    }
+    // Bit 5 of the first byte clear marks a critical chunk.
+    if (!(chunk.type[0] & 0x20)) {
+        return fail(s, ValidationError::UnknownCriticalChunk);
+    }
+    for (std::size_t i = 0; i < number_of_chunk_rules; i++) {
+        const ChunkRule& rule = chunk_rules[i];
+        if (!chunk_is(chunk, rule.name)) {
+            continue;
+        }
+        if (rule.only_once && s.seen_rule[i]) {
+            return fail(s, ValidationError::DuplicateChunk);
+        }
+        s.seen_rule[i] = true;
+        const bool misplaced =
+            (rule.placement == BeforePLTE && (s.seen_PLTE || s.seen_IDAT)) ||
+            (rule.placement == BeforeIDATAfterPLTE && s.seen_IDAT) ||
+            (rule.placement == BeforeIDAT && s.seen_IDAT);
+        if (misplaced) {
+            return fail(s, ValidationError::BadChunkOrder);
+        }
+        if (rule.placement == BeforeIDATAfterPLTE) {
+            s.seen_after_PLTE = true;
+        }
+    }
+    return true;
+}
+
+static bool check_IHDR(Scan& s, const unsigned char* data) {
+    if (s.chunk.length != sizeof_IHDR_data) {
+        return fail(s, ValidationError::BadIHDR);
+    }
+    IHDR& header = s.verdict.header;
+    header.width = get_uint32_t_h(data);
+    header.height = get_uint32_t_h(data + 4);
+    header.bit_depth = data[8];
+    header.color_type = data[9];
+    header.compression_method = data[10];
+    header.filter_method = data[11];
+    header.interlace_method = data[12];
+    if (header.width > max_dimension || header.height > max_dimension || !is_supported_header(header)) {
+        return fail(s, ValidationError::BadIHDR);
+    }
+    return true;
+}
+
+/**
+ * @brief checks the data of the chunks whose size or content depends on
+ * the image, and notes what the png contains.
+*/
+static bool check_chunk_data(Scan& s, const unsigned char* data) {
+    const ChunkHeader& chunk = s.chunk;
+    const IHDR& header = s.verdict.header;
+    if (chunk_is(chunk, "IHDR")) {
+        return check_IHDR(s, data);
+    }
+    if (chunk_is(chunk, "PLTE")) {
+        const uint32_t entries = chunk.length / 3;
+        const bool indexed = header.color_type == 3;
+        if (chunk.length % 3 || entries == 0 || entries > 256 ||
+            (indexed && entries > 1u << header.bit_depth) ||
+            header.color_type == 0 || header.color_type == 4) {
+            return fail(s, ValidationError::BadPalette);
+        }
+        s.verdict.palette_entries = entries;
+        return true;
+    }
+    if (chunk_is(chunk, "tRNS")) {
+        const bool fits =
+            (header.color_type == 0 && chunk.length == 2) ||
+            (header.color_type == 2 && chunk.length == 6) ||
+            (header.color_type == 3 && chunk.length <= s.verdict.palette_entries);
+        if (!fits) {
+            return fail(s, ValidationError::BadChunkData);
+        }
+        s.verdict.has_transparency = true;
+        return true;
+    }
+    if (chunk_is(chunk, "acTL")) {
+        if (chunk.length != sizeof_acTL_data || get_uint32_t_h(data) == 0) {
+            return fail(s, ValidationError::BadChunkData);
+        }
+        s.verdict.is_animated = true;
+        s.verdict.number_of_frames = get_uint32_t_h(data);
+        return true;
+    }
+    if (chunk_is(chunk, "IEND")) {
+        if (chunk.length != 0) {
+            return fail(s, ValidationError::BadChunkLength);
+        }
+        s.seen_IEND = true;
+        return true;
+    }
+    if (chunk_is(chunk, "gAMA") || chunk_is(chunk, "cHRM") || chunk_is(chunk, "sRGB") || chunk_is(chunk, "iCCP")) {
+        s.verdict.has_color_space = true;
+    }
+    return true;
+}
+
+/**
+ * @brief inflates the zlib stream that starts in the IDAT chunk just read
+ * and runs on through the ones after it. Scanlines are only counted and
+ * their filter type checked. Leaves the first chunk after the IDAT chunks
+ * pending.
+*/
+static bool check_image_data(Scan& s) {
+    const IHDR& header = s.verdict.header;
+    s.seen_IDAT = true;
+    s.verdict.number_of_IDAT_chunks++;
+    // Errors in the image data are reported in the last IDAT chunk read,
+    // s.chunk may already be the chunk after it.
+    ChunkHeader last_IDAT = s.chunk;
+
+    const deflate::ByteSource IDAT_data = [&](const unsigned char*& bytes, std::size_t& size) {
+        while (s.chunk_left == 0) {
+            if (!check_crc(s) || !read_chunk_header(s)) {
+                return false;
+            }
+            if (!chunk_is(s.chunk, "IDAT")) {
+                s.chunk_pending = true;
+                return false;
+            }
+            s.verdict.number_of_IDAT_chunks++;
+            last_IDAT = s.chunk;
+        }
+        if (!next_span(s, bytes, size, s.chunk_left)) {
+            return fail(s, ValidationError::Truncated);
+        }
+        s.crc = s.crc32(s.crc, bytes, size);
+        s.chunk_left -= static_cast<uint32_t>(size);
+        s.verdict.compressed_bytes += size;
+        return true;
+    };
+
+    // Walks the scanlines of every pass the way run_row_pipeline cuts them.
+    const int bits = bits_per_pixel(header);
+    const int final_pass = last_pass(header);
+    int pass = header.interlace_method ? 1 : 0;
+    uint32_t row_in_pass = 0;
+    std::size_t row_size = 0;
+    std::size_t row_position = 0;
+    const auto start_pass = [&]() {
+        while (pass <= final_pass && (pass_width(header, pass) == 0 || pass_height(header, pass) == 0)) {
+            pass++;
+        }
+        row_in_pass = 0;
+        row_size = pass <= final_pass ? 1 + bytes_per_row(pass_width(header, pass), bits) : 0;
+    };
+    start_pass();
+    bool bad_filter = false;
+    bool too_much = false;
+    const deflate::ByteSink scanlines = [&](const unsigned char* bytes, std::size_t size) {
+        s.verdict.image_data_bytes += size;
+        while (size && pass <= final_pass) {
+            if (row_position == 0 && bytes[0] > 4) {
+                bad_filter = true;
+                return false;
+            }
+            const std::size_t n = std::min(size, row_size - row_position);
+            row_position += n;
+            bytes += n;
+            size -= n;
+            if (row_position == row_size) {
+                row_position = 0;
+                if (++row_in_pass == pass_height(header, pass)) {
+                    pass++;
+                    start_pass();
+                }
+            }
+        }
+        // Inflating goes on past the last scanline, the Adler-32 at the end
+        // covers everything.
+        too_much = too_much || size;
+        return true;
+    };
+    s.verdict.inflate_status = deflate::inflate_zlib(IDAT_data, scanlines);
+    if (s.verdict.error != ValidationError::None) {
+        // The IDAT source found a bad chunk, inflate only saw its input end.
+        return false;
+    }
+    if ((bad_filter || deflate::is_error(s.verdict.inflate_status)) && !s.chunk_pending) {
+        // A damaged chunk is far more likely than a bad encoder, report it
+        // as such when its CRC says so. Once the source has moved on to the
+        // chunk after the IDAT chunks, their CRCs were all checked.
+        if (!read_chunk_data(s, nullptr, 0) || !check_crc(s)) {
+            return false;
+        }
+    }
+    if (bad_filter) {
+        return fail_in(s, ValidationError::BadFilterType, &last_IDAT);
+    }
+    if (s.verdict.inflate_status == deflate::Status::InputEnded) {
+        return fail_in(s, ValidationError::ImageDataTruncated, &last_IDAT);
+    }
+    if (deflate::is_error(s.verdict.inflate_status)) {
+        return fail_in(s, ValidationError::BadImageData, &last_IDAT);
+    }
+    if (pass <= final_pass) {
+        return fail_in(s, ValidationError::ImageDataTruncated, &last_IDAT);
+    }
+    if (too_much) {
+        return fail_in(s, ValidationError::TooMuchImageData, &last_IDAT);
+    }
+    // Bytes after the end of the zlib stream are ignored, like every
+    // decoder does, but their chunks still have to be intact.
+    const unsigned char* bytes;
+    std::size_t size;
+    while (IDAT_data(bytes, size)) {
+    }
+    return s.verdict.error == ValidationError::None;
+}
+
+PngVerdict validate_png(const deflate::ByteSource& file) {
+    PngVerdict verdict{};
+    Scan s{file, kernels().crc32, verdict, nullptr, 0, 0, {}, 0, 0, false, false, false, false, false, false, {}};
+
+    unsigned char signature[sizeof(png_signature)];
+    if (read_bytes(s, signature, sizeof(signature)) < sizeof(signature) ||
+        std::memcmp(signature, png_signature, sizeof(signature)) != 0) {
+        fail(s, ValidationError::BadSignature, false);
+        return verdict;
+    }
+    while (!s.seen_IEND) {
+        if (!s.chunk_pending && !read_chunk_header(s)) {
+            break;
+        }
+        s.chunk_pending = false;
+        if (!check_placement(s)) {
+            break;
+        }
+        if (chunk_is(s.chunk, "IDAT")) {
+            if (!check_image_data(s)) {
+                break;
+            }
+            continue;
+        }
+        unsigned char data[max_kept_data];
+        const std::size_t keep = std::min<std::size_t>(s.chunk.length, max_kept_data);
+        if (!read_chunk_data(s, data, keep) || !check_crc(s) || !check_chunk_data(s, data)) {
+            break;
+        }
+    }
+    if (s.seen_IEND) {
+        const unsigned char* bytes;
+        std::size_t size;
+        verdict.data_after_IEND = next_span(s, bytes, size, 1);
+    }
+    return verdict;
+}
+
+PngVerdict validate_png(const unsigned char* bytes, std::size_t size) {
+    return validate_png(deflate::buffer_source(bytes, size));
+}
+
+PngVerdict validate_png_file(const std::string& path) {
+    std::ifstream file{path, std::ios::in | std::ios::binary};
+    if (!file.good()) {
+        PngVerdict verdict{};
+        verdict.error = ValidationError::CannotRead;
+        return verdict;
+    }
+    std::vector<unsigned char> block(file_block_size);
+    bool read_failed = false;
+    PngVerdict verdict = validate_png([&](const unsigned char*& span, std::size_t& span_size) {
+        file.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(block.size()));
+        span = block.data();
+        span_size = static_cast<std::size_t>(file.gcount());
+        read_failed = file.bad();
+        return span_size != 0;
+    });
+    if (read_failed) {
+        verdict.error = ValidationError::CannotRead;
+    }
+    return verdict;
+}
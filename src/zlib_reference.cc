@@ -0,0 +1,48 @@
+#include "zlib_reference.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+bool zlib_inflate(
+    const unsigned char* bytes,
+    std::size_t size,
+    bool raw,
+    const std::function<void(const unsigned char* bytes, std::size_t size)>& sink
+) {
+    static thread_local std::vector<unsigned char> output(std::size_t{1} << 18);
+    z_stream stream{};
+    // 15 + 32 takes a zlib or a gzip header, -15 none.
+    if (inflateInit2(&stream, raw ? -15 : 15 + 32) != Z_OK) {
+        return false;
+    }
+    stream.next_in = const_cast<unsigned char*>(bytes);
+    const unsigned char* const end = bytes + size;
+    bool ok = false;
+    for (;;) {
+        // avail_in is 32 bits wide, larger inputs go in a piece at a time.
+        if (stream.avail_in == 0) {
+            stream.avail_in = static_cast<uInt>(std::min<std::size_t>(end - stream.next_in, UINT_MAX));
+        }
+        stream.next_out = output.data();
+        stream.avail_out = static_cast<uInt>(output.size());
+        const int status = inflate(&stream, Z_NO_FLUSH);
+        sink(output.data(), output.size() - stream.avail_out);
+        if (status == Z_STREAM_END) {
+            // Further gzip members follow the way gzip -d reads them,
+            // anything else after the last one is trailing data.
+            if (!raw && end - stream.next_in >= 2 && stream.next_in[0] == 0x1f && stream.next_in[1] == 0x8b) {
+                inflateReset(&stream);
+                continue;
+            }
+            ok = true;
+            break;
+        }
+        if (status != Z_OK) {
+            break;
+        }
+    }
+    inflateEnd(&stream);
+    return ok;
+}